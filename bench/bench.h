@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2023 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+struct BenchOptions {
+    std::vector<size_t> entries;
+    size_t elements;
+    std::vector<size_t> threads;
+};
+
+/**
+ * A single measurement, emitted as one JSON object in the results array.
+ */
+class BenchResult {
+
+private:
+
+    std::string _json;
+
+    BenchResult & field(const char *key, const std::string &raw);
+
+public:
+
+    BenchResult(const char *module, const char *name);
+
+    BenchResult & set(const char *key, const std::string &value);
+
+    BenchResult & set(const char *key, const char *value) {
+        return set(key, std::string(value));
+    }
+
+    BenchResult & set(const char *key, double value);
+
+    BenchResult & set(const char *key, uint64_t value);
+
+    BenchResult & set(const char *key, uint32_t value) {
+        return set(key, static_cast<uint64_t>(value));
+    }
+
+    /**
+     * Sets key_mean_us, key_p50_us and key_p99_us from per-operation samples
+     * given in milliseconds.
+     */
+    BenchResult & latency(const char *key, std::vector<double> samples);
+
+    const std::string & json() const {
+        return _json;
+    }
+};
+
+class Bench {
+
+private:
+
+    std::string _module;
+    std::string _name;
+    std::function<void(const BenchOptions &)> _body;
+
+public:
+
+    Bench(const char *module, const char *name)
+    :   _module(module),
+        _name(name)
+    { }
+
+    Bench & body(const std::function<void(const BenchOptions &)> &body) {
+        _body = body;
+        return *this;
+    }
+
+    const std::string & module() const {
+        return _module;
+    }
+
+    const std::string & name() const {
+        return _name;
+    }
+
+    void run(const BenchOptions &options) const {
+        _body(options);
+    }
+
+    static Bench & create(const char *module, const char *name);
+
+    static std::vector<Bench *> & all();
+};
+
+#define BENCH_CAT2(a, b) a##b
+#define BENCH_CAT(a, b) BENCH_CAT2(a, b)
+
+#define bench(module, name) \
+    static Bench & BENCH_CAT(__bench_, __LINE__) = Bench::create(module, name)
+
+void report(const BenchResult &result);
+
+template <typename F>
+double time_ms(F f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
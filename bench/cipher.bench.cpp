@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2023 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#include <bench.h>
+#include <libcryptopp/aes.h>
+#include <libcryptopp/gcm.h>
+#include <libcryptopp/hmac.h>
+#include <libcryptopp/modes.h>
+#include <libcryptopp/sha.h>
+#include <libcryptopp/cpu.h>
+
+using CryptoPP::byte;
+
+// seal and open throughput of the segment schemes, before version 8 (AES-CBC,
+// then HMAC-SHA256 over the ciphertext) and from it (AES-GCM), on payloads of
+// growing size, processed in place
+bench("cipher", "segment")
+.body([] (const BenchOptions &) {
+    byte key[16] = { 1 }, macKey[32] = { 2 }, iv[16] = { 3 }, tag[32];
+
+    for (size_t mb : { 1, 100, 1024 }) {
+        size_t size = mb << 20;
+        std::vector<byte> data(size, 7);
+        bool ok;
+
+        double cbcSeal = time_ms([&] {
+            CryptoPP::CBC_Mode<CryptoPP::AES>::Encryption enc(key, sizeof(key), iv);
+            enc.ProcessData(data.data(), data.data(), size);
+
+            CryptoPP::HMAC<CryptoPP::SHA256> mac(macKey, sizeof(macKey));
+            mac.CalculateDigest(tag, data.data(), size);
+        });
+
+        double cbcOpen = time_ms([&] {
+            CryptoPP::HMAC<CryptoPP::SHA256> mac(macKey, sizeof(macKey));
+            ok = mac.VerifyDigest(tag, data.data(), size);
+
+            CryptoPP::CBC_Mode<CryptoPP::AES>::Decryption dec(key, sizeof(key), iv);
+            dec.ProcessData(data.data(), data.data(), size);
+        });
+
+        double gcmSeal = time_ms([&] {
+            CryptoPP::GCM<CryptoPP::AES>::Encryption enc;
+            enc.SetKey(key, sizeof(key));
+            enc.EncryptAndAuthenticate(data.data(), tag, 16, iv, 12, nullptr, 0, data.data(), size);
+        });
+
+        double gcmOpen = time_ms([&] {
+            CryptoPP::GCM<CryptoPP::AES>::Decryption dec;
+            dec.SetKey(key, sizeof(key));
+            ok = dec.DecryptAndVerify(data.data(), tag, 16, iv, 12, nullptr, 0, data.data(), size) && ok;
+        });
+
+        report(
+            BenchResult("cipher", "segment")
+            .set("mb", static_cast<uint64_t>(mb))
+            .set("aesni", CryptoPP::HasAESNI() ? "yes" : "no")
+            .set("pclmul", CryptoPP::HasCLMUL() ? "yes" : "no")
+            .set("cbc_hmac_seal_mb_per_s", mb * 1e3 / cbcSeal)
+            .set("cbc_hmac_open_mb_per_s", mb * 1e3 / cbcOpen)
+            .set("gcm_seal_mb_per_s", mb * 1e3 / gcmSeal)
+            .set("gcm_open_mb_per_s", mb * 1e3 / gcmOpen)
+            .set("verified", ok ? "yes" : "no")
+        );
+    }
+});
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2023 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#include <bench.h>
+#include <command_line.h>
+#include <synthetic.h>
+#include <algorithm>
+
+// lines parsed per measurement
+static const size_t LINES = 100000;
+
+// parse throughput for the lines of a typical batch stream, and for single
+// tokens of growing length made mostly of escapes, which should scale linearly
+bench("command_line", "parse")
+.body([] (const BenchOptions &) {
+    std::vector<std::string> lines;
+    for (size_t i = 0; i < LINES; ++i) {
+        auto name = synthetic_name(i);
+        switch (i % 4) {
+        case 0: lines.push_back("add " + name + "." + synthetic_element(i % 3) + " password" + std::to_string(i)); break;
+        case 1: lines.push_back("get " + name); break;
+        case 2: lines.push_back("a 'my " + name + "' \"pass word\""); break;
+        case 3: lines.push_back("remove my\\ " + name + ".user"); break;
+        }
+    }
+
+    size_t parsed = 0;
+    double typical = time_ms([&] {
+        for (const auto &line : lines) parsed += parse_command(line).type != CommandType::INVALID;
+    });
+
+    report(
+        BenchResult("command_line", "parse")
+        .set("lines", static_cast<uint64_t>(LINES))
+        .set("ns_per_line", typical * 1e6 / LINES)
+        .set("valid", static_cast<uint64_t>(parsed))
+    );
+
+    for (size_t len : { 64, 1024, 16384 }) {
+        std::string line("get ");
+        while (line.size() < len) line += "\\ a";
+
+        size_t repeat = std::max<size_t>(1, (1 << 20) / len);
+        double escaped = time_ms([&] {
+            for (size_t i = 0; i < repeat; ++i) parsed += parse_command(line).path.name.size();
+        });
+
+        report(
+            BenchResult("command_line", "parse_escaped")
+            .set("bytes", static_cast<uint64_t>(line.size()))
+            .set("ns_per_byte", escaped * 1e6 / (repeat * line.size()))
+            .set("checksum", static_cast<uint64_t>(parsed))
+        );
+    }
+});
@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) 2023 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#include <bench.h>
+#include <interchange.h>
+#include <synthetic.h>
+
+// entries per dump
+static const size_t ENTRIES = 100000;
+
+// parse throughput of a dump in each format, excluding file I/O and merging
+// into the store
+bench("interchange", "parse")
+.body([] (const BenchOptions &) {
+    std::string csv("name,element,value\n"), json("{");
+    for (size_t i = 0; i < ENTRIES; ++i) {
+        auto name = synthetic_name(i), value = "password" + std::to_string(i);
+        csv += name + ",default," + value + "\n";
+        json += (i ? ",\n\"" : "\n\"") + name + "\": {\"default\": \"" + value + "\"}";
+    }
+    json += "\n}\n";
+
+    for (auto format : { InterchangeFormat::CSV, InterchangeFormat::JSON }) {
+        const auto &text = format == InterchangeFormat::CSV ? csv : json;
+
+        size_t parsed = 0;
+        double ms = time_ms([&] { parsed = parse_entries(text, format).size(); });
+
+        report(
+            BenchResult("interchange", format == InterchangeFormat::CSV ? "parse_csv" : "parse_json")
+            .set("entries", static_cast<uint64_t>(parsed))
+            .set("bytes", static_cast<uint64_t>(text.size()))
+            .set("ms", ms)
+            .set("mb_per_s", text.size() / (ms * 1e3))
+        );
+    }
+});
@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2023 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#include <bench.h>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static std::vector<std::string> results;
+
+BenchResult::BenchResult(const char *module, const char *name) {
+    set("module", module);
+    set("benchmark", name);
+}
+
+BenchResult & BenchResult::field(const char *key, const std::string &raw) {
+    _json += _json.empty() ? "{" : ",";
+    _json += "\"";
+    _json += key;
+    _json += "\":";
+    _json += raw;
+    return *this;
+}
+
+BenchResult & BenchResult::set(const char *key, const std::string &value) {
+    std::string s = "\"";
+    for (auto c : value) {
+        if (c == '"' || c == '\\') s += '\\';
+        s += c;
+    }
+    s += "\"";
+    return field(key, s);
+}
+
+BenchResult & BenchResult::set(const char *key, double value) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.6f", value);
+    return field(key, buf);
+}
+
+BenchResult & BenchResult::set(const char *key, uint64_t value) {
+    return field(key, std::to_string(value));
+}
+
+BenchResult & BenchResult::latency(const char *key, std::vector<double> samples) {
+    if (samples.empty()) return *this;
+
+    std::sort(samples.begin(), samples.end());
+
+    double sum = 0;
+    for (auto x : samples) sum += x;
+
+    auto k = std::string(key);
+    set((k + "_mean_us").c_str(), 1000 * sum / samples.size());
+    set((k + "_p50_us").c_str(), 1000 * samples[samples.size() / 2]);
+    set((k + "_p99_us").c_str(), 1000 * samples[samples.size() * 99 / 100]);
+    return *this;
+}
+
+Bench & Bench::create(const char *module, const char *name) {
+    auto b = new Bench(module, name);
+    all().push_back(b);
+    return *b;
+}
+
+std::vector<Bench *> & Bench::all() {
+    static std::vector<Bench *> benches;
+    return benches;
+}
+
+void report(const BenchResult &result) {
+    results.push_back(result.json() + "}");
+    fprintf(stderr, "%s}\n", result.json().c_str());
+}
+
+static std::vector<size_t> parse_list(const char *s) {
+    std::vector<size_t> v;
+    char *end;
+    while (*s) {
+        size_t x = strtoull(s, &end, 10);
+        if (end == s) break;
+        v.push_back(x);
+        s = (*end == ',') ? end + 1 : end;
+    }
+    return v;
+}
+
+static void usage(const char *prog) {
+    fprintf(
+        stderr,
+        "Usage: %s [options] [module[.benchmark]]...\n"
+        "    -n, --entries <n,...>  : entry counts of the synthetic vaults\n"
+        "    -e, --elements <n>     : elements per entry\n"
+        "    -t, --threads <n,...>  : worker thread counts for scaling runs\n"
+        "    -o, --output <file>    : write JSON results to file instead of stdout\n",
+        prog
+    );
+}
+
+int main(int argc, char **argv) {
+    BenchOptions options;
+    options.entries = { 1000, 10000, 100000, 1000000 };
+    options.elements = 1;
+
+    std::vector<std::string> filters;
+    const char *output = nullptr;
+
+    for (int i = 1; i < argc; ++i) {
+        bool hasValue = i + 1 < argc;
+
+        if ((! strcmp(argv[i], "-n") || ! strcmp(argv[i], "--entries")) && hasValue) {
+            options.entries = parse_list(argv[++i]);
+        }
+        else if ((! strcmp(argv[i], "-e") || ! strcmp(argv[i], "--elements")) && hasValue) {
+            options.elements = strtoull(argv[++i], nullptr, 10);
+        }
+        else if ((! strcmp(argv[i], "-t") || ! strcmp(argv[i], "--threads")) && hasValue) {
+            options.threads = parse_list(argv[++i]);
+        }
+        else if ((! strcmp(argv[i], "-o") || ! strcmp(argv[i], "--output")) && hasValue) {
+            output = argv[++i];
+        }
+        else if (argv[i][0] == '-') {
+            usage(argv[0]);
+            return 1;
+        }
+        else {
+            filters.push_back(argv[i]);
+        }
+    }
+
+    if (options.elements == 0) options.elements = 1;
+
+    for (auto b : Bench::all()) {
+        auto id = b->module() + "." + b->name();
+
+        bool selected = filters.empty();
+        for (const auto &f : filters) {
+            if (f == b->module() || f == id) selected = true;
+        }
+        if (! selected) continue;
+
+        fprintf(stderr, "Running %s\n", id.c_str());
+        b->run(options);
+    }
+
+    FILE *out = output ? fopen(output, "w") : stdout;
+    if (out == nullptr) {
+        perror(output);
+        return 1;
+    }
+
+    fprintf(out, "[\n");
+    for (size_t i = 0; i < results.size(); ++i) {
+        fprintf(out, "    %s%s\n", results[i].c_str(), i + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "]\n");
+
+    if (output) fclose(out);
+
+    return 0;
+}
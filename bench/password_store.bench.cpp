@@ -0,0 +1,358 @@
+/*
+ * Copyright (c) 2023 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#include <bench.h>
+#include <synthetic.h>
+#include <password_store.h>
+#include <worker_pool.h>
+#include <file.h>
+#include <algorithm>
+#include <random>
+#include <thread>
+#include <malloc.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <unistd.h>
+
+static const char *BENCH_FILE = "password_store.bench";
+
+// number of sampled operations for per-operation latencies
+static const size_t SAMPLES = 1000;
+
+static void write_store(const PasswordStore &s) {
+    File(BENCH_FILE).open(File::CREATE | File::TRUNCATE);
+    (OutputFileSerializer(File(BENCH_FILE)) << s).flush();
+}
+
+static void read_store(PasswordStore &s) {
+    InputFileSerializer(File(BENCH_FILE)) >> s;
+}
+
+// bytes currently allocated on the heap
+static size_t heap_used() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    return mallinfo2().uordblks;
+#else
+    return 0;
+#endif
+}
+
+// latencies of the user-facing operations on a vault of each size. Open is
+// split into key derivation, measured once with the default parameters, and
+// decryption and decoding, measured with a trivial KDF: LAZY opens decrypt
+// names and elements only, EAGER opens decrypt every value as well
+bench("password_store", "operations")
+.body([] (const BenchOptions &options) {
+    auto kdf = KdfParameters::defaults();
+    std::string key(96, '\0');
+    double kdfTime = time_ms([&] {
+        kdf.derive("password", "0123456789abcdef", reinterpret_cast<uint8_t *>(&key[0]), key.size());
+    });
+
+    for (auto entries : options.entries) {
+        std::mt19937_64 rng(entries);
+        std::uniform_int_distribution<size_t> pick(0, entries - 1);
+
+        {
+            PasswordStore s("password");
+            populate(s, entries, options.elements);
+            s.rekey(KdfParameters { KdfAlgorithm::PBKDF2_SHA256, 1, 0, 0 });
+            write_store(s);
+        }
+
+        double openEager;
+        {
+            PasswordStore eager("password", OpenMode::EAGER);
+            openEager = time_ms([&] { read_store(eager); });
+        }
+
+        // reading through a mapping of the file leaves the sealed segments and
+        // values there instead of copying them to the heap; the store must go
+        // before the file is rewritten in place below
+        double openMapped;
+        size_t mappedHeap;
+        {
+            size_t before = heap_used();
+            PasswordStore mapped("password", OpenMode::LAZY);
+            openMapped = time_ms([&] { mapped.readFile(BENCH_FILE); });
+            mappedHeap = heap_used() - before;
+        }
+
+        size_t before = heap_used();
+        PasswordStore s("password", OpenMode::LAZY);
+        double openLazy = time_ms([&] { read_store(s); });
+        size_t lazyHeap = heap_used() - before;
+
+        // the first listing builds the name index; later ones reuse it
+        size_t listed = 0;
+        double listFirst = time_ms([&] {
+            for (const auto &n : s.names()) listed += n.size();
+        });
+        double listNext = time_ms([&] {
+            for (const auto &n : s.names()) listed += n.size();
+        });
+
+        // completing a prefix that typically matches a handful of names
+        std::vector<double> complete, get, remove;
+        for (size_t i = 0; i < SAMPLES; ++i) {
+            auto name = synthetic_name(pick(rng));
+            auto prefix = name.substr(0, std::min(name.size(), std::string("entry").size() + 3));
+            complete.push_back(time_ms([&] {
+                for (const auto &n : s.names(prefix)) listed += n.size();
+            }));
+        }
+
+        // values are decrypted on first access in LAZY mode
+        for (size_t i = 0; i < SAMPLES; ++i) {
+            auto name = synthetic_name(pick(rng));
+            get.push_back(time_ms([&] {
+                listed += s.get(name, "default").size();
+            }));
+        }
+
+        std::vector<size_t> victims(entries);
+        for (size_t i = 0; i < entries; ++i) victims[i] = i;
+        std::shuffle(victims.begin(), victims.end(), rng);
+        victims.resize(std::min(entries, SAMPLES));
+
+        for (auto i : victims) {
+            auto name = synthetic_name(i);
+            remove.push_back(time_ms([&] { s.remove(name); }));
+        }
+
+        // only the segments touched by the removals are re-encrypted
+        double writeIncremental = time_ms([&] { write_store(s); });
+
+        s.passwords();
+        double writeFull = time_ms([&] { write_store(s); });
+
+        report(
+            BenchResult("password_store", "operations")
+            .set("entries", static_cast<uint64_t>(entries))
+            .set("elements", static_cast<uint64_t>(options.elements))
+            .set("kdf", kdf.str())
+            .set("kdf_ms", kdfTime)
+            .set("open_lazy_ms", openLazy)
+            .set("open_eager_ms", openEager)
+            .set("open_mapped_ms", openMapped)
+            .set("open_lazy_heap_bytes", static_cast<uint64_t>(lazyHeap))
+            .set("open_mapped_heap_bytes", static_cast<uint64_t>(mappedHeap))
+            .set("list_first_ms", listFirst)
+            .set("list_ms", listNext)
+            .latency("complete", complete)
+            .latency("get", get)
+            .latency("remove", remove)
+            .set("write_incremental_ms", writeIncremental)
+            .set("write_full_ms", writeFull)
+            .set("checksum", static_cast<uint64_t>(listed))
+        );
+    }
+
+    File(BENCH_FILE).remove();
+});
+
+// file size, full write and lazy open time for each deflate level, 0 being
+// uncompressed, with a trivial KDF
+bench("password_store", "compression")
+.body([] (const BenchOptions &options) {
+    for (auto entries : options.entries) {
+        PasswordStore s("password");
+        populate(s, entries, options.elements);
+        s.rekey(KdfParameters { KdfAlgorithm::PBKDF2_SHA256, 1, 0, 0 });
+
+        for (uint32_t level : { 0, 1, 6, 9 }) {
+            s.recompress(CompressionParameters::deflate(level));
+            double write = time_ms([&] { write_store(s); });
+
+            int fd = ::open(BENCH_FILE, O_RDONLY);
+            uint64_t size = ::lseek(fd, 0, SEEK_END);
+            ::close(fd);
+
+            PasswordStore r("password", OpenMode::LAZY);
+            double open = time_ms([&] { read_store(r); });
+
+            report(
+                BenchResult("password_store", "compression")
+                .set("entries", static_cast<uint64_t>(entries))
+                .set("elements", static_cast<uint64_t>(options.elements))
+                .set("compression", s.compression().str())
+                .set("file_bytes", size)
+                .set("write_full_ms", write)
+                .set("open_lazy_ms", open)
+            );
+        }
+    }
+
+    File(BENCH_FILE).remove();
+});
+
+// glob matching of a prefix pattern that typically matches a handful of
+// names, through a range scan of the name index, against testing every name
+bench("password_store", "match")
+.body([] (const BenchOptions &options) {
+    for (auto entries : options.entries) {
+        std::mt19937_64 rng(entries);
+        std::uniform_int_distribution<size_t> pick(0, entries - 1);
+
+        PasswordStore s("password");
+        populate(s, entries, options.elements);
+        s.names();
+
+        size_t matched = 0;
+        std::vector<double> scan, full;
+        for (size_t i = 0; i < SAMPLES; ++i) {
+            auto name = synthetic_name(pick(rng));
+            auto pattern = name.substr(0, std::min(name.size(), std::string("entry").size() + 3)) + "*";
+
+            scan.push_back(time_ms([&] { matched += s.match(pattern).size(); }));
+            full.push_back(time_ms([&] {
+                for (const auto &n : s.names()) {
+                    if (fnmatch(pattern.c_str(), n.c_str(), 0) == 0) ++matched;
+                }
+            }));
+        }
+
+        report(
+            BenchResult("password_store", "match")
+            .set("entries", static_cast<uint64_t>(entries))
+            .latency("range_scan", scan)
+            .latency("full_scan", full)
+            .set("checksum", static_cast<uint64_t>(matched))
+        );
+    }
+});
+
+// memory footprint and lookup latency of the flat entry table, against the
+// nested map that passwords() builds from it. Footprints are heap growth, so
+// they include allocator overhead, and are reported as zero where the heap
+// cannot be inspected
+bench("password_store", "layout")
+.body([] (const BenchOptions &options) {
+    for (auto entries : options.entries) {
+        std::mt19937_64 rng(entries);
+        std::uniform_int_distribution<size_t> pick(0, entries - 1);
+        size_t values = entries * options.elements;
+
+        size_t before = heap_used();
+        PasswordStore s("password");
+        populate(s, entries, options.elements);
+        s.takeJournal();
+        size_t flat = heap_used() - before;
+
+        before = heap_used();
+        const auto &nested = static_cast<const PasswordStore &>(s).passwords();
+        size_t nestedSize = heap_used() - before;
+
+        size_t found = 0;
+        std::vector<double> flatGet, nestedGet;
+        for (size_t i = 0; i < SAMPLES; ++i) {
+            auto name = synthetic_name(pick(rng));
+            flatGet.push_back(time_ms([&] {
+                found += s.get(name, "default").size();
+            }));
+            nestedGet.push_back(time_ms([&] {
+                found += nested.get(name).get("default").size();
+            }));
+        }
+
+        report(
+            BenchResult("password_store", "layout")
+            .set("entries", static_cast<uint64_t>(entries))
+            .set("elements", static_cast<uint64_t>(options.elements))
+            .set("table_bytes_per_value", static_cast<double>(s.memory()) / values)
+            .set("flat_bytes_per_value", static_cast<double>(flat) / values)
+            .set("nested_bytes_per_value", static_cast<double>(nestedSize) / values)
+            .latency("flat_get", flatGet)
+            .latency("nested_get", nestedGet)
+            .set("checksum", static_cast<uint64_t>(found))
+        );
+    }
+});
+
+// find latency by kind of pattern: a substring of a few names, one of nearly
+// every name, a subsequence that is no substring, and a pattern matching
+// nothing, which scans everything twice. The first find builds the search
+// buffer
+bench("password_store", "find")
+.body([] (const BenchOptions &options) {
+    for (auto entries : options.entries) {
+        std::mt19937_64 rng(entries);
+        std::uniform_int_distribution<size_t> pick(0, entries - 1);
+
+        PasswordStore s("password");
+        populate(s, entries, options.elements);
+
+        size_t found = 0;
+        double build = time_ms([&] { found += s.find("entry").size(); });
+
+        std::vector<double> substring, broad, fuzzy, none;
+        for (size_t i = 0; i < SAMPLES / 10; ++i) {
+            auto name = synthetic_name(pick(rng));
+            auto tail = name.substr(name.size() - std::min<size_t>(name.size() - 3, 4));
+            auto sparse = name.substr(0, 1) + name.substr(3);
+
+            substring.push_back(time_ms([&] { found += s.find(tail).size(); }));
+            broad.push_back(time_ms([&] { found += s.find("e").size(); }));
+            fuzzy.push_back(time_ms([&] { found += s.find(sparse).size(); }));
+            none.push_back(time_ms([&] { found += s.find("zzz").size(); }));
+        }
+
+        report(
+            BenchResult("password_store", "find")
+            .set("entries", static_cast<uint64_t>(entries))
+            .set("elements", static_cast<uint64_t>(options.elements))
+            .set("build_ms", build)
+            .latency("substring", substring)
+            .latency("broad", broad)
+            .latency("fuzzy", fuzzy)
+            .latency("none", none)
+            .set("checksum", static_cast<uint64_t>(found))
+        );
+    }
+});
+
+// encryption and decryption throughput as a function of worker threads; the
+// KDF is reduced to a single PBKDF2 iteration so that it does not dominate
+bench("password_store", "scaling")
+.body([] (const BenchOptions &options) {
+    auto threads = options.threads;
+    if (threads.empty()) {
+        for (size_t t = 1; t <= std::thread::hardware_concurrency(); t *= 2) threads.push_back(t);
+    }
+
+    for (auto entries : options.entries) {
+        PasswordStore s("password");
+        populate(s, entries, options.elements);
+        s.rekey(KdfParameters { KdfAlgorithm::PBKDF2_SHA256, 1, 0, 0 });
+
+        for (auto t : threads) {
+            WorkerPool::shared().resize(t);
+
+            // passwords() marks every segment for re-encryption
+            s.passwords();
+            double write = time_ms([&] {
+                File(BENCH_FILE).open(File::CREATE | File::TRUNCATE);
+                (OutputFileSerializer(File(BENCH_FILE)) << s).flush();
+            });
+
+            PasswordStore r("password");
+            double read = time_ms([&] {
+                InputFileSerializer(File(BENCH_FILE)) >> r;
+            });
+
+            report(
+                BenchResult("password_store", "scaling")
+                .set("entries", static_cast<uint64_t>(entries))
+                .set("elements", static_cast<uint64_t>(options.elements))
+                .set("threads", static_cast<uint64_t>(t))
+                .set("write_ms", write)
+                .set("read_ms", read)
+            );
+        }
+    }
+
+    WorkerPool::shared().resize(0);
+    File(BENCH_FILE).remove();
+});
@@ -0,0 +1,29 @@
+/*
+ * Copyright (c) 2023 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#pragma once
+
+#include <password_store.h>
+#include <string>
+
+inline std::string synthetic_name(size_t i) {
+    return "entry" + std::to_string(i);
+}
+
+inline std::string synthetic_element(size_t j) {
+    return j == 0 ? "default" : "element" + std::to_string(j);
+}
+
+/**
+ * Fills a store with entries names of elements elements each.
+ */
+inline void populate(PasswordStore &s, size_t entries, size_t elements) {
+    for (size_t i = 0; i < entries; ++i) {
+        auto name = synthetic_name(i);
+        for (size_t j = 0; j < elements; ++j) {
+            s.put(name, synthetic_element(j), "password" + std::to_string(i * 31 + j));
+        }
+    }
+}
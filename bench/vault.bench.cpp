@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2023 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#include <bench.h>
+#include <synthetic.h>
+#include <vault.h>
+#include <unistd.h>
+
+static const char *BENCH_FILE = "vault.bench";
+
+// saves are fsync-bound, so fewer are sampled
+static const size_t SAMPLES = 100;
+
+static void remove_vault() {
+    auto path = std::string(BENCH_FILE);
+    ::unlink(path.c_str());
+    ::unlink((path + ".tmp").c_str());
+    ::unlink((path + ".journal").c_str());
+    ::unlink((path + ".journal.next").c_str());
+}
+
+// cost of saving a single change through the journal, against writing a
+// whole new snapshot
+bench("vault", "save")
+.body([] (const BenchOptions &options) {
+    for (auto entries : options.entries) {
+        remove_vault();
+
+        PasswordStore s("password");
+        populate(s, entries, options.elements);
+        s.rekey(KdfParameters { KdfAlgorithm::PBKDF2_SHA256, 1, 0, 0 });
+
+        // compaction is disabled so that every save is a journal append
+        Vault v(BENCH_FILE, s, static_cast<size_t>(-1));
+        double snapshot = time_ms([&] { v.save(); });
+
+        std::vector<double> save;
+        for (size_t i = 0; i < SAMPLES; ++i) {
+            s.put(synthetic_name(i % entries), "default", "changed" + std::to_string(i));
+            save.push_back(time_ms([&] { v.save(); }));
+        }
+
+        double compact = time_ms([&] { v.compact(); });
+        v.close();
+
+        report(
+            BenchResult("vault", "save")
+            .set("entries", static_cast<uint64_t>(entries))
+            .set("elements", static_cast<uint64_t>(options.elements))
+            .set("snapshot_ms", snapshot)
+            .latency("journal_save", save)
+            .set("compact_ms", compact)
+        );
+    }
+
+    remove_vault();
+});
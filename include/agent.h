@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2023 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#pragma once
+
+#include <password_store.h>
+#include <vault.h>
+#include <functional>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+enum class AgentOp : uint8_t {
+    GET,
+    COPY,
+    ADD,
+    LIST,
+    STOP,
+    __AGENT_OP_MAX
+};
+
+enum class AgentStatus : uint8_t {
+    OK,
+    NOT_FOUND,
+    ERROR,
+};
+
+/**
+ * A request or response exchanged with the agent. On the wire, a message is
+ * its 32-bit length, followed by its code (an AgentOp or AgentStatus) and its
+ * fields, each prefixed by its 32-bit length.
+ */
+struct AgentMessage {
+    uint8_t code;
+    std::vector<std::string> fields;
+};
+
+bool agent_send(int fd, const AgentMessage &message);
+
+bool agent_receive(int fd, AgentMessage &message);
+
+/**
+ * Keeps an unlocked store resident and serves requests over a Unix domain
+ * socket, which only the owning user can connect to. Requests are served one
+ * connection at a time, and the agent exits once idle for the timeout.
+ *
+ * Requests and the fields of their successful responses:
+ *  - GET name element: the value, or element/value pairs when element is
+ *    empty, default first
+ *  - COPY name element: copies the value to the clipboard, using the
+ *    function given to the agent
+ *  - ADD name element value: adds the value and saves the vault
+ *  - LIST name: all names when name is empty, otherwise its elements
+ *  - STOP: stops the agent
+ */
+class Agent {
+
+private:
+
+    static const std::function<void(Agent &, const AgentMessage &, AgentMessage &)> handler[];
+
+    std::string _path;
+    PasswordStore &_store;
+    Vault &_vault;
+    unsigned _timeout;
+    std::function<bool(const std::string &)> _copy;
+    int _socket;
+    bool _stop;
+
+    void handle(int client);
+
+public:
+
+    /**
+     * A timeout of zero means the agent never expires.
+     */
+    Agent(
+        const std::string &path,
+        PasswordStore &store,
+        Vault &vault,
+        unsigned timeout,
+        const std::function<bool(const std::string &)> &copy
+    );
+
+    Agent(const Agent &) = delete;
+
+    Agent & operator=(const Agent &) = delete;
+
+    ~Agent();
+
+    /**
+     * Creates the socket. Throws if another agent is already listening on it.
+     */
+    void listen();
+
+    /**
+     * Serves requests until the idle timeout expires, a STOP request is
+     * received, or the process is signalled.
+     */
+    void serve();
+};
+
+class AgentClient {
+
+private:
+
+    int _socket;
+
+public:
+
+    /**
+     * Connects to the agent listening on path. Throws if there is none.
+     */
+    explicit AgentClient(const std::string &path);
+
+    AgentClient(const AgentClient &) = delete;
+
+    AgentClient & operator=(const AgentClient &) = delete;
+
+    ~AgentClient();
+
+    AgentMessage request(AgentOp op, const std::vector<std::string> &fields);
+};
@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2023 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#pragma once
+
+#include <string>
+
+/**
+ * Name of the function exported by clipboard plugins, with the signature
+ * extern "C" bool (const char *text, size_t size).
+ */
+#define CLIPBOARD_PLUGIN_SYMBOL "pwdman_clipboard_set_text"
+
+/**
+ * A way of putting text on the clipboard.
+ */
+class ClipboardBackend {
+
+public:
+
+    virtual ~ClipboardBackend() { }
+
+    virtual const char * name() const = 0;
+
+    /**
+     * Where setText() puts text, as told to the user, e.g. "copied to the X11
+     * clipboard".
+     */
+    virtual const char * destination() const = 0;
+
+    virtual bool setText(const std::string &text) = 0;
+
+    /**
+     * The backend in use, chosen on the first call. With a display, this is
+     * the X11 backend, which is loaded from a plugin so that its libraries are
+     * only mapped when the clipboard is actually used. Without a display, or
+     * if the plugin cannot be loaded, text is handed to the terminal using
+     * the OSC 52 escape sequence instead.
+     */
+    static ClipboardBackend & get();
+
+    /**
+     * Why get() fell back to the terminal although there is a display, i.e.
+     * why the X11 plugin could not be loaded; empty otherwise.
+     */
+    static const std::string & warning();
+};
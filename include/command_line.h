@@ -1,12 +1,16 @@
 #pragma once
 
+#include <string_ref.h>
 #include <string>
+#include <vector>
 #include <stdint.h>
 
 #define CMD_MAX 1024
 #define PASS_MAX 1024
 
 struct PasswordPath {
+    // the vault the path is in, if given as a vault: prefix
+    std::string vault;
     std::string name;
     std::string element;
 };
@@ -22,6 +26,12 @@ enum class CommandType : uint8_t {
     WRITE,
     QUIT,
     WRITE_QUIT,
+    TUNE,
+    FIND,
+    STATS,
+    IMPORT,
+    EXPORT,
+    COMPRESS,
     __CMD_MAX
 };
 
@@ -29,21 +39,101 @@ enum class CommandArgs : uint8_t {
     PATH_VAL,
     PATH_ONLY,
     OPT_PATH,
+    OPT_ARG_VAL,
+    OPT_ARG,
+    ARG,
     NONE,
 };
 
 struct Command {
-    std::string cmdStr;
+    // the line the command was parsed from, which must outlive the command
+    StringRef cmdStr;
     CommandType type;
     PasswordPath path;
     std::string value;
+
+    Command()
+    :   cmdStr("", 0)
+    { }
+};
+
+/**
+ * Splits a command line into space-separated tokens in a single pass, without
+ * modifying it. A token may be quoted with ' or ", in which case it extends to
+ * the matching quote; otherwise, a backslash makes the next character part of
+ * the token, so that "my\ pass" is a single token. Tokens are references into
+ * the line, except for those containing escapes, which are unescaped into a
+ * buffer owned by the tokenizer; either remain valid as long as both the line
+ * and the tokenizer do.
+ */
+class Tokenizer {
+
+private:
+
+    const char *_p;
+    const char *_end;
+    std::string _unescaped;
+
+public:
+
+    explicit Tokenizer(StringRef line)
+    :   _p(line.data),
+        _end(line.data + line.size)
+    { }
+
+    /**
+     * Sets token to the next token, which is empty at the end of the line.
+     * Returns false if a quoted token is not terminated.
+     */
+    bool next(StringRef &token, bool quote = true);
+
+    /**
+     * The rest of the line is only spaces.
+     */
+    bool done() const;
+
+    /**
+     * The quote character an unterminated token was expected to end with.
+     */
+    char expected() const {
+        return *_p;
+    }
 };
 
-PasswordPath get_password_path(char *n);
+/**
+ * Splits [vault:]name[.element] at the last dot. The vault is only taken from
+ * a prefix of letters, digits, - and _ followed by a colon.
+ */
+PasswordPath get_password_path(StringRef n);
+
+/**
+ * Whether name can be used as a vault prefix.
+ */
+bool valid_vault_name(StringRef name);
+
+/**
+ * Finds the vault path is in among the open vaults, the first of which is the
+ * default, and drops its vault prefix. The prefix is only taken as a vault when
+ * more than one is open and it names one of them; otherwise it is put back into
+ * the name, so that "https://example.com", or "pwdman:old" in a session with
+ * only the pwdman vault, are names in the default vault. Returns the index of
+ * the vault the prefix named, or -1 if there was none.
+ */
+int resolve_vault(PasswordPath &path, const std::vector<std::string> &vaults);
+
+/**
+ * Whether name is a glob pattern, i.e. has any of *, ? or [ in it.
+ */
+bool glob_pattern(StringRef name);
+
+Command parse_command(StringRef str);
 
-char * get_token(char *&str, bool quote = true);
+/**
+ * The command token names, or INVALID.
+ */
+CommandType command_type(StringRef token);
 
-Command parse_command(char *str);
+const char * command_name(CommandType type);
 
 void get_password(char *password);
 
@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2023 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#pragma once
+
+#include <password_store.h>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/**
+ * Completion candidates for names and name.element paths, as typed on the
+ * command line: escaped, or as is within quotes. The candidates are built once
+ * per store generation, sorted, so that the matches of a prefix are a
+ * contiguous range. When the prefix is extended, as it is while typing, the
+ * previous range is narrowed instead of searching all candidates again.
+ */
+class CompletionCache {
+
+private:
+
+    struct Keys {
+        const PasswordStore *store = nullptr;
+        uint64_t generation = 0;
+        bool quoted = false;
+
+        // the name whose elements are completed, if any
+        std::string scope;
+
+        std::vector<std::string> keys;
+
+        // the last prefix, and the range of keys it matched
+        std::string prefix;
+        size_t first = 0;
+        size_t last = 0;
+
+        bool current(const PasswordStore &s, bool q, const std::string &name) const {
+            return store == &s && generation == s.generation() && quoted == q && scope == name;
+        }
+    };
+
+    Keys _names;
+    Keys _elements;
+
+    static void narrow(Keys &k, const std::string &prefix);
+
+public:
+
+    typedef std::vector<std::string>::const_iterator iterator;
+
+    struct Range {
+        iterator first;
+        iterator last;
+
+        iterator begin() const {
+            return first;
+        }
+
+        iterator end() const {
+            return last;
+        }
+
+        size_t size() const {
+            return last - first;
+        }
+    };
+
+    /**
+     * The candidates starting with text. quoted is set if text is within
+     * quotes, in which case candidates are not escaped. The range remains
+     * valid until the next call.
+     */
+    Range complete(const PasswordStore &store, const std::string &text, bool quoted);
+};
@@ -0,0 +1,512 @@
+/*
+ * Copyright (c) 2023 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#pragma once
+
+#include <secure_arena.h>
+#include <string_ref.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * Meta record for tables that carry none.
+ */
+struct NoMeta { };
+
+/**
+ * Flat hash table of (name, element) -> value entries, each carrying a Meta
+ * record. Entries live in a single open-addressing array, and all strings are
+ * packed into one blob: names and elements are interned, so a name and an
+ * element such as "default" are stored once however many entries use them.
+ * The entries of a name are chained together, so that they can be enumerated
+ * without a nested table.
+ *
+ * Entries are addressed by index. Indices, and StringRefs into the table,
+ * remain valid until the next put() or erase(). The blob, which holds every
+ * name, element and value, is drawn from a SecureArena, by default the shared
+ * one. Discarded strings are wiped, and the blob is compacted once it is
+ * mostly garbage. Offsets are 32-bit, so the blob is limited to 4 GiB.
+ */
+template <typename Meta>
+class EntryTable {
+
+    template <typename> friend class EntryTable;
+
+public:
+
+    static const uint32_t NONE = 0xffffffff;
+
+private:
+
+    static const uint32_t EMPTY = 0xffffffff;
+    static const uint32_t TOMBSTONE = 0xfffffffe;
+    static const size_t MIN_CAPACITY = 16;
+
+    // an interned string; count is the number of entries using it as their
+    // name, and refs the number using it as either name or element
+    struct String {
+        uint32_t hash;
+        uint32_t str;
+        uint32_t first;
+        uint32_t count;
+        uint32_t refs;
+    };
+
+    struct Entry {
+        uint32_t hash;
+        uint32_t name;
+        uint32_t element;
+        uint32_t value;
+        uint32_t next;
+        Meta meta;
+    };
+
+    std::vector<String> _strings;
+    std::vector<Entry> _entries;
+    size_t _stringsUsed = 0;
+    size_t _entriesUsed = 0;
+    size_t _size = 0;
+    size_t _names = 0;
+
+    // strings are stored as their 32-bit length followed by their bytes
+    ArenaAllocator<char> _alloc;
+    char *_blob = nullptr;
+    size_t _blobSize = 0;
+    size_t _blobCapacity = 0;
+    size_t _garbage = 0;
+
+    static uint32_t hash(StringRef s) {
+        // FNV-1a
+        uint64_t h = 0xcbf29ce484222325;
+        for (size_t i = 0; i < s.size; ++i) {
+            h ^= static_cast<uint8_t>(s.data[i]);
+            h *= 0x100000001b3;
+        }
+        return static_cast<uint32_t>(h ^ (h >> 32));
+    }
+
+    static uint32_t hash(uint32_t name, uint32_t element) {
+        return name ^ (element + 0x9e3779b9 + (name << 6) + (name >> 2));
+    }
+
+    static size_t capacity(size_t n) {
+        size_t c = MIN_CAPACITY;
+        while (c < 2 * n) c <<= 1;
+        return c;
+    }
+
+    static bool live(uint32_t str) {
+        return str != EMPTY && str != TOMBSTONE;
+    }
+
+    StringRef stringAt(uint32_t offset) const {
+        uint32_t size;
+        memcpy(&size, _blob + offset, sizeof(size));
+        return StringRef(_blob + offset + sizeof(size), size);
+    }
+
+    uint32_t store(StringRef s) {
+        size_t need = _blobSize + sizeof(uint32_t) + s.size;
+        if (need > _blobCapacity) {
+            size_t c = std::max(need, 2 * _blobCapacity);
+            char *blob = _alloc.allocate(c);
+            if (_blob != nullptr) {
+                memcpy(blob, _blob, _blobSize);
+                _alloc.deallocate(_blob, _blobCapacity);
+            }
+            _blob = blob;
+            _blobCapacity = c;
+        }
+
+        uint32_t offset = _blobSize;
+        uint32_t size = s.size;
+        memcpy(_blob + offset, &size, sizeof(size));
+        memcpy(_blob + offset + sizeof(size), s.data, s.size);
+        _blobSize = need;
+        return offset;
+    }
+
+    void drop(uint32_t offset) {
+        size_t size = sizeof(uint32_t) + stringAt(offset).size;
+        SecureArena::wipe(_blob + offset, size);
+        _garbage += size;
+    }
+
+    uint32_t findString(StringRef s, uint32_t h) const {
+        if (_strings.empty()) return NONE;
+
+        size_t mask = _strings.size() - 1;
+        for (size_t i = h & mask; ; i = (i + 1) & mask) {
+            const auto &x = _strings[i];
+            if (x.str == EMPTY) return NONE;
+            if (x.str != TOMBSTONE && x.hash == h && stringAt(x.str) == s) return i;
+        }
+    }
+
+    uint32_t intern(StringRef s, uint32_t h) {
+        size_t mask = _strings.size() - 1;
+        size_t slot = NONE;
+
+        for (size_t i = h & mask; ; i = (i + 1) & mask) {
+            auto &x = _strings[i];
+            if (x.str == EMPTY) {
+                if (slot == NONE) {
+                    slot = i;
+                    ++_stringsUsed;
+                }
+                break;
+            }
+            if (x.str == TOMBSTONE) {
+                if (slot == NONE) slot = i;
+            }
+            else if (x.hash == h && stringAt(x.str) == s) {
+                return i;
+            }
+        }
+
+        _strings[slot] = String { h, store(s), NONE, 0, 0 };
+        return slot;
+    }
+
+    void release(uint32_t slot) {
+        auto &x = _strings[slot];
+        if (--x.refs == 0) {
+            drop(x.str);
+            x.str = TOMBSTONE;
+        }
+    }
+
+    uint32_t findEntry(StringRef name, StringRef element, uint32_t h) const {
+        if (_entries.empty()) return NONE;
+
+        size_t mask = _entries.size() - 1;
+        for (size_t i = h & mask; ; i = (i + 1) & mask) {
+            const auto &e = _entries[i];
+            if (e.name == EMPTY) return NONE;
+            if (
+                e.name != TOMBSTONE && e.hash == h
+                && stringAt(e.name) == name && stringAt(e.element) == element
+            ) {
+                return i;
+            }
+        }
+    }
+
+    // makes room for one more entry, rebuilding the table when it is too full
+    // or the blob is mostly garbage
+    void reserve() {
+        if (
+            _entries.empty()
+            || 4 * (_entriesUsed + 1) > 3 * _entries.size()
+            || 4 * (_stringsUsed + 2) > 3 * _strings.size()
+            || (_garbage > 4096 && 2 * _garbage > _blobSize)
+        ) {
+            rebuild(_size + 1);
+        }
+    }
+
+    void rebuild(size_t entries, size_t strings = 0, size_t bytes = 0) {
+        EntryTable t(_alloc);
+        t._entries.assign(capacity(entries), Entry { 0, EMPTY, 0, 0, NONE, Meta() });
+        t._strings.assign(capacity(std::max(strings, _stringsUsed) + 2), String { 0, EMPTY, NONE, 0, 0 });
+        t._blobCapacity = std::max<size_t>(std::max(bytes, _blobSize - _garbage), 256);
+        t._blob = _alloc.allocate(t._blobCapacity);
+
+        t.merge(*this);
+        swap(t);
+    }
+
+    void eraseAt(uint32_t i) {
+        auto &e = _entries[i];
+        auto name = findString(stringAt(e.name), hash(stringAt(e.name)));
+        auto element = findString(stringAt(e.element), hash(stringAt(e.element)));
+
+        auto &n = _strings[name];
+        if (n.first == i) {
+            n.first = e.next;
+        }
+        else {
+            uint32_t prev = n.first;
+            while (_entries[prev].next != i) prev = _entries[prev].next;
+            _entries[prev].next = e.next;
+        }
+        if (--n.count == 0) --_names;
+
+        drop(e.value);
+        release(name);
+        release(element);
+
+        e.name = TOMBSTONE;
+        e.meta = Meta();
+        --_size;
+    }
+
+public:
+
+    /**
+     * The blob is allocated with alloc, whose deallocate() must wipe it.
+     */
+    explicit EntryTable(const ArenaAllocator<char> &alloc = ArenaAllocator<char>(&SecureArena::shared()))
+    :   _alloc(alloc)
+    { }
+
+    EntryTable(const EntryTable &other)
+    :   _strings(other._strings),
+        _entries(other._entries),
+        _stringsUsed(other._stringsUsed),
+        _entriesUsed(other._entriesUsed),
+        _size(other._size),
+        _names(other._names),
+        _alloc(other._alloc),
+        _blobSize(other._blobSize),
+        _blobCapacity(other._blobSize),
+        _garbage(other._garbage)
+    {
+        if (other._blob != nullptr) {
+            _blob = _alloc.allocate(_blobCapacity);
+            memcpy(_blob, other._blob, _blobSize);
+        }
+    }
+
+    EntryTable & operator=(EntryTable other) {
+        swap(other);
+        return *this;
+    }
+
+    ~EntryTable() {
+        if (_blob != nullptr) {
+            SecureArena::wipe(_blob, _blobCapacity);
+            _alloc.deallocate(_blob, _blobCapacity);
+        }
+    }
+
+    void swap(EntryTable &other) {
+        std::swap(_strings, other._strings);
+        std::swap(_entries, other._entries);
+        std::swap(_stringsUsed, other._stringsUsed);
+        std::swap(_entriesUsed, other._entriesUsed);
+        std::swap(_size, other._size);
+        std::swap(_names, other._names);
+        std::swap(_alloc, other._alloc);
+        std::swap(_blob, other._blob);
+        std::swap(_blobSize, other._blobSize);
+        std::swap(_blobCapacity, other._blobCapacity);
+        std::swap(_garbage, other._garbage);
+    }
+
+    /**
+     * Number of entries.
+     */
+    size_t size() const {
+        return _size;
+    }
+
+    /**
+     * Number of distinct names.
+     */
+    size_t names() const {
+        return _names;
+    }
+
+    bool empty() const {
+        return _size == 0;
+    }
+
+    /**
+     * Bytes allocated for the table and its strings.
+     */
+    size_t memory() const {
+        return _strings.capacity() * sizeof(String) + _entries.capacity() * sizeof(Entry) + _blobCapacity;
+    }
+
+    void clear() {
+        EntryTable(_alloc).swap(*this);
+    }
+
+    SecureArena * arena() const {
+        return _alloc.arena();
+    }
+
+    /**
+     * Index of the first entry of name, or NONE.
+     */
+    uint32_t first(StringRef name) const {
+        auto i = findString(name, hash(name));
+        return i == NONE ? NONE : _strings[i].first;
+    }
+
+    /**
+     * Index of the entry following i in its name's chain, or NONE.
+     */
+    uint32_t next(uint32_t i) const {
+        return _entries[i].next;
+    }
+
+    uint32_t find(StringRef name, StringRef element) const {
+        return findEntry(name, element, hash(hash(name), hash(element)));
+    }
+
+    bool contains(StringRef name) const {
+        return first(name) != NONE;
+    }
+
+    bool contains(StringRef name, StringRef element) const {
+        return find(name, element) != NONE;
+    }
+
+    StringRef name(uint32_t i) const {
+        return stringAt(_entries[i].name);
+    }
+
+    StringRef element(uint32_t i) const {
+        return stringAt(_entries[i].element);
+    }
+
+    StringRef value(uint32_t i) const {
+        return stringAt(_entries[i].value);
+    }
+
+    Meta & meta(uint32_t i) {
+        return _entries[i].meta;
+    }
+
+    const Meta & meta(uint32_t i) const {
+        return _entries[i].meta;
+    }
+
+    /**
+     * Replaces the value of entry i, keeping its Meta record.
+     */
+    void setValue(uint32_t i, StringRef value) {
+        auto offset = store(value);
+        drop(_entries[i].value);
+        _entries[i].value = offset;
+    }
+
+    /**
+     * Adds or replaces an entry, resetting its Meta record, and returns its
+     * index. New elements are appended to the end of their name's chain.
+     */
+    uint32_t put(StringRef name, StringRef element, StringRef value) {
+        reserve();
+
+        auto hn = hash(name);
+        auto he = hash(element);
+        auto h = hash(hn, he);
+
+        auto i = findEntry(name, element, h);
+        if (i != NONE) {
+            setValue(i, value);
+            _entries[i].meta = Meta();
+            return i;
+        }
+
+        size_t mask = _entries.size() - 1;
+        for (i = h & mask; live(_entries[i].name); i = (i + 1) & mask);
+        if (_entries[i].name == EMPTY) ++_entriesUsed;
+
+        auto n = intern(name, hn);
+        auto el = intern(element, he);
+        ++_strings[n].refs;
+        ++_strings[el].refs;
+
+        _entries[i] = Entry { h, _strings[n].str, _strings[el].str, store(value), NONE, Meta() };
+
+        if (_strings[n].count++ == 0) {
+            _strings[n].first = i;
+            ++_names;
+        }
+        else {
+            uint32_t last = _strings[n].first;
+            while (_entries[last].next != NONE) last = _entries[last].next;
+            _entries[last].next = i;
+        }
+
+        ++_size;
+        return i;
+    }
+
+    bool erase(StringRef name, StringRef element) {
+        auto i = find(name, element);
+        if (i == NONE) return false;
+        eraseAt(i);
+        return true;
+    }
+
+    /**
+     * Erases all entries of name.
+     */
+    bool erase(StringRef name) {
+        auto i = first(name);
+        if (i == NONE) return false;
+
+        while (i != NONE) {
+            auto next = _entries[i].next;
+            eraseAt(i);
+            i = next;
+        }
+        return true;
+    }
+
+    /**
+     * Calls f(i) for every entry.
+     */
+    template <typename F>
+    void forEach(F f) const {
+        for (uint32_t i = 0; i < _entries.size(); ++i) {
+            if (live(_entries[i].name)) f(i);
+        }
+    }
+
+    /**
+     * Calls f(name, first) for every name, with the index of its first entry.
+     */
+    template <typename F>
+    void forEachName(F f) const {
+        for (const auto &x : _strings) {
+            if (live(x.str) && x.count > 0) f(stringAt(x.str), x.first);
+        }
+    }
+
+    /**
+     * Puts all entries of other, with their Meta records, grouped by name.
+     */
+    void merge(const EntryTable &other) {
+        reserveFor(other);
+        other.forEachName([&] (StringRef name, uint32_t first) {
+            for (auto i = first; i != NONE; i = other.next(i)) {
+                meta(put(name, other.element(i), other.value(i))) = other.meta(i);
+            }
+        });
+    }
+
+    /**
+     * Puts every entry of other, with a reset meta record.
+     */
+    template <typename M>
+    void putAll(const EntryTable<M> &other) {
+        reserveFor(other);
+        other.forEachName([&] (StringRef name, uint32_t first) {
+            for (auto i = first; i != NONE; i = other.next(i)) put(name, other.element(i), other.value(i));
+        });
+    }
+
+    /**
+     * Makes room for the entries of other, assuming none of them is present,
+     * so that adding them does not grow the table step by step.
+     */
+    template <typename M>
+    void reserveFor(const EntryTable<M> &other) {
+        size_t entries = _size + other._size;
+        size_t strings = _stringsUsed + other._stringsUsed;
+
+        if (4 * (entries + 1) > 3 * _entries.size() || 4 * (strings + 2) > 3 * _strings.size()) {
+            rebuild(entries, strings, _blobSize - _garbage + other._blobSize - other._garbage);
+        }
+    }
+};
@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2023 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#pragma once
+
+#include <password_store.h>
+#include <entry_table.h>
+#include <string>
+#include <stdint.h>
+
+enum class InterchangeFormat : uint8_t {
+    CSV,
+    JSON,
+};
+
+/**
+ * JSON for paths ending in .json, and CSV otherwise.
+ */
+InterchangeFormat interchange_format(const std::string &path);
+
+/**
+ * Parses a dump of entries, splitting it into chunks of whole records that
+ * are parsed in parallel on the shared worker pool. When a name and element
+ * appear more than once, the last value wins.
+ *
+ * CSV is either the name,element,value layout written by export, or one row
+ * per login as exported by other password managers, with a header naming the
+ * columns: name or title, and any of password, username, url, notes and totp
+ * (login_ prefixed or not), which become the default, user, url, notes and
+ * totp elements. Other columns are ignored, as are empty values.
+ *
+ * JSON is an object of names, each mapping to an object of elements and their
+ * values, as written by export, or directly to a default value.
+ */
+EntryTable<NoMeta> parse_entries(const std::string &text, InterchangeFormat format);
+
+/**
+ * All entries of store, in the layout read back by parse_entries().
+ */
+std::string format_entries(const PasswordStore &store, InterchangeFormat format);
+
+/**
+ * Reads entries from the file at path into store, and returns their number.
+ */
+size_t import_entries(PasswordStore &store, const std::string &path);
+
+/**
+ * Writes all entries of store, unencrypted, to a new file at path that only
+ * its owner can read, and returns their number.
+ */
+size_t export_entries(const PasswordStore &store, const std::string &path);
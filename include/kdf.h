@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2023 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#pragma once
+
+#include <string>
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Upper bounds on the scrypt block size r and lanes p that a password file
+ * may ask for. scrypt itself requires r * p < 2^30.
+ */
+static const uint32_t KDF_MAX_BLOCK_SIZE = 1024;
+static const uint32_t KDF_MAX_PARALLELISM = 64;
+
+enum class KdfAlgorithm : uint32_t {
+    PBKDF2_SHA256,
+    SCRYPT,
+    __KDF_MAX
+};
+
+/**
+ * Key derivation function and cost, as recorded in the password file header.
+ * For PBKDF2, cost is the iteration count. For scrypt, cost is the CPU/memory
+ * cost N, blockSize is r and parallelism is the number of independent lanes p.
+ */
+struct KdfParameters {
+    KdfAlgorithm algorithm;
+    uint64_t cost;
+    uint32_t blockSize;
+    uint32_t parallelism;
+
+    static KdfParameters defaults();
+
+    bool valid() const;
+
+    void derive(
+        const std::string &passphrase,
+        const std::string &salt,
+        uint8_t *key,
+        size_t len
+    ) const {
+        derive(passphrase.data(), passphrase.size(), salt, key, len);
+    }
+
+    void derive(
+        const char *passphrase,
+        size_t size,
+        const std::string &salt,
+        uint8_t *key,
+        size_t len
+    ) const;
+
+    /**
+     * Memory used by a single derivation, in bytes, or UINT64_MAX if that
+     * does not fit.
+     */
+    uint64_t memory() const;
+
+    std::string str() const;
+};
+
+const char * kdf_name(KdfAlgorithm algorithm);
+
+bool kdf_algorithm(const char *name, KdfAlgorithm &algorithm);
+
+/**
+ * Measures the KDF on this machine and returns parameters for the given
+ * algorithm such that a derivation takes about the given number of seconds.
+ */
+KdfParameters tune_kdf(KdfAlgorithm algorithm, uint32_t parallelism, double seconds);
@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2023 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#pragma once
+
+#include <string_ref.h>
+#include <string>
+
+/**
+ * A whole file, mapped read-only. Files are only ever replaced by renaming a
+ * new one over them, so the mapping stays valid, and unchanged, for as long as
+ * it is held, even once the file is replaced.
+ */
+class MappedFile {
+
+private:
+
+    const char *_data;
+    size_t _size;
+
+public:
+
+    /**
+     * Maps the file at path, and starts reading it ahead of a sequential scan.
+     * Throws an Error if it cannot be opened or mapped, or is empty.
+     */
+    explicit MappedFile(const std::string &path);
+
+    MappedFile(const MappedFile &) = delete;
+
+    MappedFile & operator=(const MappedFile &) = delete;
+
+    ~MappedFile();
+
+    const char * data() const {
+        return _data;
+    }
+
+    size_t size() const {
+        return _size;
+    }
+
+    /**
+     * Hints that the rest of the accesses are scattered, so that no more is
+     * read ahead.
+     */
+    void random() const;
+};
+
+/**
+ * Bytes that are either owned, or borrowed from a MappedFile, which must then
+ * outlive them.
+ */
+class Blob {
+
+private:
+
+    std::string _owned;
+    StringRef _borrowed;
+    bool _isBorrowed;
+
+public:
+
+    Blob()
+    :   _borrowed("", 0),
+        _isBorrowed(false)
+    { }
+
+    Blob(std::string owned)
+    :   _owned(std::move(owned)),
+        _borrowed("", 0),
+        _isBorrowed(false)
+    { }
+
+    Blob & operator=(std::string owned) {
+        _owned = std::move(owned);
+        _isBorrowed = false;
+        return *this;
+    }
+
+    void borrow(StringRef bytes) {
+        std::string().swap(_owned);
+        _borrowed = bytes;
+        _isBorrowed = true;
+    }
+
+    bool borrowed() const {
+        return _isBorrowed;
+    }
+
+    const char * data() const {
+        return _isBorrowed ? _borrowed.data : _owned.data();
+    }
+
+    size_t size() const {
+        return _isBorrowed ? _borrowed.size : _owned.size();
+    }
+
+    StringRef ref() const {
+        return StringRef(data(), size());
+    }
+
+    std::string str() const {
+        return std::string(data(), size());
+    }
+};
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2023 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#pragma once
+
+#include <string_ref.h>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+struct SearchResult {
+    std::string name;
+
+    // empty when the name itself matched
+    std::string element;
+
+    // lower is better: substring matches rank above fuzzy ones, then earlier
+    // and tighter matches above later and looser ones, then shorter candidates
+    uint64_t score;
+};
+
+/**
+ * Case-insensitive search over names and name.element paths. Candidates are
+ * lowercased into one packed buffer, separated by newlines, which is scanned
+ * for substring matches with SIMD compares of the pattern's first and last
+ * bytes. Candidates without a substring match are then tested for containing
+ * the pattern as a subsequence, after a cheap check of a per-candidate mask of
+ * the characters it contains. Both passes are split across the shared worker
+ * pool.
+ */
+class NameSearch {
+
+private:
+
+    std::string _text;
+    std::string _folded;
+    std::vector<uint32_t> _offsets;
+    std::vector<uint32_t> _elements;
+    std::vector<uint64_t> _masks;
+
+    static uint64_t mask(const char *s, size_t len);
+
+    SearchResult result(uint32_t candidate, uint64_t score) const;
+
+    uint32_t length(uint32_t candidate) const {
+        return _offsets[candidate + 1] - _offsets[candidate] - 1;
+    }
+
+public:
+
+    static const size_t FIND_LIMIT = 20;
+
+    NameSearch();
+
+    void clear();
+
+    /**
+     * Adds a name, or a name.element path if element is not empty.
+     */
+    void add(StringRef name, StringRef element = StringRef("", 0));
+
+    size_t size() const {
+        return _offsets.size() - 1;
+    }
+
+    /**
+     * The best matches for pattern, at most limit of them, best first.
+     */
+    std::vector<SearchResult> find(const std::string &pattern, size_t limit = FIND_LIMIT) const;
+};
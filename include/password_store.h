@@ -6,37 +6,465 @@
 #pragma once
 
 #include <hash_map.h>
+#include <entry_table.h>
+#include <name_search.h>
+#include <kdf.h>
+#include <secure_arena.h>
+#include <mapped_file.h>
+#include <memory>
+#include <set>
 #include <vector>
+#include <functional>
 #include <serialization.h>
 
 
 using namespace spl;
 
+enum class OpenMode : uint8_t {
+    EAGER,
+    LAZY,
+};
+
+enum class Compression : uint32_t {
+    NONE,
+    DEFLATE,
+    __COMPRESSION_MAX
+};
+
+/**
+ * How segment plaintext is compressed before it is sealed, as recorded in the
+ * password file header. Values are sealed individually, and left as they are.
+ */
+struct CompressionParameters {
+    Compression algorithm;
+    uint32_t level;
+
+    /**
+     * Deflate at level 6.
+     */
+    static CompressionParameters defaults() {
+        return CompressionParameters { Compression::DEFLATE, 6 };
+    }
+
+    /**
+     * Deflate at the given level, from 1 (fastest) to 9 (smallest), or none
+     * for level 0.
+     */
+    static CompressionParameters deflate(uint32_t level) {
+        return CompressionParameters { level ? Compression::DEFLATE : Compression::NONE, level };
+    }
+
+    bool valid() const {
+        return algorithm < Compression::__COMPRESSION_MAX && level <= 9;
+    }
+
+    std::string str() const;
+};
+
 class PasswordStore
 :   public Serializable {
 
+    friend class EntryParser;
+
 protected:
 
-    std::string _passphrase;
-    HashMap<std::string, HashMap<std::string, std::string>> _passwords;
+    /**
+     * An independently encrypted and authenticated slice of the store. Names
+     * are assigned to segments by hash, and the sealed form of each segment is
+     * kept after reading/writing so that clean segments can be written back
+     * without being re-encrypted. Segments read from a mapped file borrow their
+     * sealed form from it.
+     */
+    struct Segment {
+        Blob sealed;
+        Blob values;
+        std::string tag;
+        bool dirty;
+    };
+
+    /**
+     * Location of an individually sealed value within a segment's value blob.
+     * Valid for every value that is unchanged since it was last read or
+     * written, so that it can be copied as-is into rewritten segments.
+     */
+    struct SealedValue {
+        uint32_t segment;
+        uint32_t offset;
+        uint32_t size;
+        bool resident;
+        bool valid;
+    };
+
+    static const std::function<void(PasswordStore &, InputStreamSerializer &)> reader[];
+
+    // holds the passphrase, the derived key and decode buffers; shared by
+    // copies of the store, and wiped once the last of them is destroyed
+    std::shared_ptr<SecureArena> _arena;
+
+    SecureString _passphrase;
+    OpenMode _mode;
+
+    // values are decrypted on first access, so entries are filled in by const
+    // accessors
+    mutable EntryTable<SealedValue> _entries;
+
+    // the map handed out by passwords(); while detached, it is authoritative
+    // and is folded back into _entries on the next access through the store
+    mutable HashMap<std::string, HashMap<std::string, std::string>> _view;
+    mutable bool _detached;
+
+    // sorted index of names, built on first use and then kept up to date by
+    // put()/remove()
+    mutable std::set<std::string> _names;
+    mutable bool _indexed;
+
+    // names and name.element paths for find(), rebuilt on first use after
+    // entries are added or removed
+    mutable NameSearch _search;
+    mutable bool _searchable;
+
+    // bumped whenever names or elements may have been added or removed
+    mutable uint64_t _generation;
+
+    mutable std::string _salt;
+    mutable KdfParameters _kdf;
+    CompressionParameters _compression;
+    mutable SecureString _key;
+    mutable std::vector<Segment> _segments;
+
+    // the file segments were read from, while any of them borrows from it
+    mutable std::shared_ptr<MappedFile> _mapping;
+
+    // format version the segments and values are sealed in, which is that of
+    // the file last read until the next write; 0 if neither happened yet
+    mutable uint32_t _version;
+
+    // random id of the snapshot last read or written, which journal records
+    // are bound to
+    mutable std::string _snapshot;
+
+    // mutations made since the last takeJournal(), encoded as journal
+    // operations
+    std::string _journal;
+    mutable bool _journalable;
+    bool _replaying;
+
+    void record(
+        uint32_t op,
+        const std::string &name,
+        const std::string &element = "",
+        const std::string &value = ""
+    );
+
+    const std::set<std::string> & index() const;
+
+    const NameSearch & search() const;
+
+    void reset();
+
+    template <typename Source>
+    void readSegments(Source &source, uint32_t version);
+
+    void finishRead();
+
+    /**
+     * Writes the whole store from scratch in an older format version, as
+     * releases of that version did, under a key of its own. Only tests use
+     * it, to check that files of every version are still read.
+     */
+    void writeVersion(OutputStreamSerializer &serializer, uint32_t version) const;
+
+    void deriveKey() const;
+
+    void newKey(const KdfParameters &kdf) const;
+
+    void touch(const std::string &name);
+
+    void touchAll();
+
+    void attach() const {
+        if (_detached) absorb();
+    }
+
+    void absorb() const;
+
+    HashMap<std::string, HashMap<std::string, std::string>> materialize() const;
+
+    StringRef resolve(uint32_t i) const;
+
+    void resolveAll() const;
 
 public:
 
-    PasswordStore(const std::string &passphrase)
-    :   _passphrase(passphrase)
+    /**
+     * A range of names in sorted order, iterated in place.
+     */
+    class NameRange {
+
+    private:
+
+        std::set<std::string>::const_iterator _begin;
+        std::set<std::string>::const_iterator _end;
+
+    public:
+
+        NameRange(std::set<std::string>::const_iterator begin, std::set<std::string>::const_iterator end)
+        :   _begin(begin),
+            _end(end)
+        { }
+
+        std::set<std::string>::const_iterator begin() const {
+            return _begin;
+        }
+
+        std::set<std::string>::const_iterator end() const {
+            return _end;
+        }
+
+        bool empty() const {
+            return _begin == _end;
+        }
+    };
+
+    /**
+     * In LAZY mode, only names and elements are decrypted when reading; each
+     * value is decrypted the first time it is accessed. EAGER mode decrypts
+     * everything up front.
+     */
+    PasswordStore(const char *passphrase, OpenMode mode = OpenMode::EAGER)
+    :   _arena(std::make_shared<SecureArena>()),
+        _passphrase(passphrase, ArenaAllocator<char>(_arena.get())),
+        _mode(mode),
+        _entries(ArenaAllocator<char>(_arena.get())),
+        _detached(false),
+        _indexed(false),
+        _searchable(false),
+        _generation(0),
+        _kdf(KdfParameters::defaults()),
+        _compression(CompressionParameters::defaults()),
+        _key(ArenaAllocator<char>(_arena.get())),
+        _version(0),
+        _journalable(false),
+        _replaying(false)
+    { }
+
+    PasswordStore(const std::string &passphrase, OpenMode mode = OpenMode::EAGER)
+    :   _arena(std::make_shared<SecureArena>()),
+        _passphrase(passphrase.data(), passphrase.size(), ArenaAllocator<char>(_arena.get())),
+        _mode(mode),
+        _entries(ArenaAllocator<char>(_arena.get())),
+        _detached(false),
+        _indexed(false),
+        _searchable(false),
+        _generation(0),
+        _kdf(KdfParameters::defaults()),
+        _compression(CompressionParameters::defaults()),
+        _key(ArenaAllocator<char>(_arena.get())),
+        _version(0),
+        _journalable(false),
+        _replaying(false)
     { }
 
+    /**
+     * Wipes the values held in memory and any unsaved journal operations.
+     */
+    ~PasswordStore();
+
+    /**
+     * A password file as of the seal() that produced it: the header and every
+     * sealed segment, copied out of the store so that the file can be written
+     * while the store is in use again.
+     */
+    class Image {
+
+        friend class PasswordStore;
+
+    private:
+
+        std::string _salt;
+        KdfParameters _kdf;
+        std::string _snapshot;
+        CompressionParameters _compression;
+        std::string _indexTag;
+        std::vector<Segment> _segments;
+
+        // keeps segments borrowed from the file last read valid
+        std::shared_ptr<MappedFile> _mapping;
+
+    public:
+
+        const std::string & snapshot() const {
+            return _snapshot;
+        }
+
+        /**
+         * Writes the file, exactly as writeObject() would have.
+         */
+        void write(OutputStreamSerializer &serializer) const;
+    };
+
+    /**
+     * Encrypts whatever changed since the last write, under a new snapshot id,
+     * and returns the resulting file without writing it. The store is then
+     * journalable, as after writeObject(), which is seal() followed by
+     * Image::write().
+     */
+    Image seal() const;
+
     void writeObject(OutputStreamSerializer &serializer) const override;
 
     void readObject(InputStreamSerializer &serializer) override;
 
-    HashMap<std::string, HashMap<std::string, std::string>> & passwords() {
-        return _passwords;
+    /**
+     * Reads the file at path as readObject() would, but from a mapping of the
+     * file: segments are decrypted straight from the mapping, and kept there
+     * rather than copied. The file must only ever be replaced by renaming a
+     * new one over it, as Vault does, and never modified in place.
+     */
+    void readFile(const std::string &path);
+
+    /**
+     * All entries as a nested map. The map is built on demand, and changes
+     * made through it are taken back into the store on its next use, after
+     * which the map is emptied. Such changes cannot be tracked, so all
+     * segments are re-encrypted on the next write. Prefer put()/remove() for
+     * mutations.
+     */
+    HashMap<std::string, HashMap<std::string, std::string>> & passwords();
+
+    const HashMap<std::string, HashMap<std::string, std::string>> & passwords() const;
+
+    bool contains(const std::string &name) const {
+        attach();
+        return _entries.contains(name);
+    }
+
+    bool contains(const std::string &name, const std::string &element) const {
+        attach();
+        return _entries.contains(name, element);
+    }
+
+    HashMap<std::string, std::string> get(const std::string &name) const;
+
+    std::string get(const std::string &name, const std::string &element) const;
+
+    std::vector<std::string> elements(const std::string &name) const;
+
+    /**
+     * Calls f(name, element, value) for every entry, by name in sorted order.
+     * The references are valid during the call only.
+     */
+    void forEach(const std::function<void(StringRef, StringRef, StringRef)> &f) const;
+
+    const KdfParameters & kdf() const {
+        return _kdf;
     }
 
-    const HashMap<std::string, HashMap<std::string, std::string>> & passwords() const {
-        return _passwords;
+    /**
+     * Switches to a new salt and KDF parameters. The key is derived
+     * immediately, and the whole store is re-encrypted on the next write.
+     */
+    void rekey(const KdfParameters &kdf);
+
+    const CompressionParameters & compression() const {
+        return _compression;
     }
 
+    /**
+     * Switches to new compression parameters, which every segment is
+     * rewritten with on the next write.
+     */
+    void recompress(const CompressionParameters &compression);
+
+    void put(const std::string &name, const std::string &element, const std::string &value);
+
+    bool remove(const std::string &name);
+
+    /**
+     * Puts every entry of entries at once, into a table sized for all of
+     * them. Bulk changes are not journaled, so the next save writes a single
+     * snapshot.
+     */
+    void putAll(const EntryTable<NoMeta> &entries);
+
+    bool remove(const std::string &name, const std::string &element);
+
+    /**
+     * Removes each of names, or only their element if given, as a single
+     * batch: the removals end up in the same journal record. Returns the
+     * number of names or elements removed.
+     */
+    size_t removeAll(const std::vector<std::string> &names, const std::string &element = "");
+
+    /**
+     * The names starting with prefix, in sorted order. The range is found in
+     * O(log n) and remains valid until the store is modified.
+     */
+    NameRange names(const std::string &prefix = "") const;
+
     std::vector<std::string> list() const;
+
+    /**
+     * The names matching a glob pattern, in sorted order: * matches any run of
+     * characters, ? any one and [...] any one in a set, as in fnmatch(3). Only
+     * the range of names starting with the pattern's literal prefix is
+     * scanned. A pattern that is itself a name matches only that name, so
+     * that names with special characters in them can still be addressed.
+     */
+    std::vector<std::string> match(const std::string &pattern) const;
+
+    /**
+     * Names and name.element paths matching pattern, best first; see
+     * NameSearch. Elements named default are found through their name.
+     */
+    std::vector<SearchResult> find(const std::string &pattern, size_t limit = NameSearch::FIND_LIMIT) const;
+
+    /**
+     * Changes whenever a name or element is added or removed, so that
+     * structures derived from the names can tell when to rebuild. Changing a
+     * value leaves it as is.
+     */
+    uint64_t generation() const {
+        attach();
+        return _generation;
+    }
+
+    /**
+     * Bytes allocated for the entries held in memory.
+     */
+    size_t memory() const {
+        return _entries.memory();
+    }
+
+    const std::string & snapshot() const {
+        return _snapshot;
+    }
+
+    /**
+     * Whether the changes made since the last snapshot was read or written
+     * are fully described by the journal, i.e. none were made through
+     * passwords() and the key is unchanged. Otherwise, a new snapshot must be
+     * written.
+     */
+    bool journalable() const {
+        return _journalable && ! _snapshot.empty();
+    }
+
+    /**
+     * Returns and clears the operations recorded by put()/remove() since the
+     * last call.
+     */
+    std::string takeJournal();
+
+    /**
+     * Encrypts and authenticates journal operations, binding them to a
+     * snapshot id and their position in the journal.
+     */
+    std::string sealJournal(const std::string &operations, const std::string &snapshot, uint64_t seq) const;
+
+    /**
+     * Verifies a sealed journal record and applies its operations. Returns
+     * false, without applying anything, if the record is not authentic.
+     */
+    bool replayJournal(const std::string &sealed, const std::string &snapshot, uint64_t seq);
 };
@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2023 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/**
+ * Wall-clock time spent in named phases, such as the steps of reading and
+ * writing the store and each command. Disabled by default, in which case
+ * timing a phase costs a single load.
+ */
+class Profiler {
+
+private:
+
+    struct Phase {
+        uint64_t count = 0;
+        double total = 0;
+        double max = 0;
+
+        // at most SAMPLES of them, for percentiles
+        std::vector<double> samples;
+    };
+
+    static const size_t SAMPLES = 65536;
+
+    std::atomic<bool> _enabled;
+    mutable std::mutex _mtx;
+    std::map<std::string, Phase> _phases;
+
+    Profiler()
+    :   _enabled(false)
+    { }
+
+public:
+
+    typedef std::chrono::steady_clock Clock;
+
+    static Profiler & shared();
+
+    bool enabled() const {
+        return _enabled.load(std::memory_order_relaxed);
+    }
+
+    void enable(bool enabled = true) {
+        _enabled = enabled;
+    }
+
+    void record(const std::string &phase, double ms);
+
+    void clear();
+
+    /**
+     * A table of count, total, mean, p50, p90, p99 and max per phase.
+     */
+    std::string str() const;
+
+    /**
+     * The same, as a JSON array with one object per phase.
+     */
+    std::string json() const;
+};
+
+/**
+ * Records the time until it is destroyed, or until stop(), under phase.
+ */
+class ProfileScope {
+
+private:
+
+    const char *_group;
+    const char *_phase;
+    bool _active;
+    Profiler::Clock::time_point _start;
+
+public:
+
+    explicit ProfileScope(const char *phase)
+    :   ProfileScope(nullptr, phase)
+    { }
+
+    /**
+     * Records under group.phase.
+     */
+    ProfileScope(const char *group, const char *phase)
+    :   _group(group),
+        _phase(phase),
+        _active(Profiler::shared().enabled())
+    {
+        if (_active) _start = Profiler::Clock::now();
+    }
+
+    ProfileScope(const ProfileScope &) = delete;
+
+    ProfileScope & operator=(const ProfileScope &) = delete;
+
+    ~ProfileScope() {
+        stop();
+    }
+
+    void stop();
+};
+
+/**
+ * Time spent in a phase entered several times per operation, such as once per
+ * batch of segments, recorded as a single sample.
+ */
+class ProfileTotal {
+
+private:
+
+    const char *_phase;
+    bool _active;
+    double _total = 0;
+    Profiler::Clock::time_point _start;
+
+public:
+
+    explicit ProfileTotal(const char *phase)
+    :   _phase(phase),
+        _active(Profiler::shared().enabled())
+    { }
+
+    void start() {
+        if (_active) _start = Profiler::Clock::now();
+    }
+
+    void stop() {
+        if (_active) _total += std::chrono::duration<double, std::milli>(Profiler::Clock::now() - _start).count();
+    }
+
+    /**
+     * Records the total so far.
+     */
+    void record() {
+        if (_active) Profiler::shared().record(_phase, _total);
+        _active = false;
+    }
+};
@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2023 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+/**
+ * Runs saves on a background thread, so that the caller does not wait for key
+ * derivation, encryption and fsync. Each save has two parts: a prepare
+ * function, which uses the state shared with the caller, and the write
+ * function it returns, which must not. The caller must hold mutex() while
+ * using the shared state; the saver holds it only while preparing, so that
+ * file writes and fsync run without it. Saves requested while one is in
+ * flight are coalesced into a single follow-up save.
+ */
+class BackgroundSaver {
+
+private:
+
+    std::function<std::function<void()>()> _prepare;
+    size_t _autosave;
+
+    std::mutex _sharedMtx;
+    std::mutex _mtx;
+    std::condition_variable _requested;
+    std::condition_variable _done;
+
+    // requests are numbered; each save covers every request made before it
+    // started
+    uint64_t _requests = 0;
+    uint64_t _started = 0;
+    uint64_t _completed = 0;
+    uint64_t _saves = 0;
+    size_t _mutations = 0;
+    bool _failed = false;
+    bool _stop = false;
+    std::vector<std::string> _errors;
+
+    std::thread _thread;
+
+    void loop();
+
+public:
+
+    /**
+     * prepare and the function it returns are called on the background
+     * thread, and report failure by throwing. With a non-zero autosave, a save
+     * is requested every autosave mutations.
+     */
+    explicit BackgroundSaver(const std::function<std::function<void()>()> &prepare, size_t autosave = 0);
+
+    BackgroundSaver(const BackgroundSaver &) = delete;
+
+    BackgroundSaver & operator=(const BackgroundSaver &) = delete;
+
+    /**
+     * Waits for pending saves.
+     */
+    ~BackgroundSaver();
+
+    /**
+     * Guards the state that prepare uses.
+     */
+    std::mutex & mutex() {
+        return _sharedMtx;
+    }
+
+    /**
+     * Requests a save, and returns without waiting for it.
+     */
+    void request();
+
+    /**
+     * Counts n mutations towards the autosave threshold.
+     */
+    void mutated(size_t n = 1);
+
+    /**
+     * Waits until every save requested so far is done, and returns false if
+     * the last of them failed. Must not be called while holding mutex().
+     */
+    bool wait();
+
+    bool saving();
+
+    /**
+     * The number of saves done, counting coalesced requests once.
+     */
+    uint64_t saves();
+
+    /**
+     * The messages of failed saves since the last call.
+     */
+    std::vector<std::string> errors();
+};
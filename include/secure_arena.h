@@ -0,0 +1,157 @@
+/*
+ * Copyright (c) 2023 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stddef.h>
+
+/**
+ * Memory for secrets. Allocations are carved out of large chunks that are
+ * locked into RAM, so they are never swapped out, and excluded from core
+ * dumps. Locking is best effort, since it is subject to RLIMIT_MEMLOCK.
+ *
+ * Blocks are rounded up to a power of two, and freed blocks are zeroized and
+ * kept on a free list per size, from which later allocations of that size
+ * are served. Blocks larger than a chunk get a chunk of their own, which is
+ * released as soon as they are freed. All remaining chunks are zeroized and
+ * released together when the arena is destroyed. Allocation is thread-safe.
+ */
+class SecureArena {
+
+private:
+
+    struct Chunk {
+        char *data;
+        size_t size;
+        size_t used;
+        bool locked;
+    };
+
+    mutable std::mutex _mutex;
+    std::vector<Chunk> _chunks;
+    size_t _chunkSize;
+
+    // freed blocks of MIN_BLOCK << i bytes, by i
+    std::vector<std::vector<char *>> _free;
+    size_t _used = 0;
+
+    Chunk & grow(size_t size);
+
+    void release(char *block, size_t size);
+
+public:
+
+    static const size_t CHUNK_SIZE = 64 * 1024;
+
+    static const size_t MIN_BLOCK = 16;
+
+    explicit SecureArena(size_t chunkSize = CHUNK_SIZE);
+
+    SecureArena(const SecureArena &) = delete;
+
+    SecureArena & operator=(const SecureArena &) = delete;
+
+    ~SecureArena();
+
+    /**
+     * Process-wide arena, for secrets that do not belong to a store, such as
+     * entries being imported.
+     */
+    static SecureArena & shared();
+
+    /**
+     * Returns size bytes aligned for any type. Throws std::bad_alloc if no
+     * memory can be mapped.
+     */
+    void * allocate(size_t size);
+
+    /**
+     * Zeroizes a block returned by allocate(size) and makes it available
+     * again.
+     */
+    void deallocate(void *data, size_t size);
+
+    /**
+     * Bytes in blocks allocated and not yet freed.
+     */
+    size_t size() const;
+
+    /**
+     * Bytes mapped for chunks.
+     */
+    size_t mapped() const;
+
+    /**
+     * Whether data points into one of this arena's chunks.
+     */
+    bool contains(const void *data) const;
+
+    /**
+     * Whether every chunk could be locked into RAM.
+     */
+    bool locked() const;
+
+    /**
+     * Zeroes memory in a way the compiler cannot optimize away.
+     */
+    static void wipe(void *data, size_t size);
+
+    static void wipe(std::string &s) {
+        if (! s.empty()) wipe(&s[0], s.size());
+    }
+};
+
+/**
+ * Standard allocator drawing from a SecureArena.
+ */
+template <typename T>
+class ArenaAllocator {
+
+    template <typename U> friend class ArenaAllocator;
+
+private:
+
+    SecureArena *_arena;
+
+public:
+
+    using value_type = T;
+
+    explicit ArenaAllocator(SecureArena *arena)
+    :   _arena(arena)
+    { }
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U> &other)
+    :   _arena(other._arena)
+    { }
+
+    T * allocate(size_t n) {
+        return static_cast<T *>(_arena->allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T *p, size_t n) {
+        _arena->deallocate(p, n * sizeof(T));
+    }
+
+    SecureArena * arena() const {
+        return _arena;
+    }
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U> &other) const {
+        return _arena == other._arena;
+    }
+
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U> &other) const {
+        return _arena != other._arena;
+    }
+};
+
+using SecureString = std::basic_string<char, std::char_traits<char>, ArenaAllocator<char>>;
@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2023 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#pragma once
+
+#include <string>
+#include <string.h>
+
+/**
+ * A non-owning reference to a string, such as a std::string, bytes held by an
+ * EntryTable, or a token of a command line.
+ */
+struct StringRef {
+    const char *data;
+    size_t size;
+
+    StringRef(const char *data, size_t size)
+    :   data(data),
+        size(size)
+    { }
+
+    StringRef(const char *s)
+    :   data(s),
+        size(strlen(s))
+    { }
+
+    StringRef(const std::string &s)
+    :   data(s.data()),
+        size(s.size())
+    { }
+
+    std::string str() const {
+        return std::string(data, size);
+    }
+
+    bool empty() const {
+        return size == 0;
+    }
+
+    bool operator==(const StringRef &other) const {
+        return size == other.size && memcmp(data, other.data, size) == 0;
+    }
+
+    bool operator!=(const StringRef &other) const {
+        return ! (*this == other);
+    }
+};
@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2023 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#pragma once
+
+#include <password_store.h>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * On-disk home of a PasswordStore: a snapshot file, and an append-only journal
+ * of encrypted records holding the mutations saved since that snapshot. Each
+ * save appends a record, and the journal is folded into a new snapshot in the
+ * background once it grows past a threshold. Snapshots and journals are only
+ * ever replaced by renaming a fully written and synced file over them, so an
+ * interrupted save loses at most the record being written.
+ *
+ * A vault is used by a single Vault at a time, across processes: each holds
+ * an exclusive lock on a .lock file next to the snapshot for as long as it
+ * exists.
+ */
+class Vault {
+
+private:
+
+    std::string _path;
+    std::string _tmpPath;
+    std::string _journalPath;
+    std::string _nextPath;
+    std::string _rejectedPath;
+    int _lock;
+
+    PasswordStore &_store;
+    size_t _threshold;
+
+    // journal of the snapshot currently on disk
+    int _journal;
+    std::string _snapshot;
+    uint64_t _seq;
+    size_t _size;
+
+    // operations taken from the store but not yet durable
+    std::string _pending;
+
+    // background compaction: a copy of the store as of the last save is
+    // written to the temporary path, and records saved in the meantime are
+    // kept so that they can be carried over to the new snapshot's journal
+    std::thread _compactor;
+    std::shared_ptr<PasswordStore> _compacted;
+    std::atomic<bool> _compactDone;
+    std::exception_ptr _compactError;
+    std::vector<std::string> _recent;
+
+    std::string _warning;
+
+    static void writeSnapshot(const PasswordStore::Image &image, const std::string &path);
+
+    size_t writeJournal(const std::string &snapshot, const std::vector<std::string> &sealed);
+
+    void openJournal(const std::string &snapshot, uint64_t seq, size_t size);
+
+    void publish(const std::string &snapshot, const std::vector<std::string> &sealed);
+
+    bool replay(const std::string &path);
+
+    void reject(const std::string &records, uint64_t seq);
+
+    void append(const std::string &sealed);
+
+    std::function<void()> prepareCompact();
+
+    void startCompaction(const std::shared_ptr<PasswordStore> &copy);
+
+    void finishCompaction();
+
+    void abandonCompaction();
+
+public:
+
+    static const size_t COMPACT_THRESHOLD = 256 * 1024;
+
+    /**
+     * The journal is compacted once it exceeds threshold bytes. Throws if
+     * another Vault, in this process or another, has the vault at path.
+     */
+    Vault(const std::string &path, PasswordStore &store, size_t threshold = COMPACT_THRESHOLD);
+
+    Vault(const Vault &) = delete;
+
+    Vault & operator=(const Vault &) = delete;
+
+    ~Vault();
+
+    const std::string & path() const {
+        return _path;
+    }
+
+    bool exists() const;
+
+    /**
+     * Whether a Vault has the vault at path.
+     */
+    static bool inUse(const std::string &path);
+
+    /**
+     * Set by open() when the journal had records past one that failed to
+     * authenticate. Those were moved aside to a .journal.rejected file, and
+     * the store holds the changes up to the last good record.
+     */
+    const std::string & warning() const {
+        return _warning;
+    }
+
+    /**
+     * Reads the snapshot into the store and replays its journal on top.
+     */
+    void open();
+
+    /**
+     * Makes the store's changes since the last save durable. This appends a
+     * journal record, unless the changes cannot be journaled (e.g. after a
+     * rekey, or for files written by older versions), in which case a new
+     * snapshot is written. Same as prepare()().
+     */
+    void save();
+
+    /**
+     * The part of save() that uses the store: takes its changes and seals
+     * them, as a journal record or a whole snapshot. Returns the rest of the
+     * save, which writes, syncs and renames files without touching the store,
+     * so that it can run while the store is in use again. Each returned
+     * function must have run before the next call.
+     */
+    std::function<void()> prepare();
+
+    /**
+     * Writes a new snapshot and an empty journal, waiting for any background
+     * compaction first.
+     */
+    void compact();
+
+    size_t journalSize() const {
+        return _size;
+    }
+
+    bool compacting() const {
+        return _compactor.joinable();
+    }
+
+    /**
+     * Waits for and publishes any background compaction, and closes the
+     * journal.
+     */
+    void close();
+};
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2023 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A fixed set of worker threads that execute indexed tasks. run() blocks until
+ * all indices are processed, with the calling thread taking part. Tasks must
+ * not call run() on the same pool.
+ */
+class WorkerPool {
+
+private:
+
+    std::vector<std::thread> _threads;
+
+    std::mutex _runMtx;
+    std::mutex _mtx;
+    std::condition_variable _start;
+    std::condition_variable _done;
+
+    const std::function<void(size_t)> *_task = nullptr;
+    size_t _n = 0;
+    std::atomic<size_t> _next;
+    size_t _active = 0;
+    uint64_t _generation = 0;
+    bool _stop = false;
+    std::exception_ptr _error;
+
+    void work();
+
+    void loop();
+
+    void start(size_t threads);
+
+    void stop();
+
+public:
+
+    /**
+     * Creates a pool that runs tasks on the given number of threads, including
+     * the caller of run(). Zero means one per hardware thread.
+     */
+    explicit WorkerPool(size_t threads = 0);
+
+    WorkerPool(const WorkerPool &) = delete;
+
+    WorkerPool & operator=(const WorkerPool &) = delete;
+
+    ~WorkerPool();
+
+    size_t size() const {
+        return _threads.size() + 1;
+    }
+
+    void resize(size_t threads);
+
+    void run(size_t n, const std::function<void(size_t)> &task);
+
+    static WorkerPool & shared();
+};
@@ -0,0 +1,14 @@
+/*
+ * Copyright (c) 2023 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+// X11 clipboard backend, built as a plugin so that pwdman itself does not link
+// libclip and its dependencies; see ClipboardBackend
+
+#include <clipboard.h>
+#include <libclip/clip.h>
+
+extern "C" bool pwdman_clipboard_set_text(const char *text, size_t size) {
+    return clip::set_text(std::string(text, size));
+}
@@ -0,0 +1,355 @@
+/*
+ * Copyright (c) 2023 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#include <agent.h>
+#include <error.h>
+#include <chrono>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// upper bound on the size of a message, so that a misbehaving peer cannot make
+// the other side allocate arbitrarily
+static const uint32_t MESSAGE_MAX = 16 * 1024 * 1024;
+
+// a connected client that stops responding is dropped after this long
+static const int CLIENT_TIMEOUT = 5;
+
+static volatile sig_atomic_t signalled = 0;
+
+static void on_signal(int) {
+    signalled = 1;
+}
+
+static bool send_all(int fd, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t n = ::send(fd, data, size, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool receive_all(int fd, char *data, size_t size) {
+    while (size > 0) {
+        ssize_t n = ::recv(fd, data, size, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool socket_address(const std::string &path, sockaddr_un &addr) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) return false;
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+static bool same_user(int fd) {
+#ifdef SO_PEERCRED
+    ucred cred;
+    socklen_t len = sizeof(cred);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0) return false;
+    return cred.uid == getuid();
+#else
+    uid_t uid;
+    gid_t gid;
+    if (getpeereid(fd, &uid, &gid) != 0) return false;
+    return uid == getuid();
+#endif
+}
+
+bool agent_send(int fd, const AgentMessage &message) {
+    std::string data(sizeof(uint32_t), '\0');
+    data.push_back(static_cast<char>(message.code));
+
+    for (const auto &f : message.fields) {
+        uint32_t size = f.size();
+        data.append(reinterpret_cast<const char *>(&size), sizeof(size));
+        data.append(f);
+    }
+
+    uint32_t size = data.size() - sizeof(uint32_t);
+    memcpy(&data[0], &size, sizeof(size));
+
+    return send_all(fd, data.data(), data.size());
+}
+
+bool agent_receive(int fd, AgentMessage &message) {
+    uint32_t size;
+    if (! receive_all(fd, reinterpret_cast<char *>(&size), sizeof(size))) return false;
+    if (size == 0 || size > MESSAGE_MAX) return false;
+
+    std::string data(size, '\0');
+    if (! receive_all(fd, &data[0], size)) return false;
+
+    message.code = static_cast<uint8_t>(data[0]);
+    message.fields.clear();
+
+    size_t pos = 1;
+    while (pos < data.size()) {
+        uint32_t len;
+        if (data.size() - pos < sizeof(len)) return false;
+        memcpy(&len, &data[pos], sizeof(len));
+        pos += sizeof(len);
+
+        if (data.size() - pos < len) return false;
+        message.fields.push_back(data.substr(pos, len));
+        pos += len;
+    }
+
+    return true;
+}
+
+static void respond(AgentMessage &response, AgentStatus status) {
+    response.code = static_cast<uint8_t>(status);
+}
+
+const std::function<void(Agent &, const AgentMessage &, AgentMessage &)> Agent::handler[] = {
+    // GET
+    [] (Agent &agent, const AgentMessage &request, AgentMessage &response) {
+        if (request.fields.size() != 2) throw Error("Malformed request");
+        const auto &name = request.fields[0];
+        const auto &element = request.fields[1];
+
+        if (element.empty() ? ! agent._store.contains(name) : ! agent._store.contains(name, element)) {
+            return respond(response, AgentStatus::NOT_FOUND);
+        }
+
+        if (element.empty()) {
+            if (agent._store.contains(name, "default")) {
+                response.fields.push_back("default");
+                response.fields.push_back(agent._store.get(name, "default"));
+            }
+            for (const auto &x : agent._store.get(name)) {
+                if (x.k == "default") continue;
+                response.fields.push_back(x.k);
+                response.fields.push_back(x.v);
+            }
+        }
+        else {
+            response.fields.push_back(agent._store.get(name, element));
+        }
+
+        respond(response, AgentStatus::OK);
+    },
+
+    // COPY
+    [] (Agent &agent, const AgentMessage &request, AgentMessage &response) {
+        if (request.fields.size() != 2) throw Error("Malformed request");
+        const auto &name = request.fields[0];
+        const auto &element = request.fields[1].empty() ? std::string("default") : request.fields[1];
+
+        if (! agent._store.contains(name, element)) return respond(response, AgentStatus::NOT_FOUND);
+
+        if (! agent._copy(agent._store.get(name, element))) {
+            throw Error("An error occurred while copying data to clipboard");
+        }
+
+        respond(response, AgentStatus::OK);
+    },
+
+    // ADD
+    [] (Agent &agent, const AgentMessage &request, AgentMessage &response) {
+        if (request.fields.size() != 3 || request.fields[0].empty() || request.fields[2].empty()) {
+            throw Error("Malformed request");
+        }
+        const auto &element = request.fields[1].empty() ? std::string("default") : request.fields[1];
+
+        agent._store.put(request.fields[0], element, request.fields[2]);
+        agent._vault.save();
+
+        respond(response, AgentStatus::OK);
+    },
+
+    // LIST
+    [] (Agent &agent, const AgentMessage &request, AgentMessage &response) {
+        if (request.fields.size() != 1) throw Error("Malformed request");
+        const auto &name = request.fields[0];
+
+        if (name.empty()) {
+            for (const auto &n : agent._store.names()) response.fields.push_back(n);
+        }
+        else if (agent._store.contains(name)) {
+            response.fields = agent._store.elements(name);
+        }
+        else {
+            return respond(response, AgentStatus::NOT_FOUND);
+        }
+
+        respond(response, AgentStatus::OK);
+    },
+
+    // STOP
+    [] (Agent &agent, const AgentMessage &request, AgentMessage &response) {
+        agent._stop = true;
+        respond(response, AgentStatus::OK);
+    },
+};
+
+Agent::Agent(
+    const std::string &path,
+    PasswordStore &store,
+    Vault &vault,
+    unsigned timeout,
+    const std::function<bool(const std::string &)> &copy
+)
+:   _path(path),
+    _store(store),
+    _vault(vault),
+    _timeout(timeout),
+    _copy(copy),
+    _socket(-1),
+    _stop(false)
+{ }
+
+Agent::~Agent() {
+    if (_socket >= 0) {
+        ::close(_socket);
+        ::unlink(_path.c_str());
+    }
+}
+
+void Agent::listen() {
+    sockaddr_un addr;
+    if (! socket_address(_path, addr)) throw Error("Agent socket path is too long");
+
+    _socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (_socket < 0) throw Error("Failed to create agent socket");
+
+    // a socket file left behind by an agent that did not exit cleanly is
+    // replaced, but a live agent is not
+    if (::connect(_socket, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0) {
+        ::close(_socket);
+        _socket = -1;
+        throw Error("Agent is already running");
+    }
+    ::unlink(_path.c_str());
+
+    // the socket is created accessible to the owner only
+    auto mask = ::umask(0077);
+    int rc = ::bind(_socket, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+    ::umask(mask);
+
+    if (rc != 0 || ::listen(_socket, 16) != 0) {
+        ::close(_socket);
+        _socket = -1;
+        throw Error("Failed to create agent socket");
+    }
+}
+
+void Agent::handle(int client) {
+    AgentMessage request;
+
+    while (! _stop && agent_receive(client, request)) {
+        AgentMessage response;
+
+        if (request.code < static_cast<uint8_t>(AgentOp::__AGENT_OP_MAX)) {
+            try {
+                handler[request.code](*this, request, response);
+            }
+            catch (const Error &e) {
+                response.code = static_cast<uint8_t>(AgentStatus::ERROR);
+                response.fields.assign(1, e.what());
+            }
+        }
+        else {
+            response.code = static_cast<uint8_t>(AgentStatus::ERROR);
+            response.fields.assign(1, "Unsupported request");
+        }
+
+        if (! agent_send(client, response)) break;
+    }
+}
+
+void Agent::serve() {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+    sigaction(SIGHUP, &sa, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+
+    auto timeout = std::chrono::seconds(_timeout);
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+
+    while (! _stop && ! signalled) {
+        int wait = -1;
+        if (_timeout > 0) {
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now()
+            ).count();
+            if (remaining <= 0) break;
+            wait = static_cast<int>(remaining);
+        }
+
+        pollfd p;
+        p.fd = _socket;
+        p.events = POLLIN;
+        p.revents = 0;
+
+        int rc = ::poll(&p, 1, wait);
+        if (rc < 0 && errno != EINTR) throw Error("Failed to wait for agent requests");
+        if (rc <= 0) continue;
+
+        int client = ::accept(_socket, nullptr, nullptr);
+        if (client < 0) continue;
+
+        if (same_user(client)) {
+            timeval tv;
+            tv.tv_sec = CLIENT_TIMEOUT;
+            tv.tv_usec = 0;
+            setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+            setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+            handle(client);
+            deadline = std::chrono::steady_clock::now() + timeout;
+        }
+
+        ::close(client);
+    }
+}
+
+AgentClient::AgentClient(const std::string &path) {
+    sockaddr_un addr;
+    if (! socket_address(path, addr)) throw Error("Agent socket path is too long");
+
+    _socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (_socket < 0) throw Error("Failed to create agent socket");
+
+    if (::connect(_socket, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+        ::close(_socket);
+        throw Error("Agent is not running");
+    }
+}
+
+AgentClient::~AgentClient() {
+    ::close(_socket);
+}
+
+AgentMessage AgentClient::request(AgentOp op, const std::vector<std::string> &fields) {
+    AgentMessage message { static_cast<uint8_t>(op), fields };
+
+    if (! agent_send(_socket, message) || ! agent_receive(_socket, message)) {
+        throw Error("Lost connection to agent");
+    }
+
+    return message;
+}
@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2023 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#include <clipboard.h>
+#include <libcryptopp/base64.h>
+#include <libcryptopp/filters.h>
+#include <dlfcn.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <vector>
+
+// where 'make install' puts plugins
+#ifndef CLIPBOARD_PLUGIN_DIR
+#define CLIPBOARD_PLUGIN_DIR "/usr/lib/pwdman"
+#endif
+
+static const char *CLIPBOARD_PLUGIN = "pwdman-clip.so";
+
+// set when the X11 plugin was wanted but could not be loaded
+static std::string fallback_warning;
+
+/**
+ * Forwards to a plugin wrapping libclip.
+ */
+class PluginClipboard
+:   public ClipboardBackend {
+
+private:
+
+    using SetText = bool (*)(const char *, size_t);
+
+    void *_handle;
+    SetText _setText;
+
+    PluginClipboard(void *handle, SetText setText)
+    :   _handle(handle),
+        _setText(setText)
+    { }
+
+public:
+
+    ~PluginClipboard() {
+        dlclose(_handle);
+    }
+
+    const char * name() const override {
+        return "x11";
+    }
+
+    const char * destination() const override {
+        return "copied to the X11 clipboard";
+    }
+
+    bool setText(const std::string &text) override {
+        return _setText(text.data(), text.size());
+    }
+
+    /**
+     * Looks for the plugin in $PWDMAN_CLIPBOARD_PLUGIN, next to the executable
+     * and in the install directory, in that order. If none loads, returns null
+     * and sets error to the reason the last one failed.
+     */
+    static PluginClipboard * load(std::string &error) {
+        std::vector<std::string> candidates;
+
+        auto env = getenv("PWDMAN_CLIPBOARD_PLUGIN");
+        if (env != nullptr && *env) candidates.push_back(env);
+
+        char exe[PATH_MAX];
+        auto len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+        if (len > 0) {
+            auto dir = std::string(exe, len);
+            candidates.push_back(dir.substr(0, dir.rfind('/') + 1) + CLIPBOARD_PLUGIN);
+        }
+
+        candidates.push_back(std::string(CLIPBOARD_PLUGIN_DIR "/") + CLIPBOARD_PLUGIN);
+
+        for (const auto &path : candidates) {
+            auto handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+            if (handle == nullptr) {
+                auto e = dlerror();
+                error = e != nullptr ? e : path + ": cannot be loaded";
+                continue;
+            }
+
+            auto setText = reinterpret_cast<SetText>(dlsym(handle, CLIPBOARD_PLUGIN_SYMBOL));
+            if (setText != nullptr) return new PluginClipboard(handle, setText);
+
+            error = path + ": no " CLIPBOARD_PLUGIN_SYMBOL " symbol";
+            dlclose(handle);
+        }
+
+        return nullptr;
+    }
+};
+
+/**
+ * Asks the terminal to set the clipboard through an OSC 52 escape sequence,
+ * which also works over ssh. Terminals that do not support it ignore it.
+ */
+class TerminalClipboard
+:   public ClipboardBackend {
+
+public:
+
+    const char * name() const override {
+        return "terminal";
+    }
+
+    const char * destination() const override {
+        return "sent to the terminal via OSC 52";
+    }
+
+    bool setText(const std::string &text) override {
+        if (! isatty(STDOUT_FILENO)) return false;
+
+        std::string seq = "\033]52;c;";
+        CryptoPP::StringSource ss(text, true,
+            new CryptoPP::Base64Encoder(
+                new CryptoPP::StringSink(seq),
+                false
+            )
+        );
+        seq += "\a";
+
+        return write(STDOUT_FILENO, seq.data(), seq.size()) == static_cast<ssize_t>(seq.size());
+    }
+};
+
+ClipboardBackend & ClipboardBackend::get() {
+    static ClipboardBackend *backend = nullptr;
+
+    if (backend == nullptr) {
+        auto display = getenv("DISPLAY");
+        if (display != nullptr && *display) {
+            std::string error;
+            backend = PluginClipboard::load(error);
+            if (backend == nullptr) {
+                fallback_warning = "The X11 clipboard plugin could not be loaded (" + error
+                    + "); passwords are sent to the terminal via OSC 52 instead";
+            }
+        }
+        if (backend == nullptr) backend = new TerminalClipboard();
+    }
+
+    return *backend;
+}
+
+const std::string & ClipboardBackend::warning() {
+    return fallback_warning;
+}
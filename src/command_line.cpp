@@ -1,6 +1,7 @@
 #include <command_line.h>
-#include <vector>
+#include <ctype.h>
 #include <string.h>
+#include <strings.h>
 #include <termios.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -8,190 +9,317 @@
 const struct {
     CommandType type;
     CommandArgs args;
-    std::vector<std::string> str;
+    const char *name;
 } COMMAND[] = {
-    {
-        CommandType::INVALID,
-        CommandArgs::NONE,
-        { }
-    },
-    {
-        CommandType::ADD,
-        CommandArgs::PATH_VAL,
-        { "add", "a" }
-    },
-    {
-        CommandType::REMOVE,
-        CommandArgs::PATH_ONLY,
-        { "remove", "r" }
-    },
-    {
-        CommandType::GET,
-        CommandArgs::PATH_ONLY,
-        { "get", "g" }
-    },
-    {
-        CommandType::COPY,
-        CommandArgs::PATH_ONLY,
-        { "copy", "c" }
-    },
-    {
-        CommandType::LIST,
-        CommandArgs::OPT_PATH,
-        { "list", "l" }
-    },
-    {
-        CommandType::HELP,
-        CommandArgs::NONE,
-        { "help", "h" }
-    },
-    {
-        CommandType::WRITE,
-        CommandArgs::NONE,
-        { "write", "w" }
-    },
-    {
-        CommandType::QUIT,
-        CommandArgs::NONE,
-        { "quit", "q", "exit" }
-    },
-    {
-        CommandType::WRITE_QUIT,
-        CommandArgs::NONE,
-        { "wq" }
-    },
+    { CommandType::INVALID, CommandArgs::NONE, "invalid" },
+    { CommandType::ADD, CommandArgs::PATH_VAL, "add" },
+    { CommandType::REMOVE, CommandArgs::PATH_ONLY, "remove" },
+    { CommandType::GET, CommandArgs::PATH_ONLY, "get" },
+    { CommandType::COPY, CommandArgs::PATH_ONLY, "copy" },
+    { CommandType::LIST, CommandArgs::OPT_PATH, "list" },
+    { CommandType::HELP, CommandArgs::NONE, "help" },
+    { CommandType::WRITE, CommandArgs::NONE, "write" },
+    { CommandType::QUIT, CommandArgs::NONE, "quit" },
+    { CommandType::WRITE_QUIT, CommandArgs::NONE, "wq" },
+    { CommandType::TUNE, CommandArgs::OPT_ARG_VAL, "tune" },
+    { CommandType::FIND, CommandArgs::ARG, "find" },
+    { CommandType::STATS, CommandArgs::NONE, "stats" },
+    { CommandType::IMPORT, CommandArgs::ARG, "import" },
+    { CommandType::EXPORT, CommandArgs::ARG, "export" },
+    { CommandType::COMPRESS, CommandArgs::OPT_ARG, "compress" },
 };
 
-PasswordPath get_password_path(char *n) {
-    PasswordPath p;
-    char *ptr = strrchr(n, '.');
-    if (ptr) {
-        *ptr = '\0';
-        p.name = n;
-        p.element = ptr + 1;
+struct Alias {
+    const char *str;
+    CommandType type;
+};
+
+// every name a command can be typed as, matched case-insensitively
+constexpr Alias ALIASES[] = {
+    { "add", CommandType::ADD },
+    { "a", CommandType::ADD },
+    { "remove", CommandType::REMOVE },
+    { "r", CommandType::REMOVE },
+    { "get", CommandType::GET },
+    { "g", CommandType::GET },
+    { "copy", CommandType::COPY },
+    { "c", CommandType::COPY },
+    { "list", CommandType::LIST },
+    { "l", CommandType::LIST },
+    { "help", CommandType::HELP },
+    { "h", CommandType::HELP },
+    { "write", CommandType::WRITE },
+    { "w", CommandType::WRITE },
+    { "quit", CommandType::QUIT },
+    { "q", CommandType::QUIT },
+    { "exit", CommandType::QUIT },
+    { "wq", CommandType::WRITE_QUIT },
+    { "tune", CommandType::TUNE },
+    { "t", CommandType::TUNE },
+    { "find", CommandType::FIND },
+    { "f", CommandType::FIND },
+    { "stats", CommandType::STATS },
+    { "import", CommandType::IMPORT },
+    { "export", CommandType::EXPORT },
+    { "compress", CommandType::COMPRESS },
+};
+
+constexpr size_t ALIAS_COUNT = sizeof(ALIASES) / sizeof(ALIASES[0]);
+
+constexpr size_t ALIAS_SLOTS = 64;
+
+constexpr uint8_t NO_ALIAS = 0xff;
+
+static constexpr char lower(char c) {
+    return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+static constexpr size_t length(const char *s) {
+    return *s ? 1 + length(s + 1) : 0;
+}
+
+// a perfect hash of the aliases from their first and last characters and
+// their length; if adding an alias trips the static_assert below, change the
+// multipliers until it passes
+static constexpr size_t alias_hash(char first, char last, size_t len) {
+    return (static_cast<uint8_t>(lower(first)) + 4 * static_cast<uint8_t>(lower(last)) + 11 * len) % ALIAS_SLOTS;
+}
+
+static constexpr size_t alias_hash(const char *s) {
+    return alias_hash(s[0], s[length(s) - 1], length(s));
+}
+
+// the alias hashing to slot, searching from alias i
+static constexpr uint8_t alias_at(size_t slot, size_t i) {
+    return i == ALIAS_COUNT ? NO_ALIAS : alias_hash(ALIASES[i].str) == slot ? i : alias_at(slot, i + 1);
+}
+
+template <size_t... I>
+struct Indices { };
+
+template <size_t N, size_t... I>
+struct MakeIndices : MakeIndices<N - 1, N - 1, I...> { };
+
+template <size_t... I>
+struct MakeIndices<0, I...> {
+    typedef Indices<I...> type;
+};
+
+struct AliasTable {
+    uint8_t slot[ALIAS_SLOTS];
+};
+
+template <size_t... I>
+static constexpr AliasTable alias_table(Indices<I...>) {
+    return AliasTable { { alias_at(I, 0)... } };
+}
+
+// built at compile time
+constexpr AliasTable ALIAS_TABLE = alias_table(MakeIndices<ALIAS_SLOTS>::type());
+
+static constexpr bool perfect(size_t i) {
+    return i == ALIAS_COUNT || (ALIAS_TABLE.slot[alias_hash(ALIASES[i].str)] == i && perfect(i + 1));
+}
+
+static_assert(perfect(0), "command aliases collide in ALIAS_TABLE");
+
+static CommandType find_command(StringRef token) {
+    if (token.empty()) return CommandType::INVALID;
+
+    uint8_t i = ALIAS_TABLE.slot[alias_hash(token.data[0], token.data[token.size - 1], token.size)];
+    if (i == NO_ALIAS) return CommandType::INVALID;
+
+    const char *alias = ALIASES[i].str;
+    if (strncasecmp(alias, token.data, token.size) != 0 || alias[token.size] != '\0') {
+        return CommandType::INVALID;
     }
-    else {
-        p.name = n;
-        p.element.clear();
+    return ALIASES[i].type;
+}
+
+CommandType command_type(StringRef token) {
+    return find_command(token);
+}
+
+const char * command_name(CommandType type) {
+    return COMMAND[static_cast<size_t>(type)].name;
+}
+
+bool Tokenizer::next(StringRef &token, bool quote) {
+    while (_p < _end && *_p == ' ') ++_p;
+
+    token = StringRef(_p, 0);
+    if (_p == _end) return true;
+
+    if (quote && (*_p == '\'' || *_p == '\"')) {
+        auto close = static_cast<const char *>(memchr(_p + 1, *_p, _end - _p - 1));
+        if (close == nullptr) return false;
+
+        token = StringRef(_p + 1, close - _p - 1);
+        _p = close + 1;
+        return true;
     }
-    return p;
+
+    const char *start = _p;
+    while (_p < _end && *_p != ' ' && *_p != '\\') ++_p;
+
+    if (_p == _end || *_p == ' ') {
+        token = StringRef(start, _p - start);
+        return true;
+    }
+
+    // the token has escapes, so it is unescaped into the buffer. Unescaped
+    // tokens are never longer than the line, so reserving its size up front
+    // keeps earlier tokens from being moved
+    if (_unescaped.capacity() < _unescaped.size() + (_end - start)) {
+        _unescaped.reserve(_unescaped.size() + (_end - start));
+    }
+
+    size_t offset = _unescaped.size();
+    _unescaped.append(start, _p - start);
+    while (_p < _end && *_p != ' ') {
+        if (*_p == '\\' && ++_p == _end) break;
+        _unescaped.push_back(*_p++);
+    }
+
+    token = StringRef(_unescaped.data() + offset, _unescaped.size() - offset);
+    return true;
+}
+
+bool Tokenizer::done() const {
+    const char *p = _p;
+    while (p < _end && *p == ' ') ++p;
+    return p == _end;
 }
 
-char * get_token(char *&str, bool quote) {
-    char *tok = nullptr, stop, *p;
+static bool vault_char(char c) {
+    return isalnum(static_cast<unsigned char>(c)) || c == '-' || c == '_';
+}
 
-    while (*str == ' ') ++str;
+bool valid_vault_name(StringRef name) {
+    if (name.empty()) return false;
+    for (size_t i = 0; i < name.size; ++i) {
+        if (! vault_char(name.data[i])) return false;
+    }
+    return true;
+}
 
-    tok = str;
+int resolve_vault(PasswordPath &path, const std::vector<std::string> &vaults) {
+    if (path.vault.empty()) return -1;
 
-    if (*str) {
-        if (quote && (*str == '\'' || *str == '\"')) {
-            ++tok;
-            stop = *str;
-            ++str;
-            while (*str && *str != stop) ++str;
-            if (*str) {
-                *str = '\0';
-                ++str;
-            }
-            else {
-                printf("Invalid command; expected token %c\n", stop);
-                return nullptr;
-            }
-        }
-        else {
-            do {
-                if (*str && *str == '\\') {
-                    p = str;
-                    do *p = *(p + 1); while (*++p);
-                    if (*str && *str == ' ') ++str;
-                }
-                while (*str && *str != ' ' &&  *str != '\\') ++str;
-            } while (*str && *str == '\\');
-            if (*str) {
-                *str = '\0';
-                ++str;
+    if (vaults.size() > 1) {
+        for (size_t i = 0; i < vaults.size(); ++i) {
+            if (vaults[i] == path.vault) {
+                path.vault.clear();
+                return i;
             }
         }
     }
 
-    return tok;
+    path.name = path.vault + ":" + path.name;
+    path.vault.clear();
+    return -1;
 }
 
-Command parse_command(char *str) {
-    char *token;
+bool glob_pattern(StringRef name) {
+    for (size_t i = 0; i < name.size; ++i) {
+        if (name.data[i] == '*' || name.data[i] == '?' || name.data[i] == '[') return true;
+    }
+    return false;
+}
+
+PasswordPath get_password_path(StringRef n) {
+    PasswordPath p;
+
+    const char *colon = n.data;
+    while (colon < n.data + n.size && vault_char(*colon)) ++colon;
+    if (colon > n.data && colon < n.data + n.size && *colon == ':') {
+        p.vault.assign(n.data, colon - n.data);
+        n = StringRef(colon + 1, n.data + n.size - colon - 1);
+    }
+
+    const char *dot = n.data + n.size;
+    while (dot > n.data && *(dot - 1) != '.') --dot;
+
+    if (dot > n.data) {
+        p.name.assign(n.data, dot - 1 - n.data);
+        p.element.assign(dot, n.data + n.size - dot);
+    }
+    else {
+        p.name.assign(n.data, n.size);
+    }
+    return p;
+}
+
+Command parse_command(StringRef str) {
+    Tokenizer tokens(str);
+    StringRef token("", 0);
     Command cmd;
 
-    // save command str
     cmd.cmdStr = str;
 
     // get command
     cmd.type = CommandType::INVALID;
-    token = get_token(str, false);
-    if (token == nullptr || *token == '\0') {
+    tokens.next(token, false);
+    if (token.empty()) {
         return cmd;
     }
-    for (auto &c : COMMAND) {
-        for (auto &x : c.str) {
-            if (strcasecmp(token, x.c_str()) == 0) {
-                cmd.type = static_cast<CommandType>(c.type);
-            }
-        }
-    }
+    cmd.type = find_command(token);
     if (cmd.type == CommandType::INVALID) {
-        printf("Invalid command '%s'\n", token);
+        printf("Invalid command '%.*s'\n", static_cast<int>(token.size), token.data);
         return cmd;
     }
+    auto args = COMMAND[static_cast<size_t>(cmd.type)].args;
 
     // get path, if found
-    if ((token = get_token(str)) == nullptr) {
+    if (! tokens.next(token)) {
+        printf("Invalid command; expected token %c\n", tokens.expected());
         cmd.type = CommandType::INVALID;
         return cmd;
     }
-    if (*token) {
-        cmd.path = get_password_path(token);
+    if (! token.empty() && (
+        args == CommandArgs::ARG
+        || args == CommandArgs::OPT_ARG
+        || args == CommandArgs::OPT_ARG_VAL
+    )) {
+        // a pattern, file name or number, which may contain dots; kept whole
+        cmd.path.name = token.str();
     }
-    else {
-        cmd.path.name.clear();
-        cmd.path.element.clear();
+    else if (! token.empty()) {
+        cmd.path = get_password_path(token);
     }
 
     // get value, if found
-    if ((token = get_token(str)) == nullptr) {
+    if (! tokens.next(token)) {
+        printf("Invalid command; expected token %c\n", tokens.expected());
         cmd.type = CommandType::INVALID;
         return cmd;
     }
-    if (*token) {
-        cmd.value = token;
-    }
-    else {
-        cmd.value.clear();
-    }
+    cmd.value = token.str();
 
     // validate number of arguments
     if (
-        *str
+        ! tokens.done()
         || (
-            COMMAND[static_cast<size_t>(cmd.type)].args == CommandArgs::PATH_VAL
+            args == CommandArgs::PATH_VAL
             && (cmd.path.name.empty() || cmd.value.empty())
         )
         || (
-            COMMAND[static_cast<size_t>(cmd.type)].args == CommandArgs::PATH_ONLY
+            (args == CommandArgs::PATH_ONLY || args == CommandArgs::ARG)
             && (cmd.path.name.empty() || ! cmd.value.empty())
         )
         || (
-            COMMAND[static_cast<size_t>(cmd.type)].args == CommandArgs::OPT_PATH
+            (args == CommandArgs::OPT_PATH || args == CommandArgs::OPT_ARG)
             && (! cmd.value.empty())
         )
         || (
-            COMMAND[static_cast<size_t>(cmd.type)].args == CommandArgs::NONE
+            args == CommandArgs::NONE
             && (! cmd.path.name.empty() || ! cmd.value.empty())
         )
     ) {
         printf(
             "Invalid number of arguments given to command '%s'. "
             "Type 'h' or 'help' for command help.\n",
-            COMMAND[static_cast<size_t>(cmd.type)].str[0].c_str()
+            COMMAND[static_cast<size_t>(cmd.type)].name
         );
         cmd.type = CommandType::INVALID;
     }
@@ -226,32 +354,24 @@ void get_password(char *password) {
 }
 
 std::string escape(const char *str) {
-    char *escaped = (char *) malloc(2 * strlen(str) + 1);
-    char *str2 = escaped;
+    std::string s;
+    s.reserve(strlen(str));
 
     while (*str) {
         if (*str == '\\') ++str;
-        if (*str == ' ') *str2++ = '\\';
-        *str2++ = *str++;
+        if (*str == ' ') s.push_back('\\');
+        if (*str) s.push_back(*str++);
     }
-    *str2 = '\0';
-
-    std::string s(escaped);
-    free(escaped);
     return s;
 }
 
 std::string unescape(const char *str) {
-    char *unescaped = (char *) malloc(strlen(str) + 1);
-    char *str2 = unescaped;
+    std::string s;
+    s.reserve(strlen(str));
 
     while (*str) {
-        if (*str == '\\') str++;
-        *str2++ = *str++;
+        if (*str == '\\') ++str;
+        if (*str) s.push_back(*str++);
     }
-    *str2 = '\0';
-
-    std::string s(unescaped);
-    free(unescaped);
     return s;
 }
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2023 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#include <completion.h>
+#include <command_line.h>
+#include <algorithm>
+
+void CompletionCache::narrow(Keys &k, const std::string &prefix) {
+    auto first = k.keys.cbegin();
+    auto last = k.keys.cend();
+
+    // the matches of an extended prefix are among those of the prefix
+    if (prefix.compare(0, k.prefix.size(), k.prefix) == 0) {
+        first += k.first;
+        last = k.keys.cbegin() + k.last;
+    }
+
+    first = std::lower_bound(first, last, prefix);
+    last = std::upper_bound(first, last, prefix, [] (const std::string &p, const std::string &key) {
+        return key.compare(0, p.size(), p) > 0;
+    });
+
+    k.prefix = prefix;
+    k.first = first - k.keys.cbegin();
+    k.last = last - k.keys.cbegin();
+}
+
+CompletionCache::Range CompletionCache::complete(const PasswordStore &store, const std::string &text, bool quoted) {
+    auto dot = text.rfind('.');
+    Keys *k;
+
+    if (dot == std::string::npos) {
+        k = &_names;
+        if (! k->current(store, quoted, "")) {
+            *k = Keys();
+            for (const auto &n : store.names()) k->keys.push_back(quoted ? n : escape(n));
+        }
+    }
+    else {
+        // the name as stored
+        auto name = text.substr(0, dot);
+        if (! quoted) name = unescape(name);
+
+        k = &_elements;
+        if (! k->current(store, quoted, name)) {
+            *k = Keys();
+            k->scope = name;
+            if (store.contains(name)) {
+                for (const auto &e : store.elements(name)) {
+                    auto s = name + '.' + e;
+                    k->keys.push_back(quoted ? s : escape(s));
+                }
+            }
+        }
+    }
+
+    if (k->store == nullptr) {
+        k->store = &store;
+        k->generation = store.generation();
+        k->quoted = quoted;
+
+        // escaping may reorder names containing spaces
+        if (! std::is_sorted(k->keys.begin(), k->keys.end())) std::sort(k->keys.begin(), k->keys.end());
+        k->last = k->keys.size();
+    }
+
+    narrow(*k, text);
+    return Range { k->keys.cbegin() + k->first, k->keys.cbegin() + k->last };
+}
@@ -0,0 +1,545 @@
+/*
+ * Copyright (c) 2023 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#include <interchange.h>
+#include <worker_pool.h>
+#include <secure_arena.h>
+#include <profiler.h>
+#include <error.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+// bytes of input per parallel task
+static const size_t CHUNK_SIZE = 64 * 1024;
+
+// element a CSV column is imported as, for headers of other password managers
+static const struct {
+    const char *column;
+    const char *element;
+} CSV_COLUMNS[] = {
+    { "password", "default" },
+    { "login_password", "default" },
+    { "username", "user" },
+    { "login_username", "user" },
+    { "user", "user" },
+    { "url", "url" },
+    { "login_uri", "url" },
+    { "uri", "url" },
+    { "website", "url" },
+    { "notes", "notes" },
+    { "note", "notes" },
+    { "totp", "totp" },
+    { "login_totp", "totp" },
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Reads one field starting at p into field, or only skips it if field is
+ * null, leaving p on the delimiter that ends it. Returns false if a quoted
+ * field is not terminated properly.
+ */
+static bool csv_field(const char *&p, const char *end, std::string *field) {
+    if (field) field->clear();
+
+    if (p < end && *p == '\"') {
+        for (++p; ; ++p) {
+            if (p == end) return false;
+            if (*p == '\"') {
+                if (p + 1 < end && p[1] == '\"') ++p;
+                else break;
+            }
+            if (field) field->push_back(*p);
+        }
+        ++p;
+        return p == end || *p == ',' || *p == '\n' || *p == '\r';
+    }
+
+    const char *start = p;
+    while (p < end && *p != ',' && *p != '\n' && *p != '\r') ++p;
+    if (field) field->assign(start, p - start);
+    return true;
+}
+
+/**
+ * Moves p past the delimiter ending a record, if it ends one. Returns false
+ * if it is a comma, with p past it.
+ */
+static bool csv_record_end(const char *&p, const char *end) {
+    if (p < end && *p == ',') {
+        ++p;
+        return false;
+    }
+    if (p < end && *p == '\r') ++p;
+    if (p < end && *p == '\n') ++p;
+    return true;
+}
+
+/**
+ * Reads the record starting at p into fields, and moves p past it.
+ */
+static void csv_record(const char *&p, const char *end, std::vector<std::string> &fields) {
+    size_t n = 0;
+
+    do {
+        if (fields.size() <= n) fields.emplace_back();
+        if (! csv_field(p, end, &fields[n++])) throw Error("Malformed CSV file");
+    } while (! csv_record_end(p, end));
+
+    for (size_t i = n; i < fields.size(); ++i) SecureArena::wipe(fields[i]);
+    fields.resize(n);
+}
+
+/**
+ * Offsets at which chunks of about CHUNK_SIZE bytes start, each at the start
+ * of a record, followed by the end of text. Records are skipped by the same
+ * rules csv_record() reads them by, so that neither a newline within quotes
+ * nor a quote within an unquoted field is mistaken for a boundary. Past a
+ * malformed field, the rest is left as one chunk, for its parser to reject.
+ */
+static std::vector<size_t> csv_chunks(const std::string &text, size_t begin) {
+    std::vector<size_t> chunks { begin };
+    const char *p = text.data() + begin;
+    const char *end = text.data() + text.size();
+
+    for (size_t next = begin + CHUNK_SIZE; p < end; ) {
+        bool ok;
+        do {
+            ok = csv_field(p, end, nullptr);
+        } while (ok && ! csv_record_end(p, end));
+        if (! ok) break;
+
+        size_t offset = p - text.data();
+        if (offset >= next && offset < text.size()) {
+            chunks.push_back(offset);
+            next = offset + CHUNK_SIZE;
+        }
+    }
+
+    chunks.push_back(text.size());
+    return chunks;
+}
+
+static EntryTable<NoMeta> parse_csv(const std::string &text) {
+    const char *p = text.data();
+    const char *end = p + text.size();
+
+    // a byte order mark, as written by some exporters
+    if (text.compare(0, 3, "\xef\xbb\xbf") == 0) p += 3;
+
+    std::vector<std::string> header;
+    csv_record(p, end, header);
+    for (auto &h : header) {
+        for (auto &c : h) c = tolower(c);
+    }
+
+    // either name,element,value, or a name column and element columns
+    bool native = header == std::vector<std::string> { "name", "element", "value" };
+    size_t nameColumn = header.size();
+    std::vector<const char *> elements(header.size(), nullptr);
+
+    if (! native) {
+        for (size_t i = 0; i < header.size(); ++i) {
+            if (header[i] == "name" || header[i] == "title") nameColumn = i;
+            for (const auto &c : CSV_COLUMNS) {
+                if (header[i] == c.column) elements[i] = c.element;
+            }
+        }
+        bool any = false;
+        for (auto e : elements) any = any || e != nullptr;
+        if (nameColumn == header.size() || ! any) throw Error("Unrecognized CSV header");
+    }
+
+    auto chunks = csv_chunks(text, p - text.data());
+    std::vector<EntryTable<NoMeta>> tables(chunks.size() - 1);
+
+    WorkerPool::shared().run(tables.size(), [&] (size_t t) {
+        const char *q = text.data() + chunks[t];
+        const char *qend = text.data() + chunks[t + 1];
+        std::vector<std::string> fields;
+
+        while (q < qend) {
+            csv_record(q, qend, fields);
+            if (fields.size() == 1 && fields[0].empty()) continue;
+
+            if (native) {
+                if (fields.size() != 3 || fields[0].empty()) throw Error("Malformed CSV file");
+                tables[t].put(fields[0], fields[1], fields[2]);
+            }
+            else if (nameColumn < fields.size() && ! fields[nameColumn].empty()) {
+                for (size_t i = 0; i < fields.size() && i < elements.size(); ++i) {
+                    if (elements[i] && ! fields[i].empty()) tables[t].put(fields[nameColumn], elements[i], fields[i]);
+                }
+            }
+        }
+        for (auto &f : fields) SecureArena::wipe(f);
+    });
+
+    EntryTable<NoMeta> entries;
+    for (const auto &t : tables) entries.merge(t);
+    return entries;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void json_space(const char *&p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')) ++p;
+}
+
+static void json_expect(const char *&p, const char *end, char c) {
+    json_space(p, end);
+    if (p == end || *p != c) throw Error("Malformed JSON file");
+    ++p;
+}
+
+static uint32_t json_hex(const char *&p, const char *end) {
+    if (end - p < 4) throw Error("Malformed JSON file");
+
+    uint32_t x = 0;
+    for (int i = 0; i < 4; ++i, ++p) {
+        char c = *p;
+        x <<= 4;
+        if (c >= '0' && c <= '9') x |= c - '0';
+        else if (c >= 'a' && c <= 'f') x |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') x |= c - 'A' + 10;
+        else throw Error("Malformed JSON file");
+    }
+    return x;
+}
+
+static void utf8(std::string &out, uint32_t c) {
+    if (c < 0x80) {
+        out.push_back(c);
+    }
+    else if (c < 0x800) {
+        out.push_back(0xc0 | (c >> 6));
+        out.push_back(0x80 | (c & 0x3f));
+    }
+    else if (c < 0x10000) {
+        out.push_back(0xe0 | (c >> 12));
+        out.push_back(0x80 | ((c >> 6) & 0x3f));
+        out.push_back(0x80 | (c & 0x3f));
+    }
+    else {
+        out.push_back(0xf0 | (c >> 18));
+        out.push_back(0x80 | ((c >> 12) & 0x3f));
+        out.push_back(0x80 | ((c >> 6) & 0x3f));
+        out.push_back(0x80 | (c & 0x3f));
+    }
+}
+
+static void json_string(const char *&p, const char *end, std::string &s) {
+    json_expect(p, end, '\"');
+    s.clear();
+
+    while (true) {
+        const char *start = p;
+        while (p < end && *p != '\"' && *p != '\\') ++p;
+        s.append(start, p - start);
+
+        if (p == end) throw Error("Malformed JSON file");
+        if (*p++ == '\"') return;
+        if (p == end) throw Error("Malformed JSON file");
+
+        switch (*p++) {
+        case '\"': s.push_back('\"'); break;
+        case '\\': s.push_back('\\'); break;
+        case '/': s.push_back('/'); break;
+        case 'b': s.push_back('\b'); break;
+        case 'f': s.push_back('\f'); break;
+        case 'n': s.push_back('\n'); break;
+        case 'r': s.push_back('\r'); break;
+        case 't': s.push_back('\t'); break;
+        case 'u': {
+            uint32_t c = json_hex(p, end);
+            if (c >= 0xd800 && c < 0xdc00 && end - p >= 6 && p[0] == '\\' && p[1] == 'u') {
+                p += 2;
+                uint32_t low = json_hex(p, end);
+                if (low < 0xdc00 || low >= 0xe000) throw Error("Malformed JSON file");
+                c = 0x10000 + ((c - 0xd800) << 10) + (low - 0xdc00);
+            }
+            utf8(s, c);
+        }
+        break;
+        default: throw Error("Malformed JSON file");
+        }
+    }
+}
+
+/**
+ * Offsets at which chunks of about CHUNK_SIZE bytes start, each at a member of
+ * the top-level object, followed by the offset of its closing brace. Members
+ * are found by skipping strings and nested values.
+ */
+static std::vector<size_t> json_chunks(const std::string &text) {
+    const char *begin = text.data();
+    const char *p = begin;
+    const char *end = p + text.size();
+    std::vector<size_t> chunks;
+
+    json_expect(p, end, '{');
+    chunks.push_back(p - begin);
+
+    size_t depth = 0;
+    for (size_t next = (p - begin) + CHUNK_SIZE; p < end; ++p) {
+        switch (*p) {
+        case '\"':
+            for (++p; p < end && *p != '\"'; ++p) {
+                if (*p == '\\') ++p;
+            }
+            if (p >= end) throw Error("Malformed JSON file");
+        break;
+
+        case '{':
+        case '[':
+            ++depth;
+        break;
+
+        case '}':
+        case ']':
+            if (depth == 0) {
+                chunks.push_back(p - begin);
+                json_space(++p, end);
+                if (p != end) throw Error("Malformed JSON file");
+                return chunks;
+            }
+            --depth;
+        break;
+
+        case ',':
+            if (depth == 0 && static_cast<size_t>(p - begin) >= next) {
+                chunks.push_back(p + 1 - begin);
+                next = (p + 1 - begin) + CHUNK_SIZE;
+            }
+        break;
+        }
+    }
+
+    throw Error("Malformed JSON file");
+}
+
+static EntryTable<NoMeta> parse_json(const std::string &text) {
+    auto chunks = json_chunks(text);
+    std::vector<EntryTable<NoMeta>> tables(chunks.size() - 1);
+
+    WorkerPool::shared().run(tables.size(), [&] (size_t t) {
+        const char *p = text.data() + chunks[t];
+        const char *end = text.data() + chunks[t + 1];
+        std::string name, element, value;
+
+        json_space(p, end);
+        while (p < end) {
+            json_string(p, end, name);
+            json_expect(p, end, ':');
+            json_space(p, end);
+
+            if (p < end && *p == '\"') {
+                json_string(p, end, value);
+                tables[t].put(name, "default", value);
+            }
+            else {
+                json_expect(p, end, '{');
+                json_space(p, end);
+                if (p < end && *p == '}') ++p;
+                else {
+                    while (true) {
+                        json_string(p, end, element);
+                        json_expect(p, end, ':');
+                        json_string(p, end, value);
+                        tables[t].put(name, element, value);
+
+                        json_space(p, end);
+                        if (p < end && *p == ',') ++p;
+                        else break;
+                    }
+                    json_expect(p, end, '}');
+                }
+            }
+
+            // members are separated by commas, and chunks start after one
+            json_space(p, end);
+            if (p < end) json_expect(p, end, ',');
+            json_space(p, end);
+        }
+        SecureArena::wipe(value);
+    });
+
+    EntryTable<NoMeta> entries;
+    for (const auto &t : tables) entries.merge(t);
+    return entries;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void csv_append(std::string &out, StringRef s) {
+    bool quote = s.empty() ? false : s.data[0] == ' ' || s.data[s.size - 1] == ' ';
+    for (size_t i = 0; i < s.size && ! quote; ++i) {
+        char c = s.data[i];
+        quote = c == ',' || c == '\"' || c == '\n' || c == '\r';
+    }
+
+    if (! quote) {
+        out.append(s.data, s.size);
+        return;
+    }
+
+    out.push_back('\"');
+    for (size_t i = 0; i < s.size; ++i) {
+        if (s.data[i] == '\"') out.push_back('\"');
+        out.push_back(s.data[i]);
+    }
+    out.push_back('\"');
+}
+
+static void json_append(std::string &out, StringRef s) {
+    static const char HEX[] = "0123456789abcdef";
+
+    out.push_back('\"');
+    for (size_t i = 0; i < s.size; ++i) {
+        uint8_t c = s.data[i];
+        switch (c) {
+        case '\"': out.append("\\\""); break;
+        case '\\': out.append("\\\\"); break;
+        case '\n': out.append("\\n"); break;
+        case '\r': out.append("\\r"); break;
+        case '\t': out.append("\\t"); break;
+        default:
+            if (c < 0x20) {
+                out.append("\\u00");
+                out.push_back(HEX[c >> 4]);
+                out.push_back(HEX[c & 0xf]);
+            }
+            else {
+                out.push_back(c);
+            }
+        break;
+        }
+    }
+    out.push_back('\"');
+}
+
+InterchangeFormat interchange_format(const std::string &path) {
+    static const std::string JSON_EXTENSION = ".json";
+
+    bool json = path.size() >= JSON_EXTENSION.size()
+        && strcasecmp(path.c_str() + path.size() - JSON_EXTENSION.size(), JSON_EXTENSION.c_str()) == 0;
+    return json ? InterchangeFormat::JSON : InterchangeFormat::CSV;
+}
+
+EntryTable<NoMeta> parse_entries(const std::string &text, InterchangeFormat format) {
+    return format == InterchangeFormat::JSON ? parse_json(text) : parse_csv(text);
+}
+
+std::string format_entries(const PasswordStore &store, InterchangeFormat format) {
+    std::string out;
+
+    if (format == InterchangeFormat::CSV) {
+        out = "name,element,value\n";
+        store.forEach([&] (StringRef name, StringRef element, StringRef value) {
+            csv_append(out, name);
+            out.push_back(',');
+            csv_append(out, element);
+            out.push_back(',');
+            csv_append(out, value);
+            out.push_back('\n');
+        });
+        return out;
+    }
+
+    // one name per line
+    std::string last;
+    bool first = true;
+    out = "{";
+    store.forEach([&] (StringRef name, StringRef element, StringRef value) {
+        if (first || name != StringRef(last)) {
+            out.append(first ? "\n    " : "},\n    ");
+            json_append(out, name);
+            out.append(": {");
+            last.assign(name.data, name.size);
+            first = false;
+        }
+        else {
+            out.append(", ");
+        }
+        json_append(out, element);
+        out.append(": ");
+        json_append(out, value);
+    });
+    out.append(first ? "}\n" : "}\n}\n");
+    return out;
+}
+
+size_t import_entries(PasswordStore &store, const std::string &path) {
+    ProfileScope scope("import");
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw Error("Failed to open import file");
+
+    std::string text;
+    char buf[65536];
+    ssize_t n;
+    while ((n = ::read(fd, buf, sizeof(buf))) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            ::close(fd);
+            SecureArena::wipe(text);
+            throw Error("Failed to read import file");
+        }
+        text.append(buf, n);
+    }
+    ::close(fd);
+    SecureArena::wipe(buf, sizeof(buf));
+
+    try {
+        auto entries = parse_entries(text, interchange_format(path));
+        SecureArena::wipe(text);
+
+        store.putAll(entries);
+        return entries.size();
+    }
+    catch (...) {
+        SecureArena::wipe(text);
+        throw;
+    }
+}
+
+size_t export_entries(const PasswordStore &store, const std::string &path) {
+    ProfileScope scope("export");
+
+    size_t count = 0;
+    store.forEach([&] (StringRef, StringRef, StringRef) { ++count; });
+
+    auto text = format_entries(store, interchange_format(path));
+
+    // never replaces an existing file, whose permissions could be wider
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        SecureArena::wipe(text);
+        throw Error("Failed to create export file");
+    }
+
+    const char *p = text.data();
+    size_t left = text.size();
+    while (left > 0) {
+        ssize_t n = ::write(fd, p, left);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            ::close(fd);
+            SecureArena::wipe(text);
+            throw Error("Failed to write export file");
+        }
+        p += n;
+        left -= n;
+    }
+    ::close(fd);
+
+    SecureArena::wipe(text);
+    return count;
+}
@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2023 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#include <kdf.h>
+#include <libcryptopp/pwdbased.h>
+#include <libcryptopp/scrypt.h>
+#include <libcryptopp/sha.h>
+#include <error.h>
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+
+using namespace spl;
+
+// upper bound on the memory a password file may ask scrypt to use, so that a
+// damaged or malicious header cannot exhaust memory
+static const uint64_t KDF_MAX_MEMORY = 1ull << 30;
+
+static const struct {
+    KdfAlgorithm algorithm;
+    const char *name;
+} KDF[] = {
+    { KdfAlgorithm::PBKDF2_SHA256, "pbkdf2" },
+    { KdfAlgorithm::SCRYPT, "scrypt" },
+};
+
+KdfParameters KdfParameters::defaults() {
+    return KdfParameters { KdfAlgorithm::SCRYPT, 1 << 15, 8, 1 };
+}
+
+bool KdfParameters::valid() const {
+    switch (algorithm) {
+    case KdfAlgorithm::PBKDF2_SHA256:
+        return cost > 0 && cost <= UINT32_MAX;
+
+    case KdfAlgorithm::SCRYPT:
+        return
+            cost > 1 && (cost & (cost - 1)) == 0
+            && blockSize > 0 && blockSize <= KDF_MAX_BLOCK_SIZE
+            && parallelism > 0 && parallelism <= KDF_MAX_PARALLELISM
+            && (uint64_t) blockSize * parallelism < (1ull << 30)
+            && memory() <= KDF_MAX_MEMORY;
+
+    default:
+        return false;
+    }
+}
+
+uint64_t KdfParameters::memory() const {
+    if (algorithm != KdfAlgorithm::SCRYPT) return 0;
+
+    // 128 * r fits in 64 bits for any r; the product with N may not
+    uint64_t block = 128ull * blockSize;
+    if (block != 0 && cost > UINT64_MAX / block) return UINT64_MAX;
+    return block * cost;
+}
+
+void KdfParameters::derive(
+    const char *passphrase,
+    size_t size,
+    const std::string &salt,
+    uint8_t *key,
+    size_t len
+) const {
+    auto secret = reinterpret_cast<const CryptoPP::byte *>(passphrase);
+    auto s = reinterpret_cast<const CryptoPP::byte *>(salt.data());
+
+    switch (algorithm) {
+    case KdfAlgorithm::PBKDF2_SHA256:
+        CryptoPP::PKCS5_PBKDF2_HMAC<CryptoPP::SHA256>().DeriveKey(
+            key, len, 0,
+            secret, size,
+            s, salt.size(),
+            static_cast<unsigned int>(cost)
+        );
+    break;
+
+    case KdfAlgorithm::SCRYPT:
+        CryptoPP::Scrypt().DeriveKey(
+            key, len,
+            secret, size,
+            s, salt.size(),
+            cost, blockSize, parallelism
+        );
+    break;
+
+    default:
+        throw Error("Unsupported key derivation function");
+    }
+}
+
+std::string KdfParameters::str() const {
+    char buf[128];
+
+    if (algorithm == KdfAlgorithm::SCRYPT) {
+        snprintf(
+            buf, sizeof(buf), "%s N=%llu r=%u p=%u (%llu MiB)",
+            kdf_name(algorithm), (unsigned long long) cost, blockSize, parallelism,
+            (unsigned long long) (memory() >> 20)
+        );
+    }
+    else {
+        snprintf(buf, sizeof(buf), "%s iterations=%llu", kdf_name(algorithm), (unsigned long long) cost);
+    }
+
+    return buf;
+}
+
+const char * kdf_name(KdfAlgorithm algorithm) {
+    for (const auto &k : KDF) {
+        if (k.algorithm == algorithm) return k.name;
+    }
+    return "unknown";
+}
+
+bool kdf_algorithm(const char *name, KdfAlgorithm &algorithm) {
+    for (const auto &k : KDF) {
+        if (strcasecmp(name, k.name) == 0) {
+            algorithm = k.algorithm;
+            return true;
+        }
+    }
+    return false;
+}
+
+static double time_kdf(const KdfParameters &params) {
+    uint8_t key[32];
+    auto start = std::chrono::steady_clock::now();
+    params.derive("passphrase", "salt", key, sizeof(key));
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+KdfParameters tune_kdf(KdfAlgorithm algorithm, uint32_t parallelism, double seconds) {
+    KdfParameters params;
+    double t;
+
+    if (algorithm == KdfAlgorithm::SCRYPT) {
+        params = KdfParameters { algorithm, 1 << 12, 8, parallelism };
+
+        // scrypt time is linear in N, which must be a power of two
+        t = time_kdf(params);
+        while (t * 2 <= seconds) {
+            params.cost <<= 1;
+            t *= 2;
+            if (! params.valid()) {
+                params.cost >>= 1;
+                break;
+            }
+        }
+    }
+    else {
+        params = KdfParameters { algorithm, 10000, 0, 0 };
+
+        // grow the sample until it is long enough to measure, then extrapolate
+        while ((t = time_kdf(params)) < seconds / 10 && params.cost < UINT32_MAX / 2) {
+            params.cost *= 2;
+        }
+        params.cost = std::max<uint64_t>(1000, std::min<uint64_t>(UINT32_MAX, params.cost * seconds / t));
+    }
+
+    return params;
+}
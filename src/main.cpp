@@ -4,54 +4,143 @@
 */
 
 #include <password_store.h>
+#include <completion.h>
+#include <vault.h>
+#include <agent.h>
+#include <clipboard.h>
+#include <secure_arena.h>
+#include <profiler.h>
 #include <command_line.h>
+#include <interchange.h>
+#include <saver.h>
 #include <file.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
 #include <pwd.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
 #include <readline/readline.h>
 #include <readline/history.h>
-#include <libclip/clip.h>
 
+// seconds an agent is kept alive while idle, by default
+#define AGENT_TIMEOUT 900
+
+/**
+ * An open vault, addressed as name: in commands.
+ */
+struct Session {
+    std::string name;
+    std::string path;
+    std::unique_ptr<PasswordStore> store;
+    std::unique_ptr<Vault> vault;
+    CompletionCache completions;
+};
+
+// in the order given on the command line; the first is the default
+std::vector<std::unique_ptr<Session>> sessions;
+
+// those of the session the current command refers to
 PasswordStore *store = nullptr;
-File *passFile = nullptr;
+Vault *vault = nullptr;
 
-bool initialize_password_store() {
+// writes the vaults in the background in interactive sessions, in which case
+// the stores are only used while holding its mutex
+std::unique_ptr<BackgroundSaver> saver;
 
-    if (passFile == nullptr) {
-        passFile = new File(
-            Path(getpwuid(getuid())->pw_dir).append(".pwdman")
-        );
+// mutations after which interactive sessions save on their own; 0 for never
+size_t autosave = 0;
+
+std::string password_file_path() {
+    return Path(getpwuid(getuid())->pw_dir).append(".pwdman").get();
+}
+
+std::string agent_socket_path() {
+    return (sessions.empty() ? password_file_path() : sessions.front()->path) + ".sock";
+}
+
+/**
+ * Adds a vault given as [name=]path. Without a name, it is named after the
+ * file, without a leading dot or an extension.
+ */
+bool add_session(const std::string &arg) {
+    std::unique_ptr<Session> s(new Session);
+
+    auto eq = arg.find('=');
+    if (eq != std::string::npos) {
+        s->name = arg.substr(0, eq);
+        s->path = arg.substr(eq + 1);
+    }
+    else {
+        s->path = arg;
+        auto slash = arg.rfind('/');
+        s->name = arg.substr(slash == std::string::npos ? 0 : slash + 1);
+        if (! s->name.empty() && s->name[0] == '.') s->name.erase(0, 1);
+        s->name = s->name.substr(0, s->name.find('.'));
     }
 
-    if (passFile->exists()) {
+    if (s->path.empty() || ! valid_vault_name(s->name)) {
+        printf("Invalid vault '%s'; expected [name=]path, with a name of letters, digits, - and _\n", arg.c_str());
+        return false;
+    }
+    for (const auto &x : sessions) {
+        if (x->name == s->name) {
+            printf("Vault name '%s' given more than once\n", s->name.c_str());
+            return false;
+        }
+    }
+
+    sessions.push_back(std::move(s));
+    return true;
+}
+
+void use_session(Session &s) {
+    store = s.store.get();
+    vault = s.vault.get();
+}
+
+std::vector<std::string> session_names() {
+    std::vector<std::string> names;
+    for (const auto &s : sessions) names.push_back(s->name);
+    return names;
+}
+
+/**
+ * Switches to the session path is in, and drops its vault prefix, as
+ * resolve_vault() does.
+ */
+void use_session(PasswordPath &path) {
+    int i = resolve_vault(path, session_names());
+    use_session(*sessions[i < 0 ? 0 : i]);
+}
+
+/**
+ * Prompts for the password of the password file at path, or for a new one,
+ * confirmed, if it does not exist yet.
+ */
+void read_password(const std::string &path, char *password) {
+    if (File(path.c_str()).exists()) {
         printf(
             "Reading password file '%s'\n",
-            passFile->info().path().get()
+            path.c_str()
         );
 
-        char password[PASS_MAX + 1];
         printf("\nPassword: ");
         get_password(password);
-
-        store = new PasswordStore(password);
-
-        try {
-            InputFileSerializer(*passFile) >> *store;
-        }
-        catch (const Error &e) {
-            printf("%s\n\n", e.what());
-            return false;
-        }
-
-        return true;
     }
     else {
         printf(
             "Password file '%s' not found; initializing empty password store.\n",
-            passFile->info().path().get()
+            path.c_str()
         );
 
-        char password[PASS_MAX + 1], confirm[PASS_MAX + 1];
+        char confirm[PASS_MAX + 1];
 
         printf("\nPassword: ");
         get_password(password);
@@ -66,17 +155,425 @@ bool initialize_password_store() {
             get_password(confirm);
         }
 
-        store = new PasswordStore(password);
+        SecureArena::wipe(confirm, sizeof(confirm));
+    }
+}
+
+/**
+ * Prompts for the password of each session, PASS_MAX + 1 bytes apart.
+ */
+void read_passwords(std::vector<char> &passwords) {
+    passwords.assign(sessions.size() * (PASS_MAX + 1), '\0');
+    for (size_t i = 0; i < sessions.size(); ++i) {
+        if (i > 0) printf("\n");
+        read_password(sessions[i]->path, &passwords[i * (PASS_MAX + 1)]);
+    }
+}
+
+void open_session(Session &s, const char *password) {
+    s.store.reset(new PasswordStore(password, OpenMode::LAZY));
+    s.vault.reset(new Vault(s.path, *s.store));
+    if (s.vault->exists()) s.vault->open();
+}
+
+/**
+ * Unlocks all sessions, each on its own thread, so that their key derivations
+ * run side by side and the slowest of them takes about as long as all. The
+ * passwords are wiped.
+ */
+bool open_sessions(std::vector<char> &passwords) {
+    ProfileScope unlock("unlock");
+
+    std::vector<std::string> errors(sessions.size());
+    auto open = [&] (size_t i) {
+        try {
+            open_session(*sessions[i], &passwords[i * (PASS_MAX + 1)]);
+        }
+        catch (const Error &e) {
+            errors[i] = e.what();
+        }
+        catch (...) {
+            errors[i] = "Failed to open password file";
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < sessions.size(); ++i) threads.emplace_back(open, i);
+    open(0);
+    for (auto &t : threads) t.join();
+
+    SecureArena::wipe(&passwords[0], passwords.size());
+
+    bool ok = true;
+    for (size_t i = 0; i < sessions.size(); ++i) {
+        if (errors[i].empty()) continue;
+
+        if (sessions.size() > 1) printf("%s: %s\n", sessions[i]->name.c_str(), errors[i].c_str());
+        else printf("%s\n", errors[i].c_str());
+        ok = false;
+    }
+    if (! ok) {
+        printf("\n");
+        return false;
+    }
+
+    for (const auto &s : sessions) {
+        if (s->vault->warning().empty()) continue;
+        if (sessions.size() > 1) printf("%s: %s\n", s->name.c_str(), s->vault->warning().c_str());
+        else printf("%s\n", s->vault->warning().c_str());
+    }
+
+    use_session(*sessions.front());
+    return true;
+}
+
+/**
+ * Refuses vaults that another process has open, such as an agent, before
+ * asking for their passwords.
+ */
+bool sessions_available() {
+    for (const auto &s : sessions) {
+        if (Vault::inUse(s->path)) {
+            printf(
+                "Password file '%s' is in use by another pwdman process; while an agent\n"
+                "has it open, use --client, or stop the agent with --client quit\n",
+                s->path.c_str()
+            );
+            return false;
+        }
+    }
+    return true;
+}
+
+bool initialize_password_store() {
+    if (! sessions_available()) return false;
+
+    std::vector<char> passwords;
+    read_passwords(passwords);
+    return open_sessions(passwords);
+}
+
+/**
+ * Takes and seals the changes of every vault, and returns the function that
+ * writes them out, without using the stores. That function returns the errors
+ * of the vaults that failed, one per line.
+ */
+std::function<std::string()> prepare_sessions() {
+    ProfileScope prepare("save.prepare");
+    std::vector<std::pair<std::string, std::function<void()>>> writes;
+    std::string errors;
+
+    auto failed = [] (std::string &errors, const std::string &name, const Error &e) {
+        if (! errors.empty()) errors += "\n";
+        if (sessions.size() > 1) errors += name + ": ";
+        errors += e.what();
+    };
+
+    for (const auto &s : sessions) {
+        try {
+            writes.emplace_back(s->name, s->vault->prepare());
+        }
+        catch (const Error &e) {
+            failed(errors, s->name, e);
+        }
+    }
+
+    return [writes, errors, failed] () mutable {
+        ProfileScope write("save.write");
+        for (const auto &w : writes) {
+            try {
+                w.second();
+            }
+            catch (const Error &e) {
+                failed(errors, w.first, e);
+            }
+        }
+        return errors;
+    };
+}
+
+/**
+ * Saves every vault, and returns the errors of those that failed, one per line.
+ */
+std::string save_sessions() {
+    ProfileScope save("save");
+    return prepare_sessions()();
+}
+
+bool save_password_store() {
+    auto errors = save_sessions();
+    if (! errors.empty()) printf("%s\n", errors.c_str());
+    return errors.empty();
+}
+
+void print_save_errors() {
+    for (const auto &e : saver->errors()) printf("%s\n", e.c_str());
+}
+
+void close_password_store() {
+    for (const auto &s : sessions) {
+        try {
+            s->vault->close();
+        }
+        catch (const Error &e) {
+            printf("%s\n", e.what());
+        }
+    }
+}
+
+std::string path_str(const std::string &name, const std::string &element) {
+    return element.empty() ? name : name + "." + element;
+}
+
+/**
+ * Whether path.name is to be matched as a glob pattern: it has a special
+ * character in it, and is not itself the name of an entry.
+ */
+bool pattern_path(const PasswordPath &path) {
+    return glob_pattern(path.name) && ! store->contains(path.name);
+}
+
+/**
+ * The names matching path.name as a glob pattern that have path.element, if
+ * given, in sorted order.
+ */
+std::vector<std::string> match_names(const PasswordPath &path) {
+    auto names = store->match(path.name);
+    if (! path.element.empty()) {
+        names.erase(
+            std::remove_if(names.begin(), names.end(), [&] (const std::string &n) {
+                return ! store->contains(n, path.element);
+            }),
+            names.end()
+        );
+    }
+
+    if (names.empty()) printf("No match for '%s'\n", path_str(path.name, path.element).c_str());
+    return names;
+}
+
+bool confirm(const char *prompt) {
+    char *answer = readline(prompt);
+    bool yes = answer != nullptr && (strcmp(answer, "y") == 0 || strcmp(answer, "yes") == 0);
+    free(answer);
+    return yes;
+}
+
+/**
+ * Removes the names matching a pattern, or their element, all at once. When
+ * verbose, the matches are listed and only removed once confirmed; lock, if
+ * given, is released while waiting for the answer.
+ */
+bool remove_matches(const PasswordPath &path, bool verbose, std::unique_lock<std::mutex> *lock) {
+    auto names = match_names(path);
+    if (names.empty()) return false;
+
+    if (verbose) {
+        for (const auto &n : names) printf("%s\n", path_str(n, path.element).c_str());
+        printf("\n");
+
+        auto generation = store->generation();
+        if (lock) lock->unlock();
+        bool yes = confirm(names.size() == 1 ? "Remove this entry? [y/N] " : "Remove these entries? [y/N] ");
+        if (lock) lock->lock();
+
+        if (! yes) {
+            printf("Nothing removed\n");
+            return false;
+        }
+        if (store->generation() != generation) {
+            printf("The password store changed meanwhile; nothing removed\n");
+            return false;
+        }
+    }
+
+    auto removed = store->removeAll(names, path.element);
+    if (verbose) printf("%zu removed\n", removed);
+    return true;
+}
+
+bool remove_password(const PasswordPath &path, bool verbose, std::unique_lock<std::mutex> *lock = nullptr) {
+    if (pattern_path(path)) return remove_matches(path, verbose, lock);
+
+    if (! store->contains(path.name)) {
+        printf("'%s' not found\n", path.name.c_str());
+        return false;
+    }
+
+    if (path.element.empty()) {
+        store->remove(path.name);
+        if (verbose) printf("'%s' removed\n", path.name.c_str());
+    }
+    else if (store->remove(path.name, path.element)) {
+        if (verbose) {
+            if (! store->contains(path.name)) {
+                printf("'%s' removed\n", path.name.c_str());
+            }
+            else {
+                printf("'%s.%s' removed\n", path.name.c_str(), path.element.c_str());
+            }
+        }
+    }
+    else {
+        printf("'%s.%s' not found\n", path.name.c_str(), path.element.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+bool print_password(const PasswordPath &path) {
+    if (pattern_path(path)) {
+        auto names = match_names(path);
+        for (const auto &n : names) print_password(PasswordPath { path.vault, n, path.element });
+        return ! names.empty();
+    }
+
+    if (! store->contains(path.name)) {
+        printf("'%s' not found\n", path.name.c_str());
+        return false;
+    }
+
+    if (path.element.empty()) {
+        printf("%s: {\n", path.name.c_str());
+        if (store->contains(path.name, "default")) {
+            printf(
+                "    default: %s\n",
+                store->get(path.name, "default").c_str()
+            );
+        }
+        for (const auto &x : store->get(path.name)) {
+            if (x.k != "default") {
+                printf("    %s: %s\n", x.k.c_str(), x.v.c_str());
+            }
+        }
+        printf("}\n");
+    }
+    else if (store->contains(path.name, path.element)) {
+        printf(
+            "%s.%s: %s\n",
+            path.name.c_str(), path.element.c_str(),
+            store->get(path.name, path.element).c_str()
+        );
+    }
+    else {
+        printf("'%s.%s' not found\n", path.name.c_str(), path.element.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+void print_list(const PasswordPath &path) {
+    if (path.name.empty()) {
+        auto names = store->names();
+
+        if (names.empty()) {
+            printf("<Empty>\n");
+        }
+        else {
+            for (const auto &n : names) {
+                printf("%s\n", n.c_str());
+            }
+        }
+    }
+    else if (pattern_path(path)) {
+        for (const auto &n : match_names(path)) printf("%s\n", path_str(n, path.element).c_str());
+    }
+    else if (
+        store->contains(path.name)
+        && (path.element.empty() || store->contains(path.name, path.element))
+    ) {
+        if (path.element.empty()) {
+            if (store->contains(path.name, "default")) {
+                printf("default\n");
+            }
+            for (const auto &e : store->elements(path.name)) {
+                if (e != "default") printf("%s\n", e.c_str());
+            }
+        }
+        else {
+            printf("%s.%s\n", path.name.c_str(), path.element.c_str());
+        }
+    }
+}
+
+void print_find(const std::string &pattern) {
+    bool found = false;
+
+    // matches in other vaults than the default one are prefixed
+    for (const auto &s : sessions) {
+        auto prefix = s == sessions.front() ? std::string() : s->name + ":";
+
+        for (const auto &r : s->store->find(pattern)) {
+            if (r.element.empty()) printf("%s%s\n", prefix.c_str(), r.name.c_str());
+            else printf("%s%s.%s\n", prefix.c_str(), r.name.c_str(), r.element.c_str());
+            found = true;
+        }
+    }
+
+    if (! found) {
+        printf("No match for '%s'\n", pattern.c_str());
+    }
+}
 
+bool import_file(const std::string &path) {
+    try {
+        auto n = import_entries(*store, path);
+        printf("Imported %zu entries from '%s'\n", n, path.c_str());
         return true;
     }
+    catch (const Error &e) {
+        printf("%s\n", e.what());
+        return false;
+    }
 }
 
-void save_password_store() {
-    passFile->close();
-    passFile->open(File::READ_WRITE | File::CREATE | File::TRUNCATE, 0600);
-    (OutputFileSerializer(*passFile) << *store).flush();
-    passFile->close();
+bool export_file(const std::string &path) {
+    try {
+        auto n = export_entries(*store, path);
+        printf("Exported %zu entries to '%s', unencrypted\n", n, path.c_str());
+        return true;
+    }
+    catch (const Error &e) {
+        printf("%s\n", e.what());
+        return false;
+    }
+}
+
+/**
+ * Shows the compression of the password file, or sets it to the given deflate
+ * level, from 0 (none) to 9.
+ */
+bool compress_store(const std::string &level) {
+    if (level.empty()) {
+        printf("Compression is %s\n", store->compression().str().c_str());
+        return true;
+    }
+
+    char *end;
+    auto n = strtoul(level.c_str(), &end, 10);
+    if (*end != '\0' || n > 9) {
+        printf("Invalid compression level '%s'\n", level.c_str());
+        return false;
+    }
+
+    auto compression = CompressionParameters::deflate(n);
+    store->recompress(compression);
+    printf(
+        "Compression set to %s; the password file will be rewritten on the next write\n",
+        compression.str().c_str()
+    );
+    return true;
+}
+
+void print_stats() {
+    if (Profiler::shared().enabled()) {
+        printf("%s", Profiler::shared().str().c_str());
+    }
+    else {
+        printf("Profiling is disabled; run with --profile to enable it\n");
+    }
 }
 
 void print_cmd_help(const char *err = nullptr) {
@@ -87,56 +584,71 @@ void print_cmd_help(const char *err = nullptr) {
         "\n"
         "Usage:\n"
         "    (a)dd       <name> <password> : add/overwrite a stored password\n"
+        "    compress    [level]           : show or set the deflate level, 0 to 9\n"
         "    (c)opy      <name>            : copy a stored password to clipboard\n"
+        "    (f)ind      <pattern>         : search names and elements\n"
+        "    export      <file>            : write all passwords to a CSV or JSON file\n"
         "    (g)et       <name>            : get a stored password\n"
+        "    import      <file>            : add all passwords from a CSV or JSON file\n"
         "    (l)ist                        : list all stored passwords\n"
         "    (r)emove    <name>            : remove a stored password\n"
-        "    (w)rite                       : write changes to password file\n"
+        "    stats                         : show time spent per phase and command\n"
+        "    (t)une      [ms] [kdf[:lanes]]: tune key derivation to take ms to unlock\n"
+        "    (w)rite                       : write changes to password file, in the\n"
+        "                                    background\n"
         "    (h)elp                        : show this help\n"
         "    (q)uit|exit                   : terminate\n"
         "\n"
+        "Names are looked up in the first vault opened, or, when several are open,\n"
+        "in the one they are prefixed with, as in work:github.user. Import, export,\n"
+        "tune and compress apply to the first vault, and write to all of them.\n"
+        "\n"
+        "Get, copy, remove and list also take a glob pattern for the name, as in\n"
+        "remove staging-* or get db-*.password. Remove lists the matches and asks\n"
+        "before removing them all at once. A name that exists, such as a[1], is\n"
+        "always taken as it is.\n"
+        "\n"
     );
 }
 
 char * completion_generator(const char *text, int state) {
-    static size_t i;
-    static std::vector<std::string> suggestions;
+    static CompletionCache::iterator next, end;
+    static std::string prefix;
+    static size_t vaults;
+
+    if (state == 0) {
+        next = end;
+        vaults = sessions.size();
+        if (strlen(text) < 2) return nullptr;
 
-    size_t len;
+        // the candidates are copied out of the store, so a save may go on
+        // once they are built
+        std::lock_guard<std::mutex> lock(saver->mutex());
 
-    if (state) {
-        ++i;
+        // names in the vault text is prefixed with, and otherwise names in the
+        // default vault, followed by the other vaults
+        auto path = get_password_path(text);
+        int i = resolve_vault(path, session_names());
+        Session *s = sessions[i < 0 ? 0 : i].get();
+        prefix = i < 0 ? std::string() : s->name + ":";
+        if (prefix.empty() && sessions.size() > 1) vaults = 0;
+
+        auto range = s->completions.complete(*s->store, text + prefix.size(), rl_completion_quote_character);
+        next = range.begin();
+        end = range.end();
     }
-    else {
-        i = 0;
-        len = strlen(text);
-        suggestions.clear();
-    }
-
-    if (len < 2) return nullptr;
-
-    if (i == 0) {
-        if (strrchr(text, '.')) {
-            auto n = std::string(text);
-            n = n.substr(0, n.rfind("."));
-            auto n_unescaped = unescape(n);
-            if (store->passwords().contains(n_unescaped)) {
-                for (const auto &x: store->passwords()[n_unescaped]) {
-                    auto s = n + '.' + x.k;
-                    if (! rl_completion_quote_character) s = escape(s);
-                    if (strncmp(s.c_str(), text, len) == 0) suggestions.push_back(s);
-                }
-            }
-        }
-        else {
-            for (auto s : store->list()) {
-                if (! rl_completion_quote_character) s = escape(s);
-                if (strncmp(s.c_str(), text, len) == 0) suggestions.push_back(s);
-            }
+
+    if (next != end) return strdup((prefix + *next++).c_str());
+
+    while (vaults < sessions.size()) {
+        const auto &name = sessions[vaults++]->name;
+        if (strncmp(name.c_str(), text, strlen(text)) == 0) {
+            // so that the name can be typed right after the colon
+            rl_completion_suppress_append = 1;
+            return strdup((name + ":").c_str());
         }
     }
-
-    return (i < suggestions.size()) ? strdup(suggestions[i].c_str()) : nullptr;
+    return nullptr;
 }
 
 char ** completion_func(const char *text, int start, int end) {
@@ -160,146 +672,184 @@ void command_line() {
 
     char *str;
 
+    // the REPL holds the saver's mutex while it uses the stores, so it only
+    // waits for saves to be sealed, not written
+    saver.reset(new BackgroundSaver([] {
+        auto write = prepare_sessions();
+        return std::function<void()>([write] {
+            auto errors = write();
+            if (! errors.empty()) throw Error(errors);
+        });
+    }, autosave));
+
     while (true) {
+        // saves that failed since the last prompt
+        print_save_errors();
+
         str = readline("\n>> ");
+
+        // waits for a save being prepared, if any; its files are written
+        // without the lock
+        std::unique_lock<std::mutex> lock(saver->mutex());
+
         Command cmd = parse_command(str);
-        free(str);
+        ProfileScope scope("command", command_name(cmd.type));
+        use_session(cmd.path);
 
         switch (cmd.type) {
         case CommandType::ADD:
             if (cmd.path.element.empty()) cmd.path.element = "default";
-            store->passwords()[cmd.path.name][cmd.path.element] = cmd.value;
+            store->put(cmd.path.name, cmd.path.element, cmd.value);
+            saver->mutated();
         break;
 
         case CommandType::REMOVE:
-            add_history(cmd.cmdStr.c_str());
+            add_history(str);
 
-            if (store->passwords().contains(cmd.path.name)) {
-                if (cmd.path.element.empty()) {
-                    store->passwords().erase(cmd.path.name);
+            if (remove_password(cmd.path, true, &lock)) saver->mutated();
+        break;
 
-                    printf("'%s' removed\n", cmd.path.name.c_str());
-                }
-                else if (store->passwords()[cmd.path.name].erase(cmd.path.element)) {
-                    if (store->passwords()[cmd.path.name].empty()) {
-                        store->passwords().erase(cmd.path.name);
-                        printf("'%s' removed\n", cmd.path.name.c_str());
-                    }
-                    else {
-                        printf("'%s.%s' removed\n", cmd.path.name.c_str(), cmd.path.element.c_str());
-                    }
+        case CommandType::GET:
+            add_history(str);
 
+            print_password(cmd.path);
+        break;
+
+        case CommandType::COPY:
+            add_history(str);
+
+            if (cmd.path.element.empty()) cmd.path.element = "default";
+
+            if (pattern_path(cmd.path)) {
+                // only a single match can be copied
+                auto names = match_names(cmd.path);
+                if (names.empty()) break;
+                if (names.size() > 1) {
+                    for (const auto &n : names) printf("%s\n", path_str(n, cmd.path.element).c_str());
+                    printf("\n'%s' matches %zu entries; copy takes one\n", cmd.path.name.c_str(), names.size());
+                    break;
                 }
-                else {
-                    printf("'%s.%s' not found\n", cmd.path.name.c_str(), cmd.path.element.c_str());
-                }
+                cmd.path.name = names.front();
             }
-            else {
-                printf("'%s' not found\n", cmd.path.name.c_str());
-            }
-        break;
 
-        case CommandType::GET:
-            add_history(cmd.cmdStr.c_str());
-
-            if (store->passwords().contains(cmd.path.name)) {
-                if (cmd.path.element.empty()) {
-                    printf("%s: {\n", cmd.path.name.c_str());
-                    if (store->passwords()[cmd.path.name].contains("default")) {
-                        printf(
-                            "    default: %s\n",
-                            store->passwords()[cmd.path.name]["default"].c_str()
-                        );
-                    }
-                    for (const auto &x : store->passwords()[cmd.path.name]) {
-                        if (x.k != "default") {
-                            printf("    %s: %s\n", x.k.c_str(), x.v.c_str());
-                        }
-                    }
-                    printf("}\n");
+            if (store->contains(cmd.path.name, cmd.path.element)) {
+                auto &clipboard = ClipboardBackend::get();
+
+                // once, on the first copy
+                static bool warned = false;
+                if (! warned && ! ClipboardBackend::warning().empty()) {
+                    printf("%s\n", ClipboardBackend::warning().c_str());
                 }
-                else if (store->passwords()[cmd.path.name].contains(cmd.path.element)) {
+                warned = true;
+
+                if (clipboard.setText(store->get(cmd.path.name, cmd.path.element))) {
                     printf(
-                        "%s.%s: %s\n",
-                        cmd.path.name.c_str(), cmd.path.element.c_str(),
-                        store->passwords()[cmd.path.name][cmd.path.element].c_str()
+                        "Password '%s.%s' %s\n",
+                        cmd.path.name.c_str(), cmd.path.element.c_str(), clipboard.destination()
                     );
                 }
                 else {
-                    printf("'%s.%s' not found\n", cmd.path.name.c_str(), cmd.path.element.c_str());
+                    printf("An error occurred while copying data to the %s clipboard\n", clipboard.name());
                 }
             }
             else {
-                printf("'%s' not found\n", cmd.path.name.c_str());
+                printf("'%s.%s' not found\n", cmd.path.name.c_str(), cmd.path.element.c_str());
             }
         break;
 
-        case CommandType::COPY:
-            add_history(cmd.cmdStr.c_str());
+        case CommandType::LIST:
+            add_history(str);
 
-            if (cmd.path.element.empty()) cmd.path.element = "default";
+            print_list(cmd.path);
+        break;
 
-            if (
-                store->passwords().contains(cmd.path.name)
-                && store->passwords()[cmd.path.name].contains(cmd.path.element)
-            ) {
-                if (clip::set_text(store->passwords()[cmd.path.name][cmd.path.element])) {
-                    printf("Password '%s.%s' copied to clipboard\n", cmd.path.name.c_str(), cmd.path.element.c_str());
-                }
-                else {
-                    printf("An error occurred while copying data to clipboard\n");
-                }
-            }
-            else {
-                printf("'%s.%s' not found\n", cmd.path.name.c_str(), cmd.path.element.c_str());
-            }
+        case CommandType::FIND:
+            add_history(str);
+
+            print_find(cmd.path.name);
         break;
 
-        case CommandType::LIST:
-            add_history(cmd.cmdStr.c_str());
+        case CommandType::STATS:
+            add_history(str);
 
-            if (cmd.path.name.empty()) {
-                auto l = store->list();
+            print_stats();
+        break;
 
-                if (l.empty()) {
-                    printf("<Empty>\n");
-                }
-                else {
-                    for (const auto &n : l) {
-                        printf("%s\n", n.c_str());
-                    }
-                }
-            }
-            else {
-                if (
-                    store->passwords().contains(cmd.path.name)
-                    && (cmd.path.element.empty() || store->passwords()[cmd.path.name].contains(cmd.path.element))
-                ) {
-                    if (cmd.path.element.empty()) {
-                        if (store->passwords()[cmd.path.name].contains("default")) {
-                            printf("default\n");
-                        }
-                        for (const auto &x : store->passwords()[cmd.path.name]) {
-                            if (x.k != "default") printf("%s\n", x.k.c_str());
-                        }
-                    }
-                    else {
-                        printf("%s.%s\n", cmd.path.name.c_str(), cmd.path.element.c_str());
-                    }
-                }
-            }
+        case CommandType::IMPORT:
+            add_history(str);
+
+            if (import_file(cmd.path.name)) saver->mutated();
+        break;
+
+        case CommandType::EXPORT:
+            add_history(str);
+
+            export_file(cmd.path.name);
+        break;
+
+        case CommandType::COMPRESS:
+            add_history(str);
+
+            if (compress_store(cmd.path.name) && ! cmd.path.name.empty()) saver->mutated();
         break;
 
         case CommandType::HELP:
-            add_history(cmd.cmdStr.c_str());
+            add_history(str);
 
             print_cmd_help();
         break;
 
         case CommandType::WRITE:
-            add_history(cmd.cmdStr.c_str());
+            add_history(str);
+
+            // returns at once; errors are shown at a later prompt
+            saver->request();
+        break;
+
+        case CommandType::TUNE: {
+            add_history(str);
 
-            save_password_store();
+            auto kdf = store->kdf();
+            double ms = 1000;
+            uint32_t lanes = kdf.parallelism ? kdf.parallelism : 1;
+
+            if (! cmd.path.name.empty()) {
+                char *end;
+                ms = strtod(cmd.path.name.c_str(), &end);
+                if (*end != '\0' || ! std::isfinite(ms)) {
+                    printf("Invalid duration '%s'\n", cmd.path.name.c_str());
+                    break;
+                }
+            }
+
+            if (! cmd.value.empty()) {
+                auto sep = cmd.value.find(':');
+                if (sep != std::string::npos) {
+                    char *end;
+                    unsigned long n = strtoul(cmd.value.c_str() + sep + 1, &end, 10);
+                    lanes = *end == '\0' && n <= KDF_MAX_PARALLELISM ? n : 0;
+                    cmd.value.resize(sep);
+                }
+                if (! kdf_algorithm(cmd.value.c_str(), kdf.algorithm)) {
+                    printf("Unknown key derivation function '%s'\n", cmd.value.c_str());
+                    break;
+                }
+            }
+
+            if (ms <= 0 || lanes == 0 || lanes > KDF_MAX_PARALLELISM) {
+                printf("Invalid tuning parameters\n");
+                break;
+            }
+
+            printf("Tuning %s for %.0f ms...\n", kdf_name(kdf.algorithm), ms);
+            kdf = tune_kdf(kdf.algorithm, lanes, ms / 1000);
+            store->rekey(kdf);
+            saver->mutated();
+            printf(
+                "Key derivation set to %s; the password file will be re-encrypted on the next write\n",
+                kdf.str().c_str()
+            );
+        }
         break;
 
         case CommandType::QUIT:
@@ -307,21 +857,468 @@ void command_line() {
         break;
 
         case CommandType::WRITE_QUIT:
-            save_password_store();
+            lock.unlock();
+            saver->request();
+            saver->wait();
+            print_save_errors();
             printf("Bye!\n\n");
         break;
 
         default: break;
         }
 
+        // the command refers into the line
+        free(str);
+
+        if (cmd.type == CommandType::QUIT || cmd.type == CommandType::WRITE_QUIT) {
+            break;
+        }
+    }
+
+    // saves still in flight are finished before the vaults are closed
+    saver->wait();
+    print_save_errors();
+    saver.reset();
+}
+
+/**
+ * Executes commands read line by line from in, without readline and without
+ * printing anything but query results and errors. All changes are saved once,
+ * at the end of input or on 'wq'; 'q' stops and discards them. Returns the
+ * number of errors.
+ */
+size_t batch(FILE *in) {
+    auto start = std::chrono::steady_clock::now();
+
+    char *line = nullptr;
+    size_t cap = 0, lineno = 0, commands = 0, errors = 0;
+    ssize_t len;
+    bool save = true;
+
+    while ((len = getline(&line, &cap, in)) >= 0) {
+        ++lineno;
+
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) line[--len] = '\0';
+
+        // blank lines and comments
+        char *p = line;
+        while (*p == ' ') ++p;
+        if (*p == '\0' || *p == '#') continue;
+
+        ++commands;
+        Command cmd = parse_command(p);
+        ProfileScope scope("command", command_name(cmd.type));
+        use_session(cmd.path);
+        bool ok = true;
+
+        switch (cmd.type) {
+        case CommandType::ADD:
+            if (cmd.path.element.empty()) cmd.path.element = "default";
+            store->put(cmd.path.name, cmd.path.element, cmd.value);
+        break;
+
+        case CommandType::REMOVE:
+            ok = remove_password(cmd.path, false);
+        break;
+
+        case CommandType::GET:
+            ok = print_password(cmd.path);
+        break;
+
+        case CommandType::LIST:
+            print_list(cmd.path);
+        break;
+
+        case CommandType::FIND:
+            print_find(cmd.path.name);
+        break;
+
+        case CommandType::STATS:
+            print_stats();
+        break;
+
+        case CommandType::IMPORT:
+            ok = import_file(cmd.path.name);
+        break;
+
+        case CommandType::EXPORT:
+            ok = export_file(cmd.path.name);
+        break;
+
+        case CommandType::COMPRESS:
+            ok = compress_store(cmd.path.name);
+        break;
+
+        case CommandType::WRITE:
+            // everything is written at the end
+        break;
+
+        case CommandType::QUIT:
+            save = false;
+        break;
+
+        case CommandType::WRITE_QUIT:
+        break;
+
+        case CommandType::INVALID:
+            ok = false;
+        break;
+
+        default:
+            printf("'%s' is not supported in batch mode\n", cmd.cmdStr.str().c_str());
+            ok = false;
+        break;
+        }
+
+        if (! ok) {
+            printf("    at line %zu\n", lineno);
+            ++errors;
+        }
+
         if (cmd.type == CommandType::QUIT || cmd.type == CommandType::WRITE_QUIT) {
             break;
         }
     }
+
+    free(line);
+
+    if (save && ! save_password_store()) ++errors;
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf(
+        "%zu commands, %zu errors, in %.3f s (%.0f commands/s)\n",
+        commands, errors, seconds, seconds > 0 ? commands / seconds : 0
+    );
+
+    return errors;
+}
+
+void report_status(int fd, const std::string &status) {
+    // nothing more can be done if the foreground process is gone
+    if (write(fd, status.data(), status.size()) < 0) return;
+}
+
+/**
+ * Unlocks the password store and serves it from a background agent. The store
+ * is opened by the agent process itself, since worker threads do not survive
+ * fork(), and the result is reported back to the foreground process through a
+ * pipe.
+ */
+int run_agent(unsigned timeout) {
+    auto &session = *sessions.front();
+    if (! sessions_available()) return 1;
+
+    char password[PASS_MAX + 1];
+    read_password(session.path, password);
+
+    int ready[2];
+    if (pipe(ready) != 0) {
+        printf("Failed to start agent\n");
+        return 1;
+    }
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        printf("Failed to start agent\n");
+        return 1;
+    }
+
+    if (pid > 0) {
+        SecureArena::wipe(password, sizeof(password));
+        close(ready[1]);
+
+        // a status character, followed by an error message on failure
+        std::string status;
+        char buf[256];
+        ssize_t n;
+        while ((n = read(ready[0], buf, sizeof(buf))) > 0) status.append(buf, n);
+        close(ready[0]);
+
+        if (status.empty() || status[0] != '0') {
+            printf("%s\n", status.size() > 1 ? status.c_str() + 1 : "Failed to start agent");
+            return 1;
+        }
+
+        printf("Agent listening on '%s' (pid %d)\n", agent_socket_path().c_str(), pid);
+        return 0;
+    }
+
+    close(ready[0]);
+    setsid();
+
+    Agent *agent = nullptr;
+    try {
+        {
+            ProfileScope unlock("unlock");
+            open_session(session, password);
+        }
+        SecureArena::wipe(password, sizeof(password));
+        use_session(session);
+
+        agent = new Agent(
+            agent_socket_path(), *store, *vault, timeout,
+            [] (const std::string &text) {
+                auto &clipboard = ClipboardBackend::get();
+                if (clipboard.setText(text)) return true;
+
+                // the agent has no terminal to send OSC 52 to, so this is the
+                // likely reason
+                if (! ClipboardBackend::warning().empty()) throw Error(ClipboardBackend::warning());
+                return false;
+            }
+        );
+        agent->listen();
+    }
+    catch (const Error &e) {
+        report_status(ready[1], std::string("1") + e.what());
+        _exit(1);
+    }
+
+    report_status(ready[1], "0");
+    close(ready[1]);
+
+    int null = open("/dev/null", O_RDWR);
+    if (null >= 0) {
+        dup2(null, STDIN_FILENO);
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        if (null > STDERR_FILENO) close(null);
+    }
+
+    try {
+        agent->serve();
+        vault->close();
+    }
+    catch (const Error &) { }
+
+    delete agent;
+    return 0;
+}
+
+/**
+ * Sends a single command, given as arguments, to a running agent. Returns 0 on
+ * success, 1 if the command failed, and 2 if no agent could be reached.
+ */
+int run_client(int argc, char **argv) {
+    std::string line;
+    for (int i = 0; i < argc; ++i) {
+        if (i > 0) line += ' ';
+        line += escape(argv[i]);
+    }
+
+    // a password given as an argument would show in ps and in the shell's
+    // history, so it is prompted for, or read from stdin when not a terminal
+    if (argc > 0 && command_type(argv[0]) == CommandType::ADD) {
+        if (argc != 2) {
+            printf("Usage: --client add <name>; the password is read from stdin\n");
+            return 1;
+        }
+
+        char value[PASS_MAX + 2];
+        if (isatty(STDIN_FILENO)) {
+            printf("Password: ");
+            fflush(stdout);
+            get_password(value);
+        }
+        else if (fgets(value, sizeof(value), stdin) != nullptr) {
+            value[strcspn(value, "\r\n")] = '\0';
+        }
+        else {
+            value[0] = '\0';
+        }
+
+        line += ' ' + escape(value);
+        SecureArena::wipe(value, sizeof(value));
+    }
+
+    Command cmd = parse_command(&line[0]);
+    AgentOp op;
+
+    // the agent serves a single vault
+    if (! cmd.path.vault.empty()) {
+        cmd.path.name = cmd.path.vault + ":" + cmd.path.name;
+        cmd.path.vault.clear();
+    }
+    std::vector<std::string> fields;
+
+    switch (cmd.type) {
+    case CommandType::GET:
+        op = AgentOp::GET;
+        fields = { cmd.path.name, cmd.path.element };
+    break;
+
+    case CommandType::COPY:
+        op = AgentOp::COPY;
+        fields = { cmd.path.name, cmd.path.element };
+    break;
+
+    case CommandType::ADD:
+        op = AgentOp::ADD;
+        fields = { cmd.path.name, cmd.path.element, cmd.value };
+    break;
+
+    case CommandType::LIST:
+        op = AgentOp::LIST;
+        fields = { cmd.path.name };
+    break;
+
+    case CommandType::QUIT:
+        op = AgentOp::STOP;
+    break;
+
+    case CommandType::INVALID:
+        return 1;
+
+    default:
+        printf("'%s' is not supported by the agent\n", cmd.cmdStr.str().c_str());
+        return 1;
+    }
+
+    AgentMessage response;
+    try {
+        response = AgentClient(agent_socket_path()).request(op, fields);
+        for (auto &f : fields) SecureArena::wipe(f);
+        SecureArena::wipe(line);
+    }
+    catch (const Error &e) {
+        printf("%s\n", e.what());
+        return 2;
+    }
+
+    switch (static_cast<AgentStatus>(response.code)) {
+    case AgentStatus::OK:
+        if (op == AgentOp::GET && ! cmd.path.element.empty()) {
+            if (! response.fields.empty()) printf("%s\n", response.fields[0].c_str());
+        }
+        else if (op == AgentOp::GET) {
+            for (size_t i = 0; i + 1 < response.fields.size(); i += 2) {
+                printf("%s: %s\n", response.fields[i].c_str(), response.fields[i + 1].c_str());
+            }
+        }
+        else if (op == AgentOp::LIST) {
+            for (const auto &f : response.fields) printf("%s\n", f.c_str());
+        }
+        return 0;
+
+    case AgentStatus::NOT_FOUND:
+        if (cmd.path.element.empty()) {
+            printf("'%s' not found\n", cmd.path.name.c_str());
+        }
+        else {
+            printf("'%s.%s' not found\n", cmd.path.name.c_str(), cmd.path.element.c_str());
+        }
+        return 1;
+
+    default:
+        printf("%s\n", response.fields.empty() ? "Agent error" : response.fields[0].c_str());
+        return 1;
+    }
+}
+
+void print_usage(const char *argv0) {
+    printf(
+        "Usage: %s [-v|--vault [name=]path]... [--profile] [--autosave <n>]\n"
+        "       %s [-v|--vault [name=]path]... [--profile] -b|--batch [file]\n"
+        "       %s [-v|--vault [name=]path] [--profile] -a|--agent [--timeout <seconds>]\n"
+        "       %s [-v|--vault [name=]path] -c|--client <command> [args]\n"
+        "\n"
+        "    -v, --vault [name=]path  : open the password file at path, addressed\n"
+        "                               as name: in commands; by default, named\n"
+        "                               after the file. May be given several times\n"
+        "                               to unlock several files in parallel; the\n"
+        "                               first is the default (default: ~/.pwdman)\n"
+        "    -b, --batch [file]       : execute commands from file, or from stdin if\n"
+        "                               no file or '-' is given, and write once at\n"
+        "                               the end\n"
+        "        --autosave <n>       : in interactive sessions, write in the\n"
+        "                               background after every n changes\n"
+        "                               (default: 0 for only on write)\n"
+        "    -a, --agent              : unlock the password store and keep it\n"
+        "                               resident in a background agent\n"
+        "        --timeout <seconds>  : stop the agent once idle for this long\n"
+        "                               (default: %u; 0 for never)\n"
+        "    -c, --client <command>   : send a get, copy, add or list command to\n"
+        "                               the agent, or quit to stop it; add reads\n"
+        "                               the password from stdin\n"
+        "        --profile            : time each phase of reading and writing the\n"
+        "                               password file and each command, and write\n"
+        "                               the results to stderr as JSON on exit\n"
+        "\n",
+        argv0, argv0, argv0, argv0, AGENT_TIMEOUT
+    );
 }
 
 int main(int argc, char **argv) {
+    bool batchMode = false, agentMode = false, profile = false;
+    const char *script = nullptr;
+    unsigned timeout = AGENT_TIMEOUT;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-b") == 0 || strcmp(argv[i], "--batch") == 0) {
+            batchMode = true;
+            if (i + 1 < argc && (argv[i + 1][0] != '-' || strcmp(argv[i + 1], "-") == 0)) script = argv[++i];
+        }
+        else if (strcmp(argv[i], "-a") == 0 || strcmp(argv[i], "--agent") == 0) {
+            agentMode = true;
+        }
+        else if (strcmp(argv[i], "--profile") == 0) {
+            profile = true;
+        }
+        else if (strcmp(argv[i], "--timeout") == 0 && i + 1 < argc) {
+            timeout = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "--autosave") == 0 && i + 1 < argc) {
+            autosave = strtoul(argv[++i], nullptr, 10);
+        }
+        else if ((strcmp(argv[i], "-v") == 0 || strcmp(argv[i], "--vault") == 0) && i + 1 < argc) {
+            if (! add_session(argv[++i])) exit(1);
+        }
+        else if ((strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--client") == 0) && i + 1 < argc) {
+            exit(run_client(argc - i - 1, argv + i + 1));
+        }
+        else {
+            print_usage(argv[0]);
+            exit(1);
+        }
+    }
+
+    if (sessions.empty()) add_session(password_file_path());
+    if (agentMode && sessions.size() > 1) {
+        printf("The agent serves a single vault\n");
+        exit(1);
+    }
+
+    // interactive sessions always profile, for the stats command; the cost is
+    // negligible at typing speed
+    if (profile || ! (batchMode || agentMode)) Profiler::shared().enable();
+    if (profile) {
+        atexit([] { fprintf(stderr, "%s", Profiler::shared().json().c_str()); });
+    }
+
+    if (agentMode) exit(run_agent(timeout));
+
+    FILE *in = stdin;
+    if (script != nullptr && strcmp(script, "-") != 0) {
+        in = fopen(script, "r");
+        if (in == nullptr) {
+            printf("Failed to open '%s'\n", script);
+            exit(1);
+        }
+    }
+
     if (! initialize_password_store()) exit(1);
-    command_line();
-    exit(0);
+
+    int status = 0;
+    if (batchMode) {
+        if (batch(in) > 0) status = 1;
+        if (in != stdin) fclose(in);
+    }
+    else {
+        command_line();
+    }
+
+    close_password_store();
+
+    exit(status);
 }
@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2023 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#include <mapped_file.h>
+#include <error.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace spl;
+
+MappedFile::MappedFile(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw Error("Failed to open password file");
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || st.st_size == 0) {
+        ::close(fd);
+        throw Error("Failed to map password file");
+    }
+
+    // reading ahead is started before mapping, so that on slow (e.g. network)
+    // file systems the transfer overlaps with key derivation
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+
+    void *p = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) throw Error("Failed to map password file");
+
+    ::madvise(p, st.st_size, MADV_SEQUENTIAL);
+    ::madvise(p, st.st_size, MADV_WILLNEED);
+
+    _data = static_cast<const char *>(p);
+    _size = st.st_size;
+}
+
+MappedFile::~MappedFile() {
+    ::munmap(const_cast<char *>(_data), _size);
+}
+
+void MappedFile::random() const {
+    ::madvise(const_cast<char *>(_data), _size, MADV_RANDOM);
+}
@@ -0,0 +1,290 @@
+/*
+ * Copyright (c) 2023 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#include <name_search.h>
+#include <worker_pool.h>
+#include <algorithm>
+#include <string.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// candidates per task; large enough to amortize scheduling, small enough to
+// keep all workers busy
+static const size_t TASK_CANDIDATES = 16384;
+
+// score layout: fuzzy flag, substring match kind, position or gaps, length
+static const uint64_t FUZZY = 1ull << 62;
+
+static const int KIND_SHIFT = 60;
+
+static const int PENALTY_SHIFT = 32;
+
+static const uint64_t PENALTY_MAX = (1ull << 20) - 1;
+
+static char fold(char c) {
+    return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+static bool boundary(char c) {
+    return ! ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9'));
+}
+
+static uint64_t score(uint64_t kind, uint64_t penalty, uint32_t length) {
+    return (kind << KIND_SHIFT) | (std::min(penalty, PENALTY_MAX) << PENALTY_SHIFT) | length;
+}
+
+/**
+ * Calls f(i), in increasing order, for every i in [begin, end - needle size]
+ * at which s holds needle, and f returns the position to resume from.
+ * Positions are filtered a block at a time by comparing the needle's first and
+ * last bytes, and only the survivors are compared in full.
+ */
+template <typename F>
+static void scan(const char *s, size_t begin, size_t end, const std::string &needle, F f) {
+    size_t m = needle.size();
+    if (end - begin < m) return;
+
+    size_t last = end - m;
+    size_t inner = m > 2 ? m - 2 : 0;
+    size_t i = begin;
+    size_t from = begin;
+
+#if defined(__AVX2__)
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i tail = _mm256_set1_epi8(needle[m - 1]);
+
+    for (; i + 32 <= last + 1; i += 32) {
+        if (from >= i + 32) continue;
+
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + i + m - 1));
+        uint32_t bits = _mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, tail))
+        );
+
+        while (bits) {
+            size_t k = i + __builtin_ctz(bits);
+            if (k >= from && (inner == 0 || memcmp(s + k + 1, needle.data() + 1, inner) == 0)) from = f(k);
+            bits &= bits - 1;
+        }
+    }
+#elif defined(__SSE2__)
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i tail = _mm_set1_epi8(needle[m - 1]);
+
+    for (; i + 16 <= last + 1; i += 16) {
+        if (from >= i + 16) continue;
+
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i + m - 1));
+        uint32_t bits = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, tail)));
+
+        while (bits) {
+            size_t k = i + __builtin_ctz(bits);
+            if (k >= from && (inner == 0 || memcmp(s + k + 1, needle.data() + 1, inner) == 0)) from = f(k);
+            bits &= bits - 1;
+        }
+    }
+#endif
+
+    for (i = std::max(i, from); i <= last; ++i) {
+        if (
+            s[i] == needle[0] && s[i + m - 1] == needle[m - 1]
+            && memcmp(s + i + 1, needle.data() + 1, inner) == 0
+        ) {
+            i = f(i) - 1;
+        }
+    }
+}
+
+/**
+ * The limit lowest (score, candidate) pairs seen, kept as a max-heap so that
+ * most matches are rejected with a single compare.
+ */
+class Best {
+
+private:
+
+    size_t _limit;
+    size_t _seen = 0;
+    std::vector<std::pair<uint64_t, uint32_t>> _heap;
+
+public:
+
+    explicit Best(size_t limit)
+    :   _limit(limit)
+    { }
+
+    void add(uint64_t score, uint32_t candidate) {
+        std::pair<uint64_t, uint32_t> x(score, candidate);
+        ++_seen;
+
+        if (_heap.size() < _limit) {
+            _heap.push_back(x);
+            std::push_heap(_heap.begin(), _heap.end());
+        }
+        else if (x < _heap.front()) {
+            std::pop_heap(_heap.begin(), _heap.end());
+            _heap.back() = x;
+            std::push_heap(_heap.begin(), _heap.end());
+        }
+    }
+
+    size_t seen() const {
+        return _seen;
+    }
+
+    const std::vector<std::pair<uint64_t, uint32_t>> & items() const {
+        return _heap;
+    }
+};
+
+// one bit per letter and digit, and the remaining bits shared by all other
+// bytes, so that a candidate lacking any byte of the pattern can be skipped
+// without looking at it
+uint64_t NameSearch::mask(const char *s, size_t len) {
+    uint64_t m = 0;
+    for (size_t i = 0; i < len; ++i) {
+        uint8_t c = s[i];
+        if (c >= 'a' && c <= 'z') m |= 1ull << (c - 'a');
+        else if (c >= '0' && c <= '9') m |= 1ull << (26 + c - '0');
+        else m |= 1ull << (36 + c % 28);
+    }
+    return m;
+}
+
+NameSearch::NameSearch()
+:   _offsets(1, 0)
+{ }
+
+void NameSearch::clear() {
+    _text.clear();
+    _folded.clear();
+    _offsets.assign(1, 0);
+    _elements.clear();
+    _masks.clear();
+}
+
+void NameSearch::add(StringRef name, StringRef element) {
+    size_t start = _text.size();
+
+    _text.append(name.data, name.size);
+    if (! element.empty()) {
+        _text.push_back('.');
+        _text.append(element.data, element.size);
+    }
+    _text.push_back('\n');
+
+    for (size_t i = start; i < _text.size(); ++i) _folded.push_back(fold(_text[i]));
+
+    _offsets.push_back(_text.size());
+    _elements.push_back(element.size);
+    _masks.push_back(mask(_folded.data() + start, _text.size() - start - 1));
+}
+
+SearchResult NameSearch::result(uint32_t candidate, uint64_t score) const {
+    const char *s = _text.data() + _offsets[candidate];
+    uint32_t len = length(candidate);
+    uint32_t element = _elements[candidate];
+
+    SearchResult r;
+    if (element == 0) {
+        r.name.assign(s, len);
+    }
+    else {
+        r.name.assign(s, len - element - 1);
+        r.element.assign(s + len - element, element);
+    }
+    r.score = score;
+    return r;
+}
+
+std::vector<SearchResult> NameSearch::find(const std::string &pattern, size_t limit) const {
+    std::string p;
+    for (auto c : pattern) p.push_back(fold(c));
+
+    std::vector<SearchResult> results;
+    if (p.empty() || limit == 0 || size() == 0) return results;
+
+    size_t n = size();
+    size_t tasks = (n + TASK_CANDIDATES - 1) / TASK_CANDIDATES;
+    const char *s = _folded.data();
+
+    std::vector<Best> substring(tasks, Best(limit));
+
+    WorkerPool::shared().run(tasks, [&] (size_t t) {
+        uint32_t begin = t * TASK_CANDIDATES;
+        uint32_t end = std::min(n, begin + TASK_CANDIDATES);
+        auto &best = substring[t];
+
+        // candidates end with a newline, which the pattern cannot contain,
+        // so no match spans two candidates, and only the first match in each
+        // candidate is scored
+        uint32_t c = begin;
+        scan(s, _offsets[begin], _offsets[end], p, [&] (size_t pos) -> size_t {
+            while (_offsets[c + 1] <= pos) ++c;
+
+            // prefix matches, then matches starting a word, then the rest
+            uint32_t at = pos - _offsets[c];
+            uint64_t kind = at == 0 ? 0 : boundary(s[pos - 1]) ? 1 : 2;
+            best.add(score(kind, at, length(c)), c);
+
+            return _offsets[c + 1];
+        });
+    });
+
+    std::vector<std::pair<uint64_t, uint32_t>> all;
+    size_t matches = 0;
+    for (const auto &b : substring) {
+        all.insert(all.end(), b.items().begin(), b.items().end());
+        matches += b.seen();
+    }
+
+    // substring matches rank above every fuzzy one, so the fuzzy pass only
+    // runs when they leave room; all of them are then in all
+    if (matches < limit && p.size() >= 2) {
+        std::vector<uint32_t> skip;
+        for (const auto &x : all) skip.push_back(x.second);
+        std::sort(skip.begin(), skip.end());
+
+        uint64_t need = mask(p.data(), p.size());
+        std::vector<Best> fuzzy(tasks, Best(limit - matches));
+
+        // the pattern as a subsequence, matched greedily; fewer gaps rank
+        // higher
+        WorkerPool::shared().run(tasks, [&] (size_t t) {
+            uint32_t begin = t * TASK_CANDIDATES;
+            uint32_t end = std::min(n, begin + TASK_CANDIDATES);
+
+            for (uint32_t c = begin; c < end; ++c) {
+                if ((_masks[c] & need) != need) continue;
+
+                const char *q = s + _offsets[c];
+                const char *qend = q + length(c);
+                const char *start = nullptr;
+
+                // candidates are short, so a plain loop beats memchr here
+                size_t k = 0;
+                for (; q < qend && k < p.size(); ++q) {
+                    if (*q != p[k]) continue;
+                    if (k++ == 0) start = q;
+                }
+                if (k < p.size() || std::binary_search(skip.begin(), skip.end(), c)) continue;
+
+                fuzzy[t].add(FUZZY | score(0, (q - start) - p.size(), length(c)), c);
+            }
+        });
+
+        for (const auto &b : fuzzy) all.insert(all.end(), b.items().begin(), b.items().end());
+    }
+
+    // ties are broken by candidate order
+    limit = std::min(limit, all.size());
+    std::partial_sort(all.begin(), all.begin() + limit, all.end());
+
+    for (size_t i = 0; i < limit; ++i) results.push_back(result(all[i].second, all[i].first));
+    return results;
+}
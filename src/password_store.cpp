@@ -4,13 +4,24 @@
 */
 
 #include <password_store.h>
+#include <worker_pool.h>
+#include <profiler.h>
 #include <libcryptopp/default.h>
 #include <libcryptopp/filters.h>
+#include <libcryptopp/gcm.h>
 #include <libcryptopp/hex.h>
+#include <libcryptopp/modes.h>
+#include <libcryptopp/misc.h>
+#include <libcryptopp/osrng.h>
+#include <libcryptopp/zdeflate.h>
+#include <libcryptopp/zinflate.h>
 #include <std_serialization.h>
 #include <json.h>
+#include <file.h>
 #include <error.h>
 #include <algorithm>
+#include <string.h>
+#include <fnmatch.h>
 #include <functional>
 
 using DataParameters = CryptoPP::DataParametersInfo<
@@ -35,22 +46,773 @@ using Decryptor = CryptoPP::DataDecryptorWithMAC<
     DataParameters
 >;
 
+using SegmentEncryption = CryptoPP::CBC_Mode<CryptoPP::AES>::Encryption;
+
+using SegmentDecryption = CryptoPP::CBC_Mode<CryptoPP::AES>::Decryption;
+
+using SegmentMAC = CryptoPP::HMAC<CryptoPP::SHA256>;
+
+using ValueEncryption = CryptoPP::CTR_Mode<CryptoPP::AES>::Encryption;
+
+using ValueDecryption = CryptoPP::CTR_Mode<CryptoPP::AES>::Decryption;
+
+using ValueMAC = CryptoPP::HMAC<CryptoPP::SHA256>;
+
+// from version 8, segments, journal records and values are sealed in a single
+// pass, which Crypto++ runs on AES-NI and PCLMULQDQ where available
+using AEAD = CryptoPP::GCM<CryptoPP::AES>;
+
 static const uint64_t MAGIC = 0x5555555555551234;
 
-static const uint32_t VERSION = 1;
+static const uint32_t VERSION = 10;
+
+// first version sealed with AEAD
+static const uint32_t AEAD_VERSION = 8;
+
+// first version with compressed segment indexes
+static const uint32_t COMPRESSION_VERSION = 9;
+
+// first version recording the tag of each sealed value in the segment index,
+// which binds the value to that index rather than to its name alone
+static const uint32_t BOUND_VALUE_VERSION = 10;
+
+static const size_t SALT_SIZE = 16;
+
+static const size_t SNAPSHOT_ID_SIZE = 16;
+
+static const size_t CIPHER_KEY_SIZE = CryptoPP::AES::DEFAULT_KEYLENGTH;
+
+static const size_t MAC_KEY_SIZE = SegmentMAC::DIGESTSIZE;
+
+static const size_t IV_SIZE = CryptoPP::AES::BLOCKSIZE;
+
+static const size_t TAG_SIZE = SegmentMAC::DIGESTSIZE;
+
+static const size_t VALUE_TAG_SIZE = 16;
+
+static const size_t AEAD_IV_SIZE = 12;
+
+static const size_t AEAD_TAG_SIZE = 16;
+
+// derived key layout: segment cipher key, segment MAC key, value cipher key,
+// value MAC key
+static const size_t KEY_SIZE = 2 * (CIPHER_KEY_SIZE + MAC_KEY_SIZE);
+
+static const size_t VALUE_KEY_OFFSET = CIPHER_KEY_SIZE + MAC_KEY_SIZE;
+
+// target number of names per segment; the segment count is a power of two
+// chosen so that segments hold at most this many names on average
+static const size_t SEGMENT_ENTRIES = 256;
+
+static const size_t STREAM_CHUNK = 4096;
+
+// journal operations
+static const uint32_t JOURNAL_PUT = 0;
+static const uint32_t JOURNAL_REMOVE = 1;
+static const uint32_t JOURNAL_REMOVE_ELEMENT = 2;
+
+static uint32_t segment_of(StringRef name, size_t count) {
+    // FNV-1a; must be stable across builds since it determines file layout
+    uint64_t h = 0xcbf29ce484222325;
+    for (size_t i = 0; i < name.size; ++i) {
+        h ^= static_cast<uint8_t>(name.data[i]);
+        h *= 0x100000001b3;
+    }
+    return static_cast<uint32_t>(h & (count - 1));
+}
+
+static size_t segment_count(size_t entries, size_t current) {
+    size_t count = 1;
+    while (count * SEGMENT_ENTRIES < entries) count <<= 1;
+
+    // keep the current layout unless it became too small or grossly oversized,
+    // since changing it requires re-encrypting every segment
+    if (current != 0 && count <= current && count * 4 > current) return current;
+    return count;
+}
+
+static const CryptoPP::byte * bytes(const std::string &s) {
+    return reinterpret_cast<const CryptoPP::byte *>(s.data());
+}
+
+static const CryptoPP::byte * bytes(const SecureString &s) {
+    return reinterpret_cast<const CryptoPP::byte *>(s.data());
+}
+
+static const CryptoPP::byte * bytes(StringRef s) {
+    return reinterpret_cast<const CryptoPP::byte *>(s.data);
+}
+
+static std::string hex_decode(const std::string &hex) {
+    std::string raw;
+    CryptoPP::StringSource ss(hex, true,
+        new CryptoPP::HexDecoder(
+            new CryptoPP::StringSink(raw)
+        )
+    );
+    return raw;
+}
+
+// data authenticated along with a segment: its index and the segment count
+static std::string segment_context(uint32_t index, uint32_t count) {
+    std::string context;
+    context.append(reinterpret_cast<const char *>(&index), sizeof(index));
+    context.append(reinterpret_cast<const char *>(&count), sizeof(count));
+    return context;
+}
+
+// data authenticated along with a journal record: the snapshot it applies to
+// and its position in the journal
+static std::string journal_context(const std::string &snapshot, uint64_t seq) {
+    std::string context("journal");
+    context.append(snapshot);
+    context.append(reinterpret_cast<const char *>(&seq), sizeof(seq));
+    return context;
+}
+
+static void segment_tag(
+    const SecureString &key,
+    const std::string &context,
+    const CryptoPP::byte *data,
+    size_t len,
+    CryptoPP::byte *tag
+) {
+    SegmentMAC mac(bytes(key) + CIPHER_KEY_SIZE, MAC_KEY_SIZE);
+    mac.Update(bytes(context), context.size());
+    mac.Update(data, len);
+    mac.Final(tag);
+}
+
+// header fields covered by the index tag
+static std::string key_header(
+    uint32_t version,
+    const std::string &salt,
+    const KdfParameters &kdf,
+    const std::string &snapshot,
+    const CompressionParameters &compression
+) {
+    std::string header(salt);
+
+    if (version < 6) {
+        uint32_t iterations = kdf.cost;
+        header.append(reinterpret_cast<const char *>(&iterations), sizeof(iterations));
+    }
+    else {
+        uint32_t algorithm = static_cast<uint32_t>(kdf.algorithm);
+        header.append(reinterpret_cast<const char *>(&algorithm), sizeof(algorithm));
+        header.append(reinterpret_cast<const char *>(&kdf.cost), sizeof(kdf.cost));
+        header.append(reinterpret_cast<const char *>(&kdf.blockSize), sizeof(kdf.blockSize));
+        header.append(reinterpret_cast<const char *>(&kdf.parallelism), sizeof(kdf.parallelism));
+    }
+
+    if (version >= 7) header.append(snapshot);
+
+    if (version >= COMPRESSION_VERSION) {
+        uint32_t algorithm = static_cast<uint32_t>(compression.algorithm);
+        header.append(reinterpret_cast<const char *>(&algorithm), sizeof(algorithm));
+        header.append(reinterpret_cast<const char *>(&compression.level), sizeof(compression.level));
+    }
+
+    return header;
+}
+
+static std::string index_tag(
+    const SecureString &key,
+    const std::string &header,
+    const std::vector<std::string> &tags
+) {
+    std::string tag(TAG_SIZE, '\0');
+    uint32_t count = tags.size();
+
+    SegmentMAC mac(bytes(key) + CIPHER_KEY_SIZE, MAC_KEY_SIZE);
+    mac.Update(bytes(header), header.size());
+    mac.Update(reinterpret_cast<const CryptoPP::byte *>(&count), sizeof(count));
+    for (const auto &t : tags) mac.Update(bytes(t), t.size());
+    mac.Final(reinterpret_cast<CryptoPP::byte *>(&tag[0]));
+
+    return tag;
+}
+
+// size of the tag at the end of each sealed segment
+static size_t segment_tag_size(uint32_t version) {
+    return version >= AEAD_VERSION ? AEAD_TAG_SIZE : TAG_SIZE;
+}
+
+// segment layout: iv || AES-CBC(plaintext) || HMAC(context || iv || ciphertext)
+// or, from version 8: iv || AES-GCM(plaintext) || tag, with the context as
+// associated data
+static std::string seal_segment(
+    CryptoPP::RandomNumberGenerator &rng,
+    uint32_t version,
+    const SecureString &key,
+    const std::string &context,
+    const std::string &plaintext
+) {
+    if (version >= AEAD_VERSION) {
+        std::string sealed(AEAD_IV_SIZE + plaintext.size() + AEAD_TAG_SIZE, '\0');
+        auto p = reinterpret_cast<CryptoPP::byte *>(&sealed[0]);
+        rng.GenerateBlock(p, AEAD_IV_SIZE);
+
+        AEAD::Encryption enc;
+        enc.SetKey(bytes(key), CIPHER_KEY_SIZE);
+        enc.EncryptAndAuthenticate(
+            p + AEAD_IV_SIZE, p + AEAD_IV_SIZE + plaintext.size(), AEAD_TAG_SIZE,
+            p, AEAD_IV_SIZE, bytes(context), context.size(), bytes(plaintext), plaintext.size()
+        );
+        return sealed;
+    }
+
+    std::string sealed(IV_SIZE, '\0');
+    rng.GenerateBlock(reinterpret_cast<CryptoPP::byte *>(&sealed[0]), IV_SIZE);
+
+    SegmentEncryption enc(bytes(key), CIPHER_KEY_SIZE, bytes(sealed));
+    CryptoPP::StringSource ss(plaintext, true,
+        new CryptoPP::StreamTransformationFilter(enc,
+            new CryptoPP::StringSink(sealed)
+        )
+    );
+
+    size_t len = sealed.size();
+    sealed.resize(len + TAG_SIZE);
+    segment_tag(key, context, bytes(sealed), len, reinterpret_cast<CryptoPP::byte *>(&sealed[len]));
+
+    return sealed;
+}
+
+// decrypts and verifies a version 8 segment into plaintext
+static bool open_aead_segment(
+    const SecureString &key,
+    const std::string &context,
+    StringRef sealed,
+    std::string &plaintext
+) {
+    if (sealed.size < AEAD_IV_SIZE + AEAD_TAG_SIZE) return false;
+
+    size_t len = sealed.size - AEAD_IV_SIZE - AEAD_TAG_SIZE;
+    plaintext.assign(len, '\0');
+
+    AEAD::Decryption dec;
+    dec.SetKey(bytes(key), CIPHER_KEY_SIZE);
+    return dec.DecryptAndVerify(
+        reinterpret_cast<CryptoPP::byte *>(&plaintext[0]),
+        bytes(sealed) + AEAD_IV_SIZE + len, AEAD_TAG_SIZE,
+        bytes(sealed), AEAD_IV_SIZE, bytes(context), context.size(),
+        bytes(sealed) + AEAD_IV_SIZE, len
+    );
+}
+
+static bool verify_segment(
+    uint32_t version,
+    const SecureString &key,
+    const std::string &context,
+    StringRef sealed
+) {
+    if (version >= AEAD_VERSION) {
+        std::string plaintext;
+        bool ok = open_aead_segment(key, context, sealed, plaintext);
+        SecureArena::wipe(plaintext);
+        return ok;
+    }
+
+    if (
+        sealed.size < IV_SIZE + CryptoPP::AES::BLOCKSIZE + TAG_SIZE
+        || (sealed.size - IV_SIZE - TAG_SIZE) % CryptoPP::AES::BLOCKSIZE
+    ) {
+        return false;
+    }
+
+    size_t len = sealed.size - TAG_SIZE;
+    CryptoPP::byte tag[TAG_SIZE];
+    segment_tag(key, context, bytes(sealed), len, tag);
+    return CryptoPP::VerifyBufsEqual(tag, bytes(sealed) + len, TAG_SIZE);
+}
+
+// verifies a segment and decrypts it into sink. Before version 8, it is
+// decrypted STREAM_CHUNK bytes at a time once its MAC matches, so that no
+// intermediate copy of the plaintext is built; from version 8, it is decrypted
+// and verified in a single pass, and only handed to sink if authentic
+static bool open_segment(
+    uint32_t version,
+    const SecureString &key,
+    const std::string &context,
+    StringRef sealed,
+    CryptoPP::BufferedTransformation &sink
+) {
+    if (version >= AEAD_VERSION) {
+        std::string plaintext;
+        if (! open_aead_segment(key, context, sealed, plaintext)) {
+            SecureArena::wipe(plaintext);
+            return false;
+        }
+
+        try {
+            sink.Put(bytes(plaintext), plaintext.size());
+            sink.MessageEnd();
+        }
+        catch (...) {
+            SecureArena::wipe(plaintext);
+            throw;
+        }
+        SecureArena::wipe(plaintext);
+        return true;
+    }
+
+    if (! verify_segment(version, key, context, sealed)) return false;
+
+    size_t len = sealed.size - TAG_SIZE;
+
+    SegmentDecryption dec(bytes(key), CIPHER_KEY_SIZE, bytes(sealed));
+    CryptoPP::StreamTransformationFilter filter(dec, new CryptoPP::Redirector(sink));
+    for (size_t i = IV_SIZE; i < len; i += STREAM_CHUNK) {
+        filter.Put(bytes(sealed) + i, std::min(STREAM_CHUNK, len - i));
+    }
+    filter.MessageEnd();
+    return true;
+}
+
+// from version 9, segment plaintext is compressed as recorded in the header
+// before it is sealed
+static std::string compress_segment(const CompressionParameters &compression, const std::string &plaintext) {
+    if (compression.algorithm == Compression::NONE) return plaintext;
+
+    std::string compressed;
+    CryptoPP::StringSource ss(plaintext, true,
+        new CryptoPP::Deflator(new CryptoPP::StringSink(compressed), compression.level)
+    );
+    return compressed;
+}
+
+// opens a segment into sink, decompressing it on the way
+static bool open_compressed_segment(
+    uint32_t version,
+    const CompressionParameters &compression,
+    const SecureString &key,
+    const std::string &context,
+    StringRef sealed,
+    CryptoPP::BufferedTransformation &sink
+) {
+    if (version < COMPRESSION_VERSION || compression.algorithm == Compression::NONE) {
+        return open_segment(version, key, context, sealed, sink);
+    }
+
+    try {
+        CryptoPP::Inflator inflator(new CryptoPP::Redirector(sink));
+        return open_segment(version, key, context, sealed, inflator);
+    }
+    catch (const CryptoPP::Exception &) {
+        throw Error("Password file is corrupted");
+    }
+}
+
+// segment plaintext is a sequence of name, element count, (element, value)*
+// where strings are prefixed by their 32-bit length. From version 5, each
+// value is replaced by the 32-bit offset and size of the value, individually
+// sealed, in the segment's value blob.
+static void encode_field(std::string &out, uint32_t x) {
+    out.append(reinterpret_cast<const char *>(&x), sizeof(x));
+}
+
+static void encode_field(std::string &out, StringRef s) {
+    encode_field(out, static_cast<uint32_t>(s.size));
+    out.append(s.data, s.size);
+}
+
+static bool decode_field(const std::string &in, size_t &pos, uint32_t &x) {
+    if (in.size() - pos < sizeof(x)) return false;
+    memcpy(&x, &in[pos], sizeof(x));
+    pos += sizeof(x);
+    return true;
+}
+
+static bool decode_field(const std::string &in, size_t &pos, std::string &s) {
+    uint32_t size;
+    if (! decode_field(in, pos, size) || in.size() - pos < size) return false;
+    s.assign(in, pos, size);
+    pos += size;
+    return true;
+}
+
+// size of a sealed value beyond the value itself
+static size_t value_overhead(uint32_t version) {
+    return version >= AEAD_VERSION ? AEAD_IV_SIZE + AEAD_TAG_SIZE : IV_SIZE + VALUE_TAG_SIZE;
+}
+
+// data authenticated along with a value: its name and element
+static std::string value_context(StringRef name, StringRef element) {
+    std::string context;
+    encode_field(context, name);
+    encode_field(context, element);
+    return context;
+}
+
+static void value_tag(
+    const SecureString &key,
+    StringRef name,
+    StringRef element,
+    const CryptoPP::byte *data,
+    size_t len,
+    CryptoPP::byte *tag
+) {
+    auto prefix = value_context(name, element);
 
-static const std::function<HashMap<std::string, HashMap<std::string, std::string>>(InputStreamSerializer &, const char *)> reader[] = {
+    ValueMAC mac(bytes(key) + VALUE_KEY_OFFSET + CIPHER_KEY_SIZE, MAC_KEY_SIZE);
+    mac.Update(bytes(prefix), prefix.size());
+    mac.Update(data, len);
+    mac.Final(tag);
+}
+
+// value layout: iv || AES-CTR(value) || HMAC(name || element || iv || ciphertext)
+// with the tag truncated to VALUE_TAG_SIZE or, from version 8,
+// iv || AES-GCM(value) || tag, with the name and element as associated data
+static std::string seal_value(
+    CryptoPP::RandomNumberGenerator &rng,
+    uint32_t version,
+    const SecureString &key,
+    StringRef name,
+    StringRef element,
+    StringRef value
+) {
+    if (version >= AEAD_VERSION) {
+        auto context = value_context(name, element);
+        std::string sealed(AEAD_IV_SIZE + value.size + AEAD_TAG_SIZE, '\0');
+        auto p = reinterpret_cast<CryptoPP::byte *>(&sealed[0]);
+        rng.GenerateBlock(p, AEAD_IV_SIZE);
+
+        AEAD::Encryption enc;
+        enc.SetKey(bytes(key) + VALUE_KEY_OFFSET, CIPHER_KEY_SIZE);
+        enc.EncryptAndAuthenticate(
+            p + AEAD_IV_SIZE, p + AEAD_IV_SIZE + value.size, AEAD_TAG_SIZE,
+            p, AEAD_IV_SIZE, bytes(context), context.size(),
+            reinterpret_cast<const CryptoPP::byte *>(value.data), value.size
+        );
+        return sealed;
+    }
+
+    std::string sealed(IV_SIZE + value.size + VALUE_TAG_SIZE, '\0');
+    auto p = reinterpret_cast<CryptoPP::byte *>(&sealed[0]);
+
+    rng.GenerateBlock(p, IV_SIZE);
+
+    ValueEncryption enc(bytes(key) + VALUE_KEY_OFFSET, CIPHER_KEY_SIZE, p);
+    enc.ProcessData(p + IV_SIZE, reinterpret_cast<const CryptoPP::byte *>(value.data), value.size);
+
+    CryptoPP::byte tag[ValueMAC::DIGESTSIZE];
+    value_tag(key, name, element, p, IV_SIZE + value.size, tag);
+    memcpy(p + IV_SIZE + value.size, tag, VALUE_TAG_SIZE);
+
+    return sealed;
+}
+
+static std::string open_value(
+    uint32_t version,
+    const SecureString &key,
+    StringRef name,
+    StringRef element,
+    const CryptoPP::byte *sealed,
+    size_t size
+) {
+    if (version >= AEAD_VERSION) {
+        auto context = value_context(name, element);
+        size_t len = size - AEAD_IV_SIZE - AEAD_TAG_SIZE;
+        std::string value(len, '\0');
+
+        AEAD::Decryption dec;
+        dec.SetKey(bytes(key) + VALUE_KEY_OFFSET, CIPHER_KEY_SIZE);
+        bool ok = dec.DecryptAndVerify(
+            reinterpret_cast<CryptoPP::byte *>(&value[0]), sealed + AEAD_IV_SIZE + len, AEAD_TAG_SIZE,
+            sealed, AEAD_IV_SIZE, bytes(context), context.size(), sealed + AEAD_IV_SIZE, len
+        );
+        if (! ok) {
+            SecureArena::wipe(value);
+            throw Error("Password file is corrupted");
+        }
+        return value;
+    }
+
+    size_t len = size - VALUE_TAG_SIZE;
+
+    CryptoPP::byte tag[ValueMAC::DIGESTSIZE];
+    value_tag(key, name, element, sealed, len, tag);
+    if (! CryptoPP::VerifyBufsEqual(tag, sealed + len, VALUE_TAG_SIZE)) {
+        throw Error("Password file is corrupted");
+    }
+
+    std::string value(len - IV_SIZE, '\0');
+    ValueDecryption dec(bytes(key) + VALUE_KEY_OFFSET, CIPHER_KEY_SIZE, sealed);
+    dec.ProcessData(reinterpret_cast<CryptoPP::byte *>(&value[0]), sealed + IV_SIZE, value.size());
+
+    return value;
+}
+
+/**
+ * Incremental parser for segment plaintext. Attached at the end of the
+ * decryption filter chain, it inserts entries into a table as soon as they are
+ * complete instead of waiting for the whole plaintext. In lazy mode, values
+ * are recorded as references into the segment's value blob and left sealed
+ * until accessed.
+ */
+class EntryParser
+:   public CryptoPP::Bufferless<CryptoPP::Sink> {
+
+private:
+
+    enum class State : uint8_t {
+        NAME_SIZE,
+        NAME,
+        ELEMENT_COUNT,
+        ELEMENT_SIZE,
+        ELEMENT,
+        VALUE_SIZE,
+        VALUE,
+        VALUE_REF,
+    };
+
+    EntryTable<PasswordStore::SealedValue> &_entries;
+    bool _lazy;
+    size_t _overhead;
+    size_t _tagSize;
+    uint32_t _segment = 0;
+    const CryptoPP::byte *_values = nullptr;
+    size_t _valuesSize = 0;
+
+    State _state = State::NAME_SIZE;
+    SecureString _buf;
+    uint32_t _size = 0;
+    uint32_t _remaining = 0;
+    std::string _name;
+    std::string _element;
+
+    // accumulates input into _buf until it holds n bytes
+    bool fill(const CryptoPP::byte *&in, size_t &len, size_t n) {
+        size_t take = std::min(n - _buf.size(), len);
+        _buf.append(reinterpret_cast<const char *>(in), take);
+        in += take;
+        len -= take;
+        return _buf.size() == n;
+    }
+
+    bool fillSize(const CryptoPP::byte *&in, size_t &len) {
+        if (! fill(in, len, sizeof(_size))) return false;
+        memcpy(&_size, _buf.data(), sizeof(_size));
+        _buf.clear();
+        return true;
+    }
+
+    void endValue() {
+        _state = --_remaining ? State::ELEMENT_SIZE : State::NAME_SIZE;
+    }
+
+public:
+
+    /**
+     * overhead is the size of a sealed value beyond the value itself. With a
+     * non-zero tagSize, each value reference ends with the tag the sealed
+     * value must end with.
+     */
+    EntryParser(
+        EntryTable<PasswordStore::SealedValue> &entries,
+        SecureArena &arena,
+        bool lazy,
+        size_t overhead,
+        size_t tagSize = 0
+    )
+    :   _entries(entries),
+        _lazy(lazy),
+        _overhead(overhead),
+        _tagSize(tagSize),
+        _buf(ArenaAllocator<char>(&arena))
+    { }
+
+    void segment(uint32_t index, StringRef values) {
+        _segment = index;
+        _values = bytes(values);
+        _valuesSize = values.size;
+    }
+
+    size_t Put2(const CryptoPP::byte *in, size_t len, int messageEnd, bool blocking) override {
+        // loop until a field needs more input than is available; zero-length
+        // fields complete without consuming anything
+        bool more = true;
+        while (more) {
+            switch (_state) {
+            case State::NAME_SIZE:
+                if (! (more = fillSize(in, len))) break;
+                _state = State::NAME;
+            break;
+
+            case State::NAME:
+                if (! (more = fill(in, len, _size))) break;
+                _name.assign(_buf.data(), _buf.size());
+                _buf.clear();
+                _state = State::ELEMENT_COUNT;
+            break;
+
+            case State::ELEMENT_COUNT:
+                if (! (more = fillSize(in, len))) break;
+                _remaining = _size;
+                _state = _remaining ? State::ELEMENT_SIZE : State::NAME_SIZE;
+            break;
+
+            case State::ELEMENT_SIZE:
+                if (! (more = fillSize(in, len))) break;
+                _state = State::ELEMENT;
+            break;
+
+            case State::ELEMENT:
+                if (! (more = fill(in, len, _size))) break;
+                _element.assign(_buf.data(), _buf.size());
+                _buf.clear();
+                _state = _lazy ? State::VALUE_REF : State::VALUE_SIZE;
+            break;
+
+            case State::VALUE_SIZE:
+                if (! (more = fillSize(in, len))) break;
+                _state = State::VALUE;
+            break;
+
+            case State::VALUE:
+                if (! (more = fill(in, len, _size))) break;
+                _entries.put(_name, _element, StringRef(_buf.data(), _buf.size()));
+                _buf.clear();
+                endValue();
+            break;
+
+            case State::VALUE_REF: {
+                if (! (more = fill(in, len, 2 * sizeof(uint32_t) + _tagSize))) break;
+
+                PasswordStore::SealedValue ref;
+                ref.segment = _segment;
+                memcpy(&ref.offset, _buf.data(), sizeof(uint32_t));
+                memcpy(&ref.size, _buf.data() + sizeof(uint32_t), sizeof(uint32_t));
+                ref.resident = false;
+                ref.valid = true;
+
+                // the tag recorded in the authenticated index must be that of
+                // the sealed value, so that it cannot be swapped for another
+                if (
+                    ref.size < _overhead
+                    || ref.offset > _valuesSize
+                    || ref.size > _valuesSize - ref.offset
+                    || ! CryptoPP::VerifyBufsEqual(
+                        bytes(_buf) + 2 * sizeof(uint32_t),
+                        _values + ref.offset + ref.size - _tagSize,
+                        _tagSize
+                    )
+                ) {
+                    throw Error("Password file is corrupted");
+                }
+                _buf.clear();
+
+                _entries.meta(_entries.put(_name, _element, "")) = ref;
+                endValue();
+            }
+            break;
+            }
+        }
+
+        if (messageEnd && (_state != State::NAME_SIZE || ! _buf.empty())) {
+            throw Error("Password file is corrupted");
+        }
+
+        return 0;
+    }
+};
+
+// adds every value of a nested map, as decoded from the JSON formats
+template <typename Meta>
+static void put_all(
+    EntryTable<Meta> &entries,
+    const HashMap<std::string, HashMap<std::string, std::string>> &passwords
+) {
+    for (const auto &x : passwords) {
+        for (const auto &e : x.v) entries.put(x.k, e.k, e.v);
+    }
+}
+
+/**
+ * Reads fields of a mapped file, laid out as by the serializer: integers in
+ * native byte order, and strings as their 64-bit size followed by their bytes.
+ */
+class MappedReader {
+
+private:
+
+    const char *_p;
+    const char *_end;
+
+    const char * take(size_t n) {
+        if (static_cast<size_t>(_end - _p) < n) throw Error("Password file is corrupted");
+        const char *p = _p;
+        _p += n;
+        return p;
+    }
+
+public:
+
+    explicit MappedReader(const MappedFile &file)
+    :   _p(file.data()),
+        _end(file.data() + file.size())
+    { }
+
+    bool peek(void *buf, size_t n) const {
+        if (static_cast<size_t>(_end - _p) < n) return false;
+        memcpy(buf, _p, n);
+        return true;
+    }
+
+    MappedReader & operator>>(uint32_t &x) {
+        memcpy(&x, take(sizeof(x)), sizeof(x));
+        return *this;
+    }
+
+    MappedReader & operator>>(uint64_t &x) {
+        memcpy(&x, take(sizeof(x)), sizeof(x));
+        return *this;
+    }
+
+    MappedReader & operator>>(std::string &s) {
+        uint64_t size;
+        *this >> size;
+        s.assign(take(size), size);
+        return *this;
+    }
+
+    /**
+     * Points blob at the next string, in place.
+     */
+    void view(Blob &blob) {
+        uint64_t size;
+        *this >> size;
+        blob.borrow(StringRef(take(size), size));
+    }
+};
+
+// reads a sealed segment or value blob into memory, or, from a mapped file,
+// leaves it there
+static void read_blob(InputStreamSerializer &serializer, Blob &blob) {
+    std::string s;
+    serializer >> s;
+    blob = std::move(s);
+}
+
+static void read_blob(MappedReader &reader, Blob &blob) {
+    reader.view(blob);
+}
+
+const std::function<void(PasswordStore &, InputStreamSerializer &)> PasswordStore::reader[] = {
     // 0
-    [] (InputStreamSerializer &serializer, const char *passphrase) -> HashMap<std::string, HashMap<std::string, std::string>> {
+    [] (PasswordStore &store, InputStreamSerializer &serializer) {
         std::string encrypted, decrypted;
 
         serializer >> encrypted;
 
+        // the passphrase is stretched inside the decryptor
+        ProfileScope decrypt("read.decrypt");
         try {
             CryptoPP::StringSource ss2(encrypted, true,
                 new CryptoPP::HexDecoder(
                     new Decryptor(
-                        passphrase,
+                        store._passphrase.c_str(),
                         new CryptoPP::StringSink(decrypted)
                     )
                 )
@@ -63,27 +825,31 @@ static const std::function<HashMap<std::string, HashMap<std::string, std::string
             throw RuntimeError("Unexpected exception occurred");
         }
 
+        decrypt.stop();
+
+        ProfileScope decode("read.decode");
         auto m = JSON::decode<HashMap<std::string, std::string>>(decrypted);
+        SecureArena::wipe(decrypted);
+        decode.stop();
 
-        return m.map<HashMap<std::string, HashMap<std::string, std::string>>>([] (const MapNode<std::string, std::string> &n) {
-            return MapNode<std::string, HashMap<std::string, std::string>>(
-                n.k,
-                HashMap<std::string, std::string>({ {"default", n.v} })
-            );
-        });
+        ProfileScope build("read.build");
+        store._entries.clear();
+        for (const auto &x : m) store._entries.put(x.k, "default", x.v);
     },
 
     // 1
-    [] (InputStreamSerializer &serializer, const char *passphrase) -> HashMap<std::string, HashMap<std::string, std::string>> {
+    [] (PasswordStore &store, InputStreamSerializer &serializer) {
         std::string encrypted, decrypted;
 
         serializer >> encrypted;
 
+        // the passphrase is stretched inside the decryptor
+        ProfileScope decrypt("read.decrypt");
         try {
             CryptoPP::StringSource ss2(encrypted, true,
                 new CryptoPP::HexDecoder(
                     new Decryptor(
-                        passphrase,
+                        store._passphrase.c_str(),
                         new CryptoPP::StringSink(decrypted)
                     )
                 )
@@ -96,23 +862,621 @@ static const std::function<HashMap<std::string, HashMap<std::string, std::string
             throw RuntimeError("Unexpected exception occurred");
         }
 
-        return JSON::decode<HashMap<std::string, HashMap<std::string, std::string>>>(decrypted);
-    }
+        decrypt.stop();
+
+        ProfileScope decode("read.decode");
+        auto m = JSON::decode<HashMap<std::string, HashMap<std::string, std::string>>>(decrypted);
+        SecureArena::wipe(decrypted);
+        decode.stop();
+
+        ProfileScope build("read.build");
+        store._entries.clear();
+        put_all(store._entries, m);
+    },
+
+    // 2: hex-encoded segments of JSON
+    [] (PasswordStore &store, InputStreamSerializer &serializer) {
+        store.readSegments(serializer, 2);
+    },
+
+    // 3: raw segments of JSON
+    [] (PasswordStore &store, InputStreamSerializer &serializer) {
+        store.readSegments(serializer, 3);
+    },
+
+    // 4: raw segments of length-prefixed entries, parsed while decrypting
+    [] (PasswordStore &store, InputStreamSerializer &serializer) {
+        store.readSegments(serializer, 4);
+    },
+
+    // 5: as 4, with values sealed individually in a per-segment blob
+    [] (PasswordStore &store, InputStreamSerializer &serializer) {
+        store.readSegments(serializer, 5);
+    },
+
+    // 6: as 5, with the KDF algorithm and cost in the header
+    [] (PasswordStore &store, InputStreamSerializer &serializer) {
+        store.readSegments(serializer, 6);
+    },
+
+    // 7: as 6, with a snapshot id that journal records are bound to
+    [] (PasswordStore &store, InputStreamSerializer &serializer) {
+        store.readSegments(serializer, 7);
+    },
+
+    // 8: as 7, with segments, journal records and values sealed by AES-GCM
+    [] (PasswordStore &store, InputStreamSerializer &serializer) {
+        store.readSegments(serializer, 8);
+    },
+
+    // 9: as 8, with segment indexes compressed as recorded in the header
+    [] (PasswordStore &store, InputStreamSerializer &serializer) {
+        store.readSegments(serializer, 9);
+    },
+
+    // 10: as 9, with the tag of each sealed value in the segment index
+    [] (PasswordStore &store, InputStreamSerializer &serializer) {
+        store.readSegments(serializer, 10);
+    },
 };
 
+template <typename Source>
+void PasswordStore::readSegments(Source &serializer, uint32_t version) {
+    uint32_t count;
+    std::string tag;
+
+    serializer >> _salt;
+
+    if (version < 6) {
+        uint32_t iterations;
+        serializer >> iterations;
+        _kdf = KdfParameters { KdfAlgorithm::PBKDF2_SHA256, iterations, 0, 0 };
+    }
+    else {
+        uint32_t algorithm;
+        serializer >> algorithm >> _kdf.cost >> _kdf.blockSize >> _kdf.parallelism;
+        _kdf.algorithm = static_cast<KdfAlgorithm>(algorithm);
+    }
+
+    if (version >= 7) {
+        serializer >> _snapshot;
+        if (_snapshot.size() != SNAPSHOT_ID_SIZE) throw Error("Password file is corrupted");
+    }
+
+    if (version >= COMPRESSION_VERSION) {
+        uint32_t algorithm;
+        serializer >> algorithm >> _compression.level;
+        _compression.algorithm = static_cast<Compression>(algorithm);
+        if (! _compression.valid()) throw Error("Password file is corrupted");
+    }
+
+    serializer >> count >> tag;
+
+    if (! _kdf.valid() || count == 0 || (count & (count - 1)) != 0 || tag.size() != TAG_SIZE) {
+        throw Error("Password file is corrupted");
+    }
+
+    {
+        ProfileScope kdf("read.kdf");
+        deriveKey();
+    }
+
+    _entries.clear();
+
+    // segments are read in batches, and each batch is verified, decrypted and
+    // parsed in parallel, so only one batch of plaintext is ever buffered
+    auto &pool = WorkerPool::shared();
+    uint32_t batch = 4 * pool.size();
+
+    // decryption includes parsing, which is done on the fly from version 4
+    ProfileTotal load("read.load"), decrypt("read.decrypt"), merge("read.merge");
+
+    try {
+        std::vector<Segment> segments(count);
+        std::vector<std::string> tags(count);
+        for (uint32_t first = 0; first < count; first += batch) {
+            uint32_t n = std::min(batch, count - first);
+
+            load.start();
+            for (uint32_t i = first; i < first + n; ++i) {
+                auto &s = segments[i];
+                read_blob(serializer, s.sealed);
+                if (version == 2) s.sealed = hex_decode(s.sealed.str());
+                if (version >= 5) read_blob(serializer, s.values);
+            }
+            load.stop();
+
+            // a wrong password fails on the very first segment
+            if (first == 0 && ! verify_segment(version, _key, segment_context(0, count), segments[0].sealed.ref())) {
+                throw Error("Invalid password");
+            }
+
+            std::vector<EntryTable<SealedValue>> entries(n, EntryTable<SealedValue>(ArenaAllocator<char>(_arena.get())));
+
+            decrypt.start();
+            pool.run(n, [&] (size_t j) {
+                uint32_t i = first + j;
+                auto &s = segments[i];
+
+                auto context = segment_context(i, count);
+
+                if (version < 4) {
+                    std::string plaintext;
+                    CryptoPP::StringSink sink(plaintext);
+                    if (! open_segment(version, _key, context, s.sealed.ref(), sink)) {
+                        throw Error("Password file is corrupted");
+                    }
+
+                    put_all(entries[j], JSON::decode<HashMap<std::string, HashMap<std::string, std::string>>>(plaintext));
+                    SecureArena::wipe(plaintext);
+                }
+                else {
+                    EntryParser parser(
+                        entries[j], *_arena, version >= 5, value_overhead(version),
+                        version >= BOUND_VALUE_VERSION ? AEAD_TAG_SIZE : 0
+                    );
+                    parser.segment(i, s.values.ref());
+                    if (! open_compressed_segment(version, _compression, _key, context, s.sealed.ref(), parser)) {
+                        throw Error("Password file is corrupted");
+                    }
+                }
+
+                size_t tagSize = segment_tag_size(version);
+                s.tag = tags[i] = std::string(s.sealed.data() + s.sealed.size() - tagSize, tagSize);
+                s.dirty = false;
+            });
+            decrypt.stop();
+
+            merge.start();
+            for (uint32_t j = 0; j < n; ++j) _entries.merge(entries[j]);
+            merge.stop();
+        }
+
+        load.record();
+        decrypt.record();
+        merge.record();
+
+        ProfileScope verify("read.verify");
+        auto expected = index_tag(_key, key_header(version, _salt, _kdf, _snapshot, _compression), tags);
+        if (! CryptoPP::VerifyBufsEqual(bytes(expected), bytes(tag), TAG_SIZE)) {
+            throw Error("Password file is corrupted");
+        }
+
+        _segments = std::move(segments);
+    }
+    catch (...) {
+        _key.clear();
+        _snapshot.clear();
+        _entries.clear();
+        throw;
+    }
+}
+
+void PasswordStore::deriveKey() const {
+    _key.assign(KEY_SIZE, '\0');
+    _kdf.derive(_passphrase.data(), _passphrase.size(), _salt, reinterpret_cast<uint8_t *>(&_key[0]), _key.size());
+}
+
+void PasswordStore::newKey(const KdfParameters &kdf) const {
+    CryptoPP::AutoSeededRandomPool rng;
+
+    _salt.assign(SALT_SIZE, '\0');
+    rng.GenerateBlock(reinterpret_cast<CryptoPP::byte *>(&_salt[0]), SALT_SIZE);
+    _kdf = kdf;
+    deriveKey();
+}
+
+void PasswordStore::touch(const std::string &name) {
+    if (! _segments.empty()) _segments[segment_of(name, _segments.size())].dirty = true;
+}
+
+void PasswordStore::touchAll() {
+    // values may be modified in place, so none of the sealed ones can be
+    // trusted to match anymore
+    resolveAll();
+    _entries.forEach([&] (uint32_t i) { _entries.meta(i).valid = false; });
+    for (auto &s : _segments) s.dirty = true;
+}
+
+StringRef PasswordStore::resolve(uint32_t i) const {
+    const auto &ref = _entries.meta(i);
+
+    if (ref.valid && ! ref.resident) {
+        auto value = open_value(
+            _version, _key, _entries.name(i), _entries.element(i),
+            bytes(_segments[ref.segment].values.ref()) + ref.offset, ref.size
+        );
+        _entries.setValue(i, value);
+        _entries.meta(i).resident = true;
+        SecureArena::wipe(value);
+    }
+
+    return _entries.value(i);
+}
+
+void PasswordStore::resolveAll() const {
+    attach();
+    _entries.forEach([&] (uint32_t i) {
+        const auto &ref = _entries.meta(i);
+        if (ref.valid && ! ref.resident) resolve(i);
+    });
+}
+
+HashMap<std::string, HashMap<std::string, std::string>> PasswordStore::materialize() const {
+    HashMap<std::string, HashMap<std::string, std::string>> m;
+    _entries.forEachName([&] (StringRef name, uint32_t first) {
+        auto &elements = m[name.str()];
+        for (auto i = first; i != _entries.NONE; i = _entries.next(i)) {
+            elements.put(_entries.element(i).str(), _entries.value(i).str());
+        }
+    });
+    return m;
+}
+
+void PasswordStore::absorb() const {
+    _detached = false;
+    ++_generation;
+
+    _entries.clear();
+    for (auto &x : _view) {
+        for (auto &e : x.v) {
+            _entries.put(x.k, e.k, e.v);
+            SecureArena::wipe(e.v);
+        }
+    }
+    _view = HashMap<std::string, HashMap<std::string, std::string>>();
+}
+
+HashMap<std::string, HashMap<std::string, std::string>> & PasswordStore::passwords() {
+    if (_detached) return _view;
+
+    touchAll();
+    _journalable = false;
+    _indexed = false;
+    _searchable = false;
+
+    _view = materialize();
+    _detached = true;
+    return _view;
+}
+
+const HashMap<std::string, HashMap<std::string, std::string>> & PasswordStore::passwords() const {
+    resolveAll();
+    _view = materialize();
+    return _view;
+}
+
+PasswordStore::~PasswordStore() {
+    // the passphrase and key are wiped with the arena, and values with the
+    // entry table
+    for (auto &x : _view) {
+        for (auto &e : x.v) SecureArena::wipe(e.v);
+    }
+    SecureArena::wipe(_journal);
+}
+
 void PasswordStore::writeObject(OutputStreamSerializer &serializer) const {
-    std::string encrypted;
+    ProfileScope total("write");
+    seal().write(serializer);
+}
+
+PasswordStore::Image PasswordStore::seal() const {
+    // the key is derived once, on read or on the first write, and reused for
+    // all subsequent writes so that clean segments remain valid
+    attach();
+
+    // files of older versions are rewritten in full in the current format,
+    // under a new key if their key was used with other ciphers; values sealed
+    // by AES-GCM are kept as they are
+    if (_version != VERSION) {
+        if (_version < AEAD_VERSION && ! _key.empty()) {
+            resolveAll();
+            _entries.forEach([&] (uint32_t i) { _entries.meta(i).valid = false; });
+            _key.clear();
+        }
+        for (auto &s : _segments) s.dirty = true;
+        _version = VERSION;
+    }
 
-    CryptoPP::StringSource ss1(JSON::encode(_passwords), true,
-        new Encryptor(
-            _passphrase.c_str(),
-            new CryptoPP::HexEncoder(
-                new CryptoPP::StringSink(encrypted)
+    if (_key.empty()) {
+        ProfileScope kdf("write.kdf");
+        newKey(_kdf);
+        _segments.clear();
+    }
+
+    size_t count = segment_count(_entries.names(), _segments.size());
+
+    // sealed values are copied from the segment they were read from; when the
+    // layout changes, that is the previous layout
+    std::vector<Segment> previous;
+    if (count != _segments.size()) {
+        previous.swap(_segments);
+        _segments.assign(count, Segment { Blob(), Blob(), "", true });
+    }
+    const auto &source = previous.empty() ? _segments : previous;
+
+    // names of each dirty segment, by the index of their first entry
+    ProfileScope group("write.group");
+    std::vector<std::vector<uint32_t>> dirty(count);
+    _entries.forEachName([&] (StringRef name, uint32_t first) {
+        auto s = segment_of(name, count);
+        if (_segments[s].dirty) dirty[s].push_back(first);
+    });
+
+    std::vector<uint32_t> work;
+    for (uint32_t i = 0; i < count; ++i) {
+        if (_segments[i].dirty) work.push_back(i);
+    }
+
+    // dirty segments are sealed in parallel; the new locations of their sealed
+    // values are collected per segment and applied afterwards
+    std::vector<std::vector<std::pair<uint32_t, SealedValue>>> refs(work.size());
+    const auto &entries = _entries;
+    group.stop();
+
+    ProfileScope seal("write.seal");
+    WorkerPool::shared().run(work.size(), [&] (size_t j) {
+        CryptoPP::AutoSeededRandomPool rng;
+        uint32_t i = work[j];
+        std::string index, values;
+
+        for (auto first : dirty[i]) {
+            auto name = entries.name(first);
+            uint32_t elements = 0;
+            for (auto e = first; e != entries.NONE; e = entries.next(e)) ++elements;
+
+            encode_field(index, name);
+            encode_field(index, elements);
+
+            for (auto e = first; e != entries.NONE; e = entries.next(e)) {
+                SealedValue ref = entries.meta(e);
+
+                if (ref.valid) {
+                    // unchanged since it was read or last written
+                    values.append(source[ref.segment].values.data() + ref.offset, ref.size);
+                }
+                else {
+                    auto sealed = seal_value(rng, VERSION, _key, name, entries.element(e), entries.value(e));
+                    ref.size = sealed.size();
+                    ref.resident = true;
+                    ref.valid = true;
+                    values.append(sealed);
+                }
+
+                ref.segment = i;
+                ref.offset = values.size() - ref.size;
+                refs[j].emplace_back(e, ref);
+
+                encode_field(index, entries.element(e));
+                encode_field(index, ref.offset);
+                encode_field(index, ref.size);
+                index.append(values.data() + ref.offset + ref.size - AEAD_TAG_SIZE, AEAD_TAG_SIZE);
+            }
+        }
+
+        auto sealed = seal_segment(rng, VERSION, _key, segment_context(i, count), compress_segment(_compression, index));
+        _segments[i].tag = sealed.substr(sealed.size() - segment_tag_size(VERSION));
+        _segments[i].sealed = std::move(sealed);
+        _segments[i].values = std::move(values);
+        _segments[i].dirty = false;
+    });
+
+    for (const auto &r : refs) {
+        for (const auto &x : r) _entries.meta(x.first) = x.second;
+    }
+    seal.stop();
+
+    std::vector<std::string> tags(count);
+    for (size_t i = 0; i < count; ++i) {
+        tags[i] = _segments[i].tag;
+    }
+
+    // every snapshot gets a fresh id, so that a journal written against an
+    // older snapshot is never replayed on top of this one
+    CryptoPP::AutoSeededRandomPool rng;
+    _snapshot.assign(SNAPSHOT_ID_SIZE, '\0');
+    rng.GenerateBlock(reinterpret_cast<CryptoPP::byte *>(&_snapshot[0]), SNAPSHOT_ID_SIZE);
+
+    Image image;
+    image._salt = _salt;
+    image._kdf = _kdf;
+    image._snapshot = _snapshot;
+    image._compression = _compression;
+    image._indexTag = index_tag(_key, key_header(VERSION, _salt, _kdf, _snapshot, _compression), tags);
+    image._segments = _segments;
+
+    // once every segment is rewritten, the file they were read from can go;
+    // until then, the image keeps it mapped too
+    bool borrowed = false;
+    for (const auto &s : _segments) borrowed = borrowed || s.sealed.borrowed() || s.values.borrowed();
+    if (borrowed) image._mapping = _mapping;
+    else _mapping.reset();
+
+    _journalable = true;
+    return image;
+}
+
+void PasswordStore::Image::write(OutputStreamSerializer &serializer) const {
+    ProfileScope output("write.output");
+
+    serializer
+        << MAGIC << VERSION
+        << _salt
+        << static_cast<uint32_t>(_kdf.algorithm) << _kdf.cost << _kdf.blockSize << _kdf.parallelism
+        << _snapshot
+        << static_cast<uint32_t>(_compression.algorithm) << _compression.level
+        << static_cast<uint32_t>(_segments.size())
+        << _indexTag;
+
+    for (const auto &s : _segments) {
+        serializer << s.sealed.str() << s.values.str();
+    }
+}
+
+void PasswordStore::writeVersion(OutputStreamSerializer &serializer, uint32_t version) const {
+    if (version > VERSION) throw Error("Unsupported password file version");
+
+    attach();
+    resolveAll();
+
+    CryptoPP::AutoSeededRandomPool rng;
+
+    // 0 and 1: the whole store as a single JSON blob, encrypted under the
+    // passphrase itself; 0 had only default elements and no header
+    if (version < 2) {
+        std::string plaintext, encrypted;
+
+        if (version == 0) {
+            HashMap<std::string, std::string> m;
+            _entries.forEach([&] (uint32_t i) {
+                if (_entries.element(i) == StringRef("default")) m.put(_entries.name(i).str(), _entries.value(i).str());
+            });
+            plaintext = JSON::encode(m);
+        }
+        else {
+            plaintext = JSON::encode(materialize());
+        }
+
+        CryptoPP::StringSource ss(plaintext, true,
+            new Encryptor(
+                _passphrase.c_str(),
+                new CryptoPP::HexEncoder(
+                    new CryptoPP::StringSink(encrypted)
+                )
             )
-        )
-    );
+        );
+        SecureArena::wipe(plaintext);
+
+        if (version == 1) serializer << MAGIC << version;
+        serializer << encrypted;
+        return;
+    }
+
+    // before version 6, the key was always derived with PBKDF2
+    auto kdf = _kdf;
+    if (version < 6 && kdf.algorithm != KdfAlgorithm::PBKDF2_SHA256) {
+        kdf = KdfParameters { KdfAlgorithm::PBKDF2_SHA256, 100000, 0, 0 };
+    }
+
+    std::string salt(SALT_SIZE, '\0'), snapshot;
+    rng.GenerateBlock(reinterpret_cast<CryptoPP::byte *>(&salt[0]), SALT_SIZE);
+    if (version >= 7) {
+        snapshot.assign(SNAPSHOT_ID_SIZE, '\0');
+        rng.GenerateBlock(reinterpret_cast<CryptoPP::byte *>(&snapshot[0]), SNAPSHOT_ID_SIZE);
+    }
+
+    SecureString key(KEY_SIZE, '\0', ArenaAllocator<char>(_arena.get()));
+    kdf.derive(_passphrase.data(), _passphrase.size(), salt, reinterpret_cast<uint8_t *>(&key[0]), key.size());
+
+    uint32_t count = segment_count(_entries.names(), 0);
+    std::vector<std::vector<uint32_t>> names(count);
+    _entries.forEachName([&] (StringRef name, uint32_t first) {
+        names[segment_of(name, count)].push_back(first);
+    });
+
+    std::vector<std::string> sealed(count), values(count), tags(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        std::string index;
+
+        if (version < 4) {
+            HashMap<std::string, HashMap<std::string, std::string>> m;
+            for (auto first : names[i]) {
+                auto &elements = m[_entries.name(first).str()];
+                for (auto e = first; e != _entries.NONE; e = _entries.next(e)) {
+                    elements.put(_entries.element(e).str(), _entries.value(e).str());
+                }
+            }
+            index = JSON::encode(m);
+        }
+        else {
+            for (auto first : names[i]) {
+                auto name = _entries.name(first);
+                uint32_t elements = 0;
+                for (auto e = first; e != _entries.NONE; e = _entries.next(e)) ++elements;
+
+                encode_field(index, name);
+                encode_field(index, elements);
+
+                for (auto e = first; e != _entries.NONE; e = _entries.next(e)) {
+                    encode_field(index, _entries.element(e));
+
+                    if (version < 5) {
+                        encode_field(index, _entries.value(e));
+                        continue;
+                    }
 
-    serializer << MAGIC << VERSION << encrypted;
+                    auto value = seal_value(rng, version, key, name, _entries.element(e), _entries.value(e));
+                    encode_field(index, static_cast<uint32_t>(values[i].size()));
+                    encode_field(index, static_cast<uint32_t>(value.size()));
+                    if (version >= BOUND_VALUE_VERSION) index.append(value, value.size() - AEAD_TAG_SIZE, AEAD_TAG_SIZE);
+                    values[i].append(value);
+                }
+            }
+        }
+
+        if (version >= COMPRESSION_VERSION) index = compress_segment(_compression, index);
+        sealed[i] = seal_segment(rng, version, key, segment_context(i, count), index);
+        SecureArena::wipe(index);
+
+        size_t tagSize = segment_tag_size(version);
+        tags[i] = sealed[i].substr(sealed[i].size() - tagSize);
+
+        if (version == 2) {
+            std::string hex;
+            CryptoPP::StringSource ss(sealed[i], true,
+                new CryptoPP::HexEncoder(
+                    new CryptoPP::StringSink(hex)
+                )
+            );
+            sealed[i].swap(hex);
+        }
+    }
+
+    serializer << MAGIC << version << salt;
+    if (version < 6) {
+        serializer << static_cast<uint32_t>(kdf.cost);
+    }
+    else {
+        serializer << static_cast<uint32_t>(kdf.algorithm) << kdf.cost << kdf.blockSize << kdf.parallelism;
+    }
+    if (version >= 7) serializer << snapshot;
+    if (version >= COMPRESSION_VERSION) {
+        serializer << static_cast<uint32_t>(_compression.algorithm) << _compression.level;
+    }
+    serializer << count << index_tag(key, key_header(version, salt, kdf, snapshot, _compression), tags);
+
+    for (uint32_t i = 0; i < count; ++i) {
+        serializer << sealed[i];
+        if (version >= 5) serializer << values[i];
+    }
+}
+
+void PasswordStore::reset() {
+    _key.clear();
+    _compression = CompressionParameters::defaults();
+    _segments.clear();
+    _mapping.reset();
+    _entries.clear();
+    _view = HashMap<std::string, HashMap<std::string, std::string>>();
+    _detached = false;
+    _snapshot.clear();
+    _journal.clear();
+    _indexed = false;
+    _names.clear();
+    _searchable = false;
+    _search.clear();
+    ++_generation;
+}
+
+void PasswordStore::finishRead() {
+    // older versions are not journalable until rewritten in the current format,
+    // nor are those without a snapshot id
+    _journalable = _version == VERSION;
+
+    if (_mode == OpenMode::EAGER) {
+        ProfileScope resolve("read.resolve");
+        resolveAll();
+    }
 }
 
 void PasswordStore::readObject(InputStreamSerializer &serializer) {
@@ -123,21 +1487,338 @@ void PasswordStore::readObject(InputStreamSerializer &serializer) {
         throw RuntimeError("An unexpected error occurred while attempting to read password file");
     }
 
+    reset();
+    ProfileScope total("read");
+
     if (magic == MAGIC) {
         serializer >> magic >> version;
-        _passwords = reader[version](serializer, _passphrase.c_str());
+        if (version >= sizeof(reader) / sizeof(reader[0])) {
+            throw Error("Unsupported password file version");
+        }
+        _version = version;
+        reader[version](*this, serializer);
     }
     else {
-        _passwords = reader[0](serializer, _passphrase.c_str());
+        _version = 0;
+        reader[0](*this, serializer);
     }
+
+    finishRead();
 }
 
-std::vector<std::string> PasswordStore::list() const {
-    auto l =  _passwords.map<List<std::string>>([] (const MapNode<std::string, HashMap<std::string, std::string>> &p) {
-        return p.k;
-    });
+void PasswordStore::readFile(const std::string &path) {
+    std::shared_ptr<MappedFile> mapping;
+    uint64_t magic = 0;
+    uint32_t version = 0;
 
-    std::vector<std::string> v(l.begin(), l.end());
-    std::sort(v.begin(), v.end());
+    try {
+        mapping = std::make_shared<MappedFile>(path);
+    }
+    catch (const Error &) {
+        // e.g. on file systems that do not support mapping
+        InputFileSerializer(File(path.c_str())) >> *this;
+        return;
+    }
+
+    MappedReader source(*mapping);
+    if (source.peek(&magic, sizeof(magic)) && magic == MAGIC) {
+        source >> magic >> version;
+    }
+
+    // versions before segments are a single blob, read as it always was
+    if (magic != MAGIC || version < 2 || version >= sizeof(reader) / sizeof(reader[0])) {
+        mapping.reset();
+        InputFileSerializer(File(path.c_str())) >> *this;
+        return;
+    }
+
+    reset();
+    ProfileScope total("read");
+
+    _version = version;
+    readSegments(source, version);
+
+    // values are only opened when accessed, in no particular order
+    mapping->random();
+    _mapping = std::move(mapping);
+
+    finishRead();
+}
+
+void PasswordStore::rekey(const KdfParameters &kdf) {
+    // everything is re-encrypted under the new key on the next write, and so
+    // in the current format
+    touchAll();
+    newKey(kdf);
+    _version = VERSION;
+    _journalable = false;
+}
+
+void PasswordStore::recompress(const CompressionParameters &compression) {
+    if (! compression.valid()) throw Error("Invalid compression parameters");
+
+    // sealed values are unaffected, but every segment index is rewritten
+    attach();
+    _compression = compression;
+    for (auto &s : _segments) s.dirty = true;
+    _journalable = false;
+}
+
+std::string CompressionParameters::str() const {
+    if (algorithm == Compression::NONE) return "none";
+    return "deflate level=" + std::to_string(level);
+}
+
+HashMap<std::string, std::string> PasswordStore::get(const std::string &name) const {
+    attach();
+
+    HashMap<std::string, std::string> m;
+    for (auto i = _entries.first(name); i != _entries.NONE; i = _entries.next(i)) {
+        m.put(_entries.element(i).str(), resolve(i).str());
+    }
+    return m;
+}
+
+std::string PasswordStore::get(const std::string &name, const std::string &element) const {
+    attach();
+
+    auto i = _entries.find(name, element);
+    if (i == _entries.NONE) throw Error("Password not found");
+    return resolve(i).str();
+}
+
+std::vector<std::string> PasswordStore::elements(const std::string &name) const {
+    attach();
+
+    std::vector<std::string> v;
+    for (auto i = _entries.first(name); i != _entries.NONE; i = _entries.next(i)) {
+        v.push_back(_entries.element(i).str());
+    }
     return v;
 }
+
+void PasswordStore::record(
+    uint32_t op,
+    const std::string &name,
+    const std::string &element,
+    const std::string &value
+) {
+    if (_replaying) return;
+
+    encode_field(_journal, op);
+    encode_field(_journal, name);
+    if (op != JOURNAL_REMOVE) encode_field(_journal, element);
+    if (op == JOURNAL_PUT) encode_field(_journal, value);
+}
+
+void PasswordStore::put(const std::string &name, const std::string &element, const std::string &value) {
+    attach();
+    size_t size = _entries.size();
+    _entries.put(name, element, value);
+    if (_entries.size() != size) {
+        _searchable = false;
+        ++_generation;
+    }
+    if (_indexed) _names.insert(name);
+    touch(name);
+    record(JOURNAL_PUT, name, element, value);
+}
+
+void PasswordStore::putAll(const EntryTable<NoMeta> &entries) {
+    attach();
+    _entries.putAll(entries);
+
+    entries.forEachName([&] (StringRef name, uint32_t) {
+        if (_indexed) _names.insert(name.str());
+        if (! _segments.empty()) _segments[segment_of(name, _segments.size())].dirty = true;
+    });
+    _searchable = false;
+    ++_generation;
+
+    // journaling every entry would only be folded into a snapshot anyway
+    _journalable = false;
+}
+
+bool PasswordStore::remove(const std::string &name) {
+    attach();
+    if (! _entries.erase(name)) return false;
+    if (_indexed) _names.erase(name);
+    _searchable = false;
+    ++_generation;
+    touch(name);
+    record(JOURNAL_REMOVE, name);
+    return true;
+}
+
+bool PasswordStore::remove(const std::string &name, const std::string &element) {
+    attach();
+    if (! _entries.erase(name, element)) return false;
+    if (_indexed && ! _entries.contains(name)) _names.erase(name);
+    _searchable = false;
+    ++_generation;
+    touch(name);
+    record(JOURNAL_REMOVE_ELEMENT, name, element);
+    return true;
+}
+
+size_t PasswordStore::removeAll(const std::vector<std::string> &names, const std::string &element) {
+    attach();
+    size_t removed = 0;
+
+    for (const auto &name : names) {
+        if (element.empty() ? ! _entries.erase(name) : ! _entries.erase(name, element)) continue;
+
+        if (_indexed && ! _entries.contains(name)) _names.erase(name);
+        touch(name);
+        if (element.empty()) record(JOURNAL_REMOVE, name);
+        else record(JOURNAL_REMOVE_ELEMENT, name, element);
+        ++removed;
+    }
+
+    if (removed) {
+        _searchable = false;
+        ++_generation;
+    }
+    return removed;
+}
+
+const std::set<std::string> & PasswordStore::index() const {
+    if (! _indexed) {
+        std::vector<std::string> v;
+        attach();
+        v.reserve(_entries.names());
+        _entries.forEachName([&] (StringRef name, uint32_t) { v.push_back(name.str()); });
+        std::sort(v.begin(), v.end());
+
+        // constructing from a sorted range takes linear time
+        _names = std::set<std::string>(v.begin(), v.end());
+        _indexed = true;
+    }
+    return _names;
+}
+
+PasswordStore::NameRange PasswordStore::names(const std::string &prefix) const {
+    auto &names = index();
+    auto first = names.lower_bound(prefix);
+
+    // names starting with prefix end before the prefix with its last byte
+    // incremented, ignoring trailing 0xff bytes which cannot be incremented
+    std::string upper(prefix);
+    while (! upper.empty() && static_cast<uint8_t>(upper.back()) == 0xff) upper.pop_back();
+    if (upper.empty()) return NameRange(first, names.end());
+
+    upper.back() = static_cast<char>(static_cast<uint8_t>(upper.back()) + 1);
+    return NameRange(first, names.lower_bound(upper));
+}
+
+void PasswordStore::forEach(const std::function<void(StringRef, StringRef, StringRef)> &f) const {
+    for (const auto &name : index()) {
+        for (auto i = _entries.first(name); i != _entries.NONE; i = _entries.next(i)) {
+            // decrypting a value may move the table's strings
+            auto value = resolve(i);
+            f(name, _entries.element(i), value);
+        }
+    }
+}
+
+std::vector<std::string> PasswordStore::list() const {
+    auto range = names();
+    return std::vector<std::string>(range.begin(), range.end());
+}
+
+std::vector<std::string> PasswordStore::match(const std::string &pattern) const {
+    if (contains(pattern)) return { pattern };
+
+    // names can only match if they start with the part before the first
+    // special character
+    std::vector<std::string> matches;
+    for (const auto &name : names(pattern.substr(0, pattern.find_first_of("*?[\\")))) {
+        if (fnmatch(pattern.c_str(), name.c_str(), 0) == 0) matches.push_back(name);
+    }
+    return matches;
+}
+
+const NameSearch & PasswordStore::search() const {
+    if (! _searchable) {
+        _search.clear();
+
+        // in sorted order, so that equally ranked matches are listed
+        // alphabetically
+        for (auto &name : index()) {
+            _search.add(name);
+            for (auto i = _entries.first(name); i != _entries.NONE; i = _entries.next(i)) {
+                if (_entries.element(i) != StringRef("default")) _search.add(name, _entries.element(i));
+            }
+        }
+        _searchable = true;
+    }
+    return _search;
+}
+
+std::vector<SearchResult> PasswordStore::find(const std::string &pattern, size_t limit) const {
+    return search().find(pattern, limit);
+}
+
+std::string PasswordStore::takeJournal() {
+    std::string journal;
+    journal.swap(_journal);
+    return journal;
+}
+
+// journal record layout: as a segment, authenticated with the snapshot id and
+// record sequence number instead of the segment index and count
+std::string PasswordStore::sealJournal(const std::string &operations, const std::string &snapshot, uint64_t seq) const {
+    CryptoPP::AutoSeededRandomPool rng;
+    return seal_segment(rng, _version, _key, journal_context(snapshot, seq), operations);
+}
+
+bool PasswordStore::replayJournal(const std::string &sealed, const std::string &snapshot, uint64_t seq) {
+    std::string operations;
+    CryptoPP::StringSink sink(operations);
+    if (! open_segment(_version, _key, journal_context(snapshot, seq), sealed, sink)) return false;
+
+    std::vector<std::string> fields(3);
+    size_t pos = 0;
+    uint32_t op;
+
+    _replaying = true;
+    try {
+        while (pos < operations.size()) {
+            if (! decode_field(operations, pos, op) || ! decode_field(operations, pos, fields[0])) {
+                throw Error("Password file is corrupted");
+            }
+
+            switch (op) {
+            case JOURNAL_PUT:
+                if (! decode_field(operations, pos, fields[1]) || ! decode_field(operations, pos, fields[2])) {
+                    throw Error("Password file is corrupted");
+                }
+                put(fields[0], fields[1], fields[2]);
+            break;
+
+            case JOURNAL_REMOVE:
+                remove(fields[0]);
+            break;
+
+            case JOURNAL_REMOVE_ELEMENT:
+                if (! decode_field(operations, pos, fields[1])) throw Error("Password file is corrupted");
+                remove(fields[0], fields[1]);
+            break;
+
+            default:
+                throw Error("Password file is corrupted");
+            }
+        }
+    }
+    catch (...) {
+        _replaying = false;
+        SecureArena::wipe(operations);
+        for (auto &f : fields) SecureArena::wipe(f);
+        throw;
+    }
+    _replaying = false;
+    SecureArena::wipe(operations);
+    for (auto &f : fields) SecureArena::wipe(f);
+
+    return true;
+}
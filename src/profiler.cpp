@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2023 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#include <profiler.h>
+#include <algorithm>
+#include <stdio.h>
+
+struct Summary {
+    uint64_t count;
+    double total;
+    double mean;
+    double p50;
+    double p90;
+    double p99;
+    double max;
+};
+
+template <typename Phase>
+static Summary summarize(const Phase &p) {
+    auto samples = p.samples;
+    std::sort(samples.begin(), samples.end());
+
+    auto at = [&] (size_t percent) {
+        return samples.empty() ? 0 : samples[samples.size() * percent / 100];
+    };
+
+    return Summary {
+        p.count, p.total, p.count ? p.total / p.count : 0, at(50), at(90), at(99), p.max
+    };
+}
+
+Profiler & Profiler::shared() {
+    static Profiler profiler;
+    return profiler;
+}
+
+void Profiler::record(const std::string &phase, double ms) {
+    std::lock_guard<std::mutex> lock(_mtx);
+    auto &p = _phases[phase];
+
+    ++p.count;
+    p.total += ms;
+    p.max = std::max(p.max, ms);
+    if (p.samples.size() < SAMPLES) p.samples.push_back(ms);
+}
+
+void Profiler::clear() {
+    std::lock_guard<std::mutex> lock(_mtx);
+    _phases.clear();
+}
+
+std::string Profiler::str() const {
+    std::lock_guard<std::mutex> lock(_mtx);
+    char buf[256];
+
+    snprintf(
+        buf, sizeof(buf), "%-24s %8s %12s %10s %10s %10s %10s %10s\n",
+        "phase", "count", "total ms", "mean ms", "p50 ms", "p90 ms", "p99 ms", "max ms"
+    );
+    std::string s(buf);
+
+    for (const auto &x : _phases) {
+        auto p = summarize(x.second);
+        snprintf(
+            buf, sizeof(buf), "%-24s %8llu %12.3f %10.3f %10.3f %10.3f %10.3f %10.3f\n",
+            x.first.c_str(), static_cast<unsigned long long>(p.count),
+            p.total, p.mean, p.p50, p.p90, p.p99, p.max
+        );
+        s += buf;
+    }
+    return s;
+}
+
+std::string Profiler::json() const {
+    std::lock_guard<std::mutex> lock(_mtx);
+    char buf[512];
+    std::string s("[");
+
+    for (const auto &x : _phases) {
+        auto p = summarize(x.second);
+        snprintf(
+            buf, sizeof(buf),
+            "%s\n    {\"phase\":\"%s\",\"count\":%llu,\"total_ms\":%.6f,\"mean_ms\":%.6f,"
+            "\"p50_ms\":%.6f,\"p90_ms\":%.6f,\"p99_ms\":%.6f,\"max_ms\":%.6f}",
+            s.size() > 1 ? "," : "", x.first.c_str(), static_cast<unsigned long long>(p.count),
+            p.total, p.mean, p.p50, p.p90, p.p99, p.max
+        );
+        s += buf;
+    }
+    s += s.size() > 1 ? "\n]\n" : "]\n";
+    return s;
+}
+
+void ProfileScope::stop() {
+    if (! _active) return;
+    _active = false;
+
+    double ms = std::chrono::duration<double, std::milli>(Profiler::Clock::now() - _start).count();
+    Profiler::shared().record(_group ? std::string(_group) + "." + _phase : std::string(_phase), ms);
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2023 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#include <saver.h>
+#include <exception>
+
+BackgroundSaver::BackgroundSaver(const std::function<std::function<void()>()> &prepare, size_t autosave)
+:   _prepare(prepare),
+    _autosave(autosave),
+    _thread(&BackgroundSaver::loop, this)
+{ }
+
+BackgroundSaver::~BackgroundSaver() {
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _stop = true;
+    }
+    _requested.notify_one();
+    _thread.join();
+}
+
+void BackgroundSaver::loop() {
+    std::unique_lock<std::mutex> lock(_mtx);
+    while (true) {
+        _requested.wait(lock, [&] { return _stop || _requests != _started; });
+
+        // pending requests are still saved when stopping
+        if (_requests == _started) return;
+        _started = _requests;
+
+        lock.unlock();
+        std::string error;
+        try {
+            std::function<void()> write;
+            {
+                std::lock_guard<std::mutex> shared(_sharedMtx);
+                write = _prepare();
+            }
+            if (write) write();
+        }
+        catch (const std::exception &e) {
+            error = e.what();
+        }
+        lock.lock();
+
+        _completed = _started;
+        ++_saves;
+        _failed = ! error.empty();
+        if (_failed) _errors.push_back(error);
+        _done.notify_all();
+    }
+}
+
+void BackgroundSaver::request() {
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        ++_requests;
+        _mutations = 0;
+    }
+    _requested.notify_one();
+}
+
+void BackgroundSaver::mutated(size_t n) {
+    bool save;
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _mutations += n;
+        save = _autosave && _mutations >= _autosave;
+    }
+    if (save) request();
+}
+
+bool BackgroundSaver::wait() {
+    std::unique_lock<std::mutex> lock(_mtx);
+    auto requests = _requests;
+    _done.wait(lock, [&] { return _completed >= requests; });
+    return ! _failed;
+}
+
+bool BackgroundSaver::saving() {
+    std::lock_guard<std::mutex> lock(_mtx);
+    return _completed != _requests;
+}
+
+uint64_t BackgroundSaver::saves() {
+    std::lock_guard<std::mutex> lock(_mtx);
+    return _saves;
+}
+
+std::vector<std::string> BackgroundSaver::errors() {
+    std::lock_guard<std::mutex> lock(_mtx);
+    std::vector<std::string> errors;
+    errors.swap(_errors);
+    return errors;
+}
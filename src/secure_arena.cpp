@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2023 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#include <secure_arena.h>
+#include <new>
+#include <cstddef>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static const size_t ALIGNMENT = alignof(std::max_align_t);
+
+static size_t round_up(size_t size, size_t multiple) {
+    return (size + multiple - 1) / multiple * multiple;
+}
+
+// index of the free list of blocks of the given size, a power of two
+static size_t size_class(size_t block) {
+    size_t i = 0;
+    while ((SecureArena::MIN_BLOCK << i) < block) ++i;
+    return i;
+}
+
+static size_t block_size(size_t size) {
+    size_t block = SecureArena::MIN_BLOCK;
+    while (block < size) block <<= 1;
+    return block;
+}
+
+SecureArena::SecureArena(size_t chunkSize)
+:   _chunkSize(round_up(chunkSize, ::sysconf(_SC_PAGESIZE)))
+{
+    static_assert(MIN_BLOCK % ALIGNMENT == 0, "blocks must be aligned for any type");
+}
+
+SecureArena::~SecureArena() {
+    for (auto &c : _chunks) {
+        wipe(c.data, c.used);
+        if (c.locked) ::munlock(c.data, c.size);
+        ::munmap(c.data, c.size);
+    }
+}
+
+SecureArena & SecureArena::shared() {
+    static SecureArena arena;
+    return arena;
+}
+
+SecureArena::Chunk & SecureArena::grow(size_t size) {
+    // blocks are carved out of the last chunk, so chunks of their own go
+    // first
+    bool own = size > _chunkSize;
+
+    Chunk c;
+    c.size = size > _chunkSize ? round_up(size, ::sysconf(_SC_PAGESIZE)) : _chunkSize;
+    c.used = 0;
+
+    void *data = ::mmap(nullptr, c.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED) throw std::bad_alloc();
+    c.data = static_cast<char *>(data);
+
+    c.locked = ::mlock(c.data, c.size) == 0;
+#ifdef MADV_DONTDUMP
+    ::madvise(c.data, c.size, MADV_DONTDUMP);
+#endif
+
+    if (own) return *_chunks.insert(_chunks.begin(), c);
+    _chunks.push_back(c);
+    return _chunks.back();
+}
+
+void SecureArena::release(char *block, size_t size) {
+    size_t i = size_class(size);
+    if (_free.size() <= i) _free.resize(i + 1);
+    _free[i].push_back(block);
+}
+
+void * SecureArena::allocate(size_t size) {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    // a block larger than a chunk gets a chunk of its own
+    if (size > _chunkSize) {
+        auto &c = grow(size);
+        c.used = c.size;
+        _used += c.size;
+        return c.data;
+    }
+
+    size_t block = block_size(size);
+    size_t i = size_class(block);
+    _used += block;
+
+    if (i < _free.size() && ! _free[i].empty()) {
+        char *p = _free[i].back();
+        _free[i].pop_back();
+        return p;
+    }
+
+    // the tail of the current chunk, if too small, is split into free blocks
+    // before moving on to a new chunk
+    if (_chunks.empty() || _chunks.back().size - _chunks.back().used < block) {
+        if (! _chunks.empty() && _chunks.back().size <= _chunkSize) {
+            auto &c = _chunks.back();
+            for (size_t b = block >> 1; b >= MIN_BLOCK; b >>= 1) {
+                if (c.size - c.used >= b) {
+                    release(c.data + c.used, b);
+                    c.used += b;
+                }
+            }
+        }
+        grow(_chunkSize);
+    }
+
+    auto &c = _chunks.back();
+    void *p = c.data + c.used;
+    c.used += block;
+    return p;
+}
+
+void SecureArena::deallocate(void *data, size_t size) {
+    if (data == nullptr) return;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (size > _chunkSize) {
+        for (auto c = _chunks.begin(); c != _chunks.end(); ++c) {
+            if (c->data == data) {
+                wipe(c->data, c->size);
+                if (c->locked) ::munlock(c->data, c->size);
+                ::munmap(c->data, c->size);
+                _used -= c->size;
+                _chunks.erase(c);
+                return;
+            }
+        }
+        return;
+    }
+
+    size_t block = block_size(size);
+    wipe(data, block);
+    release(static_cast<char *>(data), block);
+    _used -= block;
+}
+
+size_t SecureArena::size() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _used;
+}
+
+size_t SecureArena::mapped() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    size_t size = 0;
+    for (const auto &c : _chunks) size += c.size;
+    return size;
+}
+
+bool SecureArena::contains(const void *data) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    auto p = static_cast<const char *>(data);
+    for (const auto &c : _chunks) {
+        if (p >= c.data && p < c.data + c.size) return true;
+    }
+    return false;
+}
+
+bool SecureArena::locked() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    for (const auto &c : _chunks) {
+        if (! c.locked) return false;
+    }
+    return true;
+}
+
+void SecureArena::wipe(void *data, size_t size) {
+    volatile char *p = static_cast<volatile char *>(data);
+    while (size--) *p++ = 0;
+}
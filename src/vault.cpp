@@ -0,0 +1,418 @@
+/*
+ * Copyright (c) 2023 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#include <vault.h>
+#include <file.h>
+#include <error.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+// journal layout: magic || snapshot id || (32-bit length || sealed record)*
+static const uint64_t JOURNAL_MAGIC = 0x555555555555a11d;
+
+static const size_t JOURNAL_HEADER_SIZE = sizeof(JOURNAL_MAGIC) + 16;
+
+static void write_all(int fd, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t n = ::write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw Error("Failed to write password file");
+        }
+        data += n;
+        size -= n;
+    }
+}
+
+static bool read_all(const std::string &path, std::string &data) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        if (errno == ENOENT) return false;
+        throw Error("Failed to open password file");
+    }
+
+    char buf[4096];
+    ssize_t n;
+    data.clear();
+    while ((n = ::read(fd, buf, sizeof(buf))) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            ::close(fd);
+            throw Error("Failed to read password file");
+        }
+        data.append(buf, n);
+    }
+
+    ::close(fd);
+    return true;
+}
+
+static void sync_path(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0 || ::fsync(fd) != 0) {
+        if (fd >= 0) ::close(fd);
+        throw Error("Failed to write password file");
+    }
+    ::close(fd);
+}
+
+static void sync_parent(const std::string &path) {
+    auto sep = path.rfind('/');
+    sync_path(sep == std::string::npos ? "." : sep == 0 ? "/" : path.substr(0, sep));
+}
+
+static void rename_path(const std::string &from, const std::string &to) {
+    if (::rename(from.c_str(), to.c_str()) != 0) throw Error("Failed to write password file");
+}
+
+Vault::Vault(const std::string &path, PasswordStore &store, size_t threshold)
+:   _path(path),
+    _tmpPath(path + ".tmp"),
+    _journalPath(path + ".journal"),
+    _nextPath(path + ".journal.next"),
+    _rejectedPath(path + ".journal.rejected"),
+    _lock(-1),
+    _store(store),
+    _threshold(threshold),
+    _journal(-1),
+    _seq(0),
+    _size(0),
+    _compactDone(false)
+{
+    // held until destruction; the lock file itself is left in place, since
+    // removing it could let two processes lock different files
+    _lock = ::open((path + ".lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (_lock < 0) throw Error("Failed to open password file");
+
+    if (::flock(_lock, LOCK_EX | LOCK_NB) != 0) {
+        ::close(_lock);
+        _lock = -1;
+        throw Error("Password file is in use by another pwdman process");
+    }
+}
+
+Vault::~Vault() {
+    try {
+        close();
+    }
+    catch (...) { }
+
+    if (_lock >= 0) ::close(_lock);
+}
+
+bool Vault::exists() const {
+    return File(_path.c_str()).exists();
+}
+
+bool Vault::inUse(const std::string &path) {
+    int fd = ::open((path + ".lock").c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    bool locked = ::flock(fd, LOCK_EX | LOCK_NB) != 0 && errno == EWOULDBLOCK;
+    ::close(fd);
+    return locked;
+}
+
+void Vault::writeSnapshot(const PasswordStore::Image &image, const std::string &path) {
+    File file(path.c_str());
+    file.open(File::READ_WRITE | File::CREATE | File::TRUNCATE, 0600);
+    OutputFileSerializer serializer(file);
+    image.write(serializer);
+    serializer.flush();
+    file.close();
+    sync_path(path);
+}
+
+size_t Vault::writeJournal(const std::string &snapshot, const std::vector<std::string> &sealed) {
+    std::string journal;
+    journal.append(reinterpret_cast<const char *>(&JOURNAL_MAGIC), sizeof(JOURNAL_MAGIC));
+    journal.append(snapshot);
+
+    for (const auto &record : sealed) {
+        uint32_t size = record.size();
+        journal.append(reinterpret_cast<const char *>(&size), sizeof(size));
+        journal.append(record);
+    }
+
+    int fd = ::open(_nextPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) throw Error("Failed to write password file");
+
+    try {
+        write_all(fd, journal.data(), journal.size());
+        if (::fsync(fd) != 0) throw Error("Failed to write password file");
+    }
+    catch (...) {
+        ::close(fd);
+        throw;
+    }
+
+    ::close(fd);
+    return journal.size();
+}
+
+void Vault::openJournal(const std::string &snapshot, uint64_t seq, size_t size) {
+    if (_journal >= 0) ::close(_journal);
+
+    _journal = ::open(_journalPath.c_str(), O_WRONLY | O_APPEND);
+    if (_journal < 0) throw Error("Failed to open password file");
+
+    _snapshot = snapshot;
+    _seq = seq;
+    _size = size;
+}
+
+void Vault::publish(const std::string &snapshot, const std::vector<std::string> &sealed) {
+    // the new journal is in place under its temporary name before the
+    // snapshot is replaced, so open() can always find the journal that
+    // matches whichever snapshot it reads
+    auto size = writeJournal(snapshot, sealed);
+    rename_path(_tmpPath, _path);
+
+    if (_journal >= 0) {
+        ::close(_journal);
+        _journal = -1;
+    }
+    rename_path(_nextPath, _journalPath);
+    sync_parent(_path);
+
+    openJournal(snapshot, sealed.size(), size);
+}
+
+void Vault::reject(const std::string &records, uint64_t seq) {
+    int fd = ::open(_rejectedPath.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0600);
+    if (fd < 0) throw Error("Password journal is corrupted");
+
+    try {
+        write_all(fd, records.data(), records.size());
+        if (::fsync(fd) != 0) throw Error("Password journal is corrupted");
+    }
+    catch (...) {
+        ::close(fd);
+        throw;
+    }
+    ::close(fd);
+
+    _warning = "Password journal is corrupted at record " + std::to_string(seq)
+        + "; later changes were not applied, and were moved to '" + _rejectedPath + "'";
+}
+
+bool Vault::replay(const std::string &path) {
+    std::string journal;
+    if (! read_all(path, journal)) return false;
+
+    if (
+        journal.size() < JOURNAL_HEADER_SIZE
+        || memcmp(journal.data(), &JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) != 0
+        || journal.compare(sizeof(JOURNAL_MAGIC), _snapshot.size(), _snapshot) != 0
+    ) {
+        // written for another snapshot
+        return false;
+    }
+
+    size_t pos = JOURNAL_HEADER_SIZE;
+    uint64_t seq = 0;
+    uint32_t size;
+
+    while (journal.size() - pos >= sizeof(size)) {
+        memcpy(&size, &journal[pos], sizeof(size));
+        if (journal.size() - pos - sizeof(size) < size) break;
+
+        bool last = pos + sizeof(size) + size == journal.size();
+        if (! _store.replayJournal(journal.substr(pos + sizeof(size), size), _snapshot, seq)) {
+            // only the final record can be torn by an interrupted save. Past
+            // any other bad record, nothing can be trusted to apply in order,
+            // so the rest is kept aside rather than failing to open at all
+            if (! last) reject(journal.substr(pos), seq);
+            break;
+        }
+
+        pos += sizeof(size) + size;
+        ++seq;
+    }
+
+    if (pos != journal.size() && ::truncate(path.c_str(), pos) != 0) {
+        throw Error("Failed to write password file");
+    }
+
+    _seq = seq;
+    _size = pos;
+    return true;
+}
+
+void Vault::open() {
+    _warning.clear();
+
+    // snapshots are only ever replaced by rename, so the store may keep
+    // reading from a mapping of this one
+    _store.readFile(_path);
+
+    // leftover of an interrupted save
+    ::unlink(_tmpPath.c_str());
+
+    // files written by older versions get a journal on their first save
+    _snapshot = _store.snapshot();
+    if (_snapshot.empty()) return;
+
+    if (replay(_nextPath)) {
+        // interrupted between replacing the snapshot and its journal
+        rename_path(_nextPath, _journalPath);
+        sync_parent(_path);
+    }
+    else if (! replay(_journalPath)) {
+        _size = writeJournal(_snapshot, std::vector<std::string>());
+        _seq = 0;
+        rename_path(_nextPath, _journalPath);
+        sync_parent(_path);
+    }
+
+    openJournal(_snapshot, _seq, _size);
+}
+
+void Vault::append(const std::string &sealed) {
+    uint32_t size = sealed.size();
+
+    std::string record;
+    record.append(reinterpret_cast<const char *>(&size), sizeof(size));
+    record.append(sealed);
+
+    try {
+        write_all(_journal, record.data(), record.size());
+        if (::fsync(_journal) != 0) throw Error("Failed to write password file");
+    }
+    catch (...) {
+        // drop the partial record; if that fails too, the journal is
+        // abandoned and the next save writes a new snapshot instead
+        if (::ftruncate(_journal, _size) != 0) {
+            ::close(_journal);
+            _journal = -1;
+        }
+        throw;
+    }
+
+    ++_seq;
+    _size += record.size();
+}
+
+void Vault::save() {
+    prepare()();
+}
+
+std::function<void()> Vault::prepare() {
+    _pending.append(_store.takeJournal());
+
+    if (_journal < 0 || ! _store.journalable()) return prepareCompact();
+
+    // sealed for the position the record will have in the journal; nothing
+    // else is written until it is
+    std::string sealed;
+    if (! _pending.empty()) sealed = _store.sealJournal(_pending, _snapshot, _seq);
+
+    // records saved while compacting are carried over to the new snapshot
+    bool carry = compacting();
+    bool finish = carry && _compactDone;
+
+    // the copy to compact is taken here, but only handed to the compactor once
+    // the record it includes is durable
+    std::shared_ptr<PasswordStore> copy;
+    size_t size = _size + (sealed.empty() ? 0 : sizeof(uint32_t) + sealed.size());
+    if (! carry && size > _threshold) copy = std::make_shared<PasswordStore>(_store);
+
+    return [this, sealed, carry, finish, copy] {
+        if (! sealed.empty()) {
+            append(sealed);
+            if (carry) _recent.push_back(_pending);
+            SecureArena::wipe(_pending);
+            _pending.clear();
+        }
+
+        if (finish) finishCompaction();
+        else if (copy) startCompaction(copy);
+    };
+}
+
+void Vault::compact() {
+    prepareCompact()();
+}
+
+std::function<void()> Vault::prepareCompact() {
+    // the snapshot covers everything, including changes not yet journaled
+    auto journal = _store.takeJournal();
+    SecureArena::wipe(journal);
+    SecureArena::wipe(_pending);
+    _pending.clear();
+
+    auto image = std::make_shared<PasswordStore::Image>(_store.seal());
+
+    return [this, image] {
+        abandonCompaction();
+        writeSnapshot(*image, _tmpPath);
+        publish(image->snapshot(), std::vector<std::string>());
+    };
+}
+
+void Vault::startCompaction(const std::shared_ptr<PasswordStore> &copy) {
+    // the copy is taken by prepare(), so the compactor never touches state
+    // shared with the caller
+    _compacted = copy;
+    _compactDone = false;
+    _compactError = nullptr;
+
+    _compactor = std::thread([this] {
+        try {
+            writeSnapshot(_compacted->seal(), _tmpPath);
+        }
+        catch (...) {
+            _compactError = std::current_exception();
+        }
+        _compactDone = true;
+    });
+}
+
+void Vault::finishCompaction() {
+    _compactor.join();
+
+    auto compacted = std::move(_compacted);
+    std::vector<std::string> recent;
+    recent.swap(_recent);
+
+    if (_compactError) {
+        // the journal is still complete, so compaction is simply retried on
+        // a later save
+        auto error = _compactError;
+        _compactError = nullptr;
+        ::unlink(_tmpPath.c_str());
+        std::rethrow_exception(error);
+    }
+
+    // records saved while compacting are resealed for the new snapshot, with
+    // the key it was written under
+    std::vector<std::string> sealed;
+    for (uint64_t seq = 0; seq < recent.size(); ++seq) {
+        sealed.push_back(compacted->sealJournal(recent[seq], compacted->snapshot(), seq));
+    }
+    publish(compacted->snapshot(), sealed);
+}
+
+void Vault::abandonCompaction() {
+    if (! compacting()) return;
+
+    _compactor.join();
+    _compacted.reset();
+    _compactError = nullptr;
+    _recent.clear();
+    ::unlink(_tmpPath.c_str());
+}
+
+void Vault::close() {
+    if (compacting()) finishCompaction();
+
+    if (_journal >= 0) {
+        ::close(_journal);
+        _journal = -1;
+    }
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2023 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#include <worker_pool.h>
+
+WorkerPool::WorkerPool(size_t threads) {
+    start(threads);
+}
+
+WorkerPool::~WorkerPool() {
+    stop();
+}
+
+void WorkerPool::start(size_t threads) {
+    if (threads == 0) threads = std::thread::hardware_concurrency();
+    if (threads == 0) threads = 1;
+
+    _stop = false;
+    for (size_t i = 1; i < threads; ++i) {
+        _threads.emplace_back(&WorkerPool::loop, this);
+    }
+}
+
+void WorkerPool::stop() {
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _stop = true;
+    }
+    _start.notify_all();
+
+    for (auto &t : _threads) t.join();
+    _threads.clear();
+}
+
+void WorkerPool::resize(size_t threads) {
+    std::lock_guard<std::mutex> lock(_runMtx);
+    stop();
+    start(threads);
+}
+
+void WorkerPool::work() {
+    size_t i;
+    while ((i = _next++) < _n) {
+        try {
+            (*_task)(i);
+        }
+        catch (...) {
+            std::lock_guard<std::mutex> lock(_mtx);
+            if (! _error) _error = std::current_exception();
+        }
+    }
+}
+
+void WorkerPool::loop() {
+    uint64_t generation = 0;
+
+    std::unique_lock<std::mutex> lock(_mtx);
+    while (true) {
+        _start.wait(lock, [&] { return _stop || _generation != generation; });
+        if (_stop) return;
+        generation = _generation;
+
+        lock.unlock();
+        work();
+        lock.lock();
+
+        if (--_active == 0) _done.notify_all();
+    }
+}
+
+void WorkerPool::run(size_t n, const std::function<void(size_t)> &task) {
+    std::lock_guard<std::mutex> runLock(_runMtx);
+
+    if (n <= 1 || _threads.empty()) {
+        for (size_t i = 0; i < n; ++i) task(i);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _task = &task;
+        _n = n;
+        _next = 0;
+        _active = _threads.size();
+        _error = nullptr;
+        ++_generation;
+    }
+    _start.notify_all();
+
+    work();
+
+    std::exception_ptr error;
+    {
+        std::unique_lock<std::mutex> lock(_mtx);
+        _done.wait(lock, [&] { return _active == 0; });
+        _task = nullptr;
+        error = _error;
+        _error = nullptr;
+    }
+
+    if (error) std::rethrow_exception(error);
+}
+
+WorkerPool & WorkerPool::shared() {
+    static WorkerPool pool;
+    return pool;
+}
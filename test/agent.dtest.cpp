@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2023 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#include <dtest.h>
+#include <agent.h>
+#include <thread>
+#include <unistd.h>
+
+static void remove_agent_files() {
+    ::unlink("agent.test");
+    ::unlink("agent.test.journal");
+    ::unlink("agent.test.sock");
+}
+
+unit("agent", "requests")
+.onInit([] {
+    remove_agent_files();
+})
+.onComplete([] {
+    remove_agent_files();
+})
+.body([] {
+    PasswordStore s("password", OpenMode::LAZY);
+    Vault v("agent.test", s);
+    s.put("github", "default", "pass");
+    s.put("github", "user", "me");
+    v.save();
+
+    std::string copied;
+    Agent agent("agent.test.sock", s, v, 0, [&] (const std::string &text) {
+        copied = text;
+        return true;
+    });
+    agent.listen();
+
+    std::thread server([&] {
+        agent.serve();
+    });
+
+    {
+        AgentClient c("agent.test.sock");
+
+        auto r = c.request(AgentOp::GET, { "github", "user" });
+        assert(r.code == static_cast<uint8_t>(AgentStatus::OK));
+        assert(r.fields == std::vector<std::string>({ "me" }));
+
+        r = c.request(AgentOp::GET, { "github", "" });
+        assert(r.code == static_cast<uint8_t>(AgentStatus::OK));
+        assert(r.fields == std::vector<std::string>({ "default", "pass", "user", "me" }));
+
+        r = c.request(AgentOp::GET, { "gitlab", "" });
+        assert(r.code == static_cast<uint8_t>(AgentStatus::NOT_FOUND));
+
+        r = c.request(AgentOp::ADD, { "gitlab", "", "secret" });
+        assert(r.code == static_cast<uint8_t>(AgentStatus::OK));
+
+        r = c.request(AgentOp::LIST, { "" });
+        assert(r.fields == std::vector<std::string>({ "github", "gitlab" }));
+
+        r = c.request(AgentOp::COPY, { "gitlab", "" });
+        assert(r.code == static_cast<uint8_t>(AgentStatus::OK));
+
+        r = c.request(AgentOp::LIST, { });
+        assert(r.code == static_cast<uint8_t>(AgentStatus::ERROR));
+    }
+
+    // a second agent cannot take over the socket
+    {
+        PasswordStore s2("password");
+        Vault v2("agent.test", s2);
+        Agent other("agent.test.sock", s2, v2, 0, [] (const std::string &) { return true; });
+        try {
+            other.listen();
+            fail("Replaced a running agent");
+        }
+        catch (...) { }
+    }
+
+    AgentClient("agent.test.sock").request(AgentOp::STOP, { });
+    server.join();
+
+    assert(copied == "secret");
+
+    // additions are saved by the agent
+    {
+        PasswordStore r("password");
+        Vault rv("agent.test", r);
+        rv.open();
+        assert(r.get("gitlab", "default") == "secret");
+    }
+});
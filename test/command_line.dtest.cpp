@@ -0,0 +1,172 @@
+/*
+ * Copyright (c) 2023 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#include <dtest.h>
+#include <command_line.h>
+#include <random>
+#include <vector>
+
+// tokenizes the line character by character; false if a quote is not closed
+static bool reference_tokens(const std::string &line, std::vector<std::string> &tokens) {
+    size_t i = 0;
+    while (true) {
+        while (i < line.size() && line[i] == ' ') ++i;
+        if (i == line.size()) return true;
+
+        std::string token;
+        if (line[i] == '\'' || line[i] == '\"') {
+            size_t close = line.find(line[i], i + 1);
+            if (close == std::string::npos) return false;
+            token = line.substr(i + 1, close - i - 1);
+            i = close + 1;
+        }
+        else {
+            while (i < line.size() && line[i] != ' ') {
+                if (line[i] == '\\' && ++i == line.size()) break;
+                token.push_back(line[i++]);
+            }
+        }
+        tokens.push_back(token);
+    }
+}
+
+static bool tokens(const std::string &line, std::vector<std::string> &out) {
+    Tokenizer t(line);
+    std::vector<StringRef> refs;
+    StringRef token("", 0);
+
+    while (! t.done()) {
+        if (! t.next(token)) return false;
+        refs.push_back(token);
+    }
+
+    // tokens stay valid until the tokenizer is destroyed
+    for (auto &r : refs) out.push_back(r.str());
+    return true;
+}
+
+unit("command_line", "parse")
+.body([] {
+    auto cmd = parse_command("ADD my\\ bank.pin '1 2 3'");
+    assert(cmd.type == CommandType::ADD);
+    assert(cmd.path.name == "my bank" && cmd.path.element == "pin");
+    assert(cmd.value == "1 2 3");
+    assert(cmd.cmdStr == StringRef("ADD my\\ bank.pin '1 2 3'"));
+
+    const std::vector<std::pair<std::string, CommandType>> aliases = {
+        { "a x y", CommandType::ADD }, { "Remove x", CommandType::REMOVE }, { "r x", CommandType::REMOVE },
+        { "get x", CommandType::GET }, { "C x", CommandType::COPY }, { "copy x", CommandType::COPY },
+        { "l", CommandType::LIST }, { "LIST", CommandType::LIST }, { "h", CommandType::HELP },
+        { "help", CommandType::HELP }, { "w", CommandType::WRITE }, { "write", CommandType::WRITE },
+        { "q", CommandType::QUIT }, { "quit", CommandType::QUIT }, { "t", CommandType::TUNE },
+        { "tune 100", CommandType::TUNE }, { "find x", CommandType::FIND }, { "F x", CommandType::FIND },
+    };
+    for (auto &x : aliases) assert(parse_command(x.first).type == x.second);
+
+    assert(parse_command("  g  github  ").type == CommandType::GET);
+    assert(parse_command("Exit").type == CommandType::QUIT);
+    assert(parse_command("wq").type == CommandType::WRITE_QUIT);
+    assert(parse_command("f a.b").path.name == "a.b");
+    assert(parse_command("").type == CommandType::INVALID);
+
+    // tune takes its duration as a raw token, which may have a dot in it
+    cmd = parse_command("tune 0.5 scrypt:2");
+    assert(cmd.type == CommandType::TUNE);
+    assert(cmd.path.name == "0.5" && cmd.path.element.empty() && cmd.value == "scrypt:2");
+    assert(parse_command("tune").type == CommandType::TUNE);
+
+    // compress shows the current level when given none, and sets it otherwise
+    cmd = parse_command("compress");
+    assert(cmd.type == CommandType::COMPRESS && cmd.path.name.empty() && cmd.value.empty());
+    cmd = parse_command("compress 6");
+    assert(cmd.type == CommandType::COMPRESS && cmd.path.name == "6" && cmd.path.element.empty());
+    assert(parse_command("compress 6 7").type == CommandType::INVALID);
+
+    // unknown commands, wrong arguments and unterminated quotes
+    assert(parse_command("adds x y").type == CommandType::INVALID);
+    assert(parse_command("w x").type == CommandType::INVALID);
+    assert(parse_command("get 'x").type == CommandType::INVALID);
+});
+
+unit("command_line", "vault")
+.body([] {
+    auto path = get_password_path("work:my.bank.pin");
+    assert(path.vault == "work" && path.name == "my.bank" && path.element == "pin");
+
+    path = parse_command("get 'home-2:my bank'").path;
+    assert(path.vault == "home-2" && path.name == "my bank" && path.element.empty());
+
+    path = parse_command("l work:").path;
+    assert(path.vault == "work" && path.name.empty());
+
+    // only a plain prefix is a vault
+    path = get_password_path("https://github.com.user");
+    assert(path.vault == "https" && path.name == "//github.com" && path.element == "user");
+    path = get_password_path("my site:8080");
+    assert(path.vault.empty() && path.name == "my site:8080");
+    path = get_password_path(":x");
+    assert(path.vault.empty() && path.name == ":x");
+
+    assert(valid_vault_name("work_2"));
+    assert(! valid_vault_name("") && ! valid_vault_name("a.b") && ! valid_vault_name("a:"));
+
+    // with a single vault, its own name followed by a colon is part of a name
+    path = parse_command("get pwdman:old.user").path;
+    assert(resolve_vault(path, { "pwdman" }) == -1);
+    assert(path.vault.empty() && path.name == "pwdman:old" && path.element == "user");
+
+    // with several, a prefix picks a vault, unless it names none of them
+    path = parse_command("get work:github").path;
+    assert(resolve_vault(path, { "pwdman", "work" }) == 1);
+    assert(path.vault.empty() && path.name == "github");
+
+    path = parse_command("get pwdman:old").path;
+    assert(resolve_vault(path, { "pwdman", "work" }) == 0 && path.name == "old");
+
+    path = parse_command("get https://example.com").path;
+    assert(resolve_vault(path, { "pwdman", "work" }) == -1 && path.name == "https://example");
+
+    path = parse_command("get github").path;
+    assert(resolve_vault(path, { "pwdman" }) == -1 && path.name == "github");
+});
+
+unit("command_line", "glob")
+.body([] {
+    auto path = parse_command("get db-*.password").path;
+    assert(path.name == "db-*" && path.element == "password");
+    assert(glob_pattern(path.name) && ! glob_pattern(path.element));
+
+    path = parse_command("remove staging:web-?").path;
+    assert(path.vault == "staging" && glob_pattern(path.name));
+
+    assert(glob_pattern("[ab]c"));
+    assert(! glob_pattern("github") && ! glob_pattern(""));
+});
+
+unit("command_line", "fuzz")
+.body([] {
+    std::mt19937 rng(1);
+    const char alphabet[] = "ab. \\'\"";
+
+    for (int n = 0; n < 100000; ++n) {
+        std::string line;
+        for (size_t len = rng() % 24; len > 0; --len) line.push_back(alphabet[rng() % (sizeof(alphabet) - 1)]);
+
+        std::vector<std::string> expected, actual;
+        bool ok = reference_tokens(line, expected);
+        assert(tokens(line, actual) == ok);
+        if (ok) assert(actual == expected);
+    }
+
+    // escaped strings are read back as one token
+    for (int n = 0; n < 10000; ++n) {
+        std::string s;
+        for (size_t len = 1 + rng() % 16; len > 0; --len) s.push_back("ab. "[rng() % 4]);
+
+        std::vector<std::string> actual;
+        assert(tokens(escape(s), actual));
+        assert(actual.size() == 1 && actual[0] == s);
+    }
+});
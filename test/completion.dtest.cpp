@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2023 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#include <dtest.h>
+#include <completion.h>
+
+static std::vector<std::string> complete(CompletionCache &c, const PasswordStore &s, const std::string &text, bool quoted = false) {
+    auto range = c.complete(s, text, quoted);
+    return std::vector<std::string>(range.begin(), range.end());
+}
+
+unit("completion", "names")
+.body([] {
+    PasswordStore s("password");
+    CompletionCache c;
+
+    for (auto n : { "github", "gitlab", "git hub", "gmail", "bank" }) {
+        s.put(n, "default", "pass");
+    }
+
+    assert((complete(c, s, "gi") == std::vector<std::string> { "git\\ hub", "github", "gitlab" }));
+
+    // narrowed, widened and narrowed again
+    assert((complete(c, s, "git\\") == std::vector<std::string> { "git\\ hub" }));
+    assert((complete(c, s, "gitl") == std::vector<std::string> { "gitlab" }));
+    assert((complete(c, s, "g") == std::vector<std::string> { "git\\ hub", "github", "gitlab", "gmail" }));
+    assert(complete(c, s, "x").empty());
+
+    // unescaped within quotes
+    assert((complete(c, s, "git ", true) == std::vector<std::string> { "git hub" }));
+
+    // changing a value keeps the cache; adding or removing names rebuilds it
+    auto generation = s.generation();
+    s.put("github", "default", "changed");
+    assert(s.generation() == generation);
+
+    s.put("gitea", "default", "pass");
+    s.remove("gitlab");
+    assert((complete(c, s, "gite") == std::vector<std::string> { "gitea" }));
+    assert(complete(c, s, "gitl").empty());
+});
+
+unit("completion", "elements")
+.body([] {
+    PasswordStore s("password");
+    CompletionCache c;
+
+    s.put("my bank", "default", "pass");
+    s.put("my bank", "pin", "1234");
+    s.put("my bank", "user", "me");
+
+    assert((complete(c, s, "my\\ bank.") == std::vector<std::string> { "my\\ bank.default", "my\\ bank.pin", "my\\ bank.user" }));
+    assert((complete(c, s, "my\\ bank.p") == std::vector<std::string> { "my\\ bank.pin" }));
+    assert((complete(c, s, "my bank.u", true) == std::vector<std::string> { "my bank.user" }));
+    assert(complete(c, s, "other.").empty());
+
+    s.remove("my bank", "pin");
+    assert(complete(c, s, "my\\ bank.p").empty());
+});
@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2023 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#include <dtest.h>
+#include <entry_table.h>
+#include <secure_arena.h>
+#include <map>
+#include <random>
+#include <set>
+
+struct TestMeta {
+    uint32_t x;
+};
+
+unit("entry_table", "basic")
+.body([] {
+    EntryTable<TestMeta> t;
+
+    auto i = t.put("github", "default", "pass");
+    t.meta(i).x = 7;
+    t.put("github", "user", "me");
+    t.put("gitlab", "default", "other");
+
+    assert(t.size() == 3);
+    assert(t.names() == 2);
+    assert(t.contains("github") && t.contains("github", "user"));
+    assert(! t.contains("default"));
+    assert(t.value(t.find("github", "default")) == StringRef("pass"));
+    assert(t.meta(t.find("github", "default")).x == 7);
+
+    // elements are chained in insertion order
+    auto first = t.first("github");
+    assert(t.element(first) == StringRef("default"));
+    assert(t.element(t.next(first)) == StringRef("user"));
+    assert(t.next(t.next(first)) == t.NONE);
+
+    // replacing a value resets its meta record
+    i = t.put("github", "default", "changed");
+    assert(t.value(i) == StringRef("changed") && t.meta(i).x == 0);
+
+    assert(t.erase("github", "default"));
+    assert(! t.erase("github", "default"));
+    assert(t.contains("github"));
+    assert(t.erase("github"));
+    assert(! t.contains("github") && t.names() == 1);
+
+    EntryTable<TestMeta> copy(t);
+    copy.put("x", "", "");
+    assert(copy.contains("x", "") && ! t.contains("x"));
+});
+
+unit("entry_table", "random")
+.body([] {
+    EntryTable<TestMeta> t;
+    std::map<std::pair<std::string, std::string>, std::string> expected;
+    std::mt19937 rng(1);
+
+    for (int n = 0; n < 200000; ++n) {
+        auto name = "name" + std::to_string(rng() % 2000);
+        auto element = rng() % 3 ? "element" + std::to_string(rng() % 4) : std::string("default");
+
+        switch (rng() % 4) {
+        case 0:
+        case 1: {
+            auto value = std::to_string(rng());
+            t.put(name, element, value);
+            expected[{ name, element }] = value;
+        }
+        break;
+
+        case 2:
+            assert(t.erase(name, element) == (expected.erase({ name, element }) == 1));
+        break;
+
+        case 3: {
+            bool erased = false;
+            for (auto x = expected.lower_bound({ name, "" }); x != expected.end() && x->first.first == name; ) {
+                x = expected.erase(x);
+                erased = true;
+            }
+            assert(t.erase(name) == erased);
+        }
+        break;
+        }
+    }
+
+    assert(t.size() == expected.size());
+
+    std::set<std::string> names;
+    size_t entries = 0;
+    t.forEachName([&] (StringRef name, uint32_t first) {
+        names.insert(name.str());
+        for (auto i = first; i != t.NONE; i = t.next(i)) {
+            ++entries;
+            assert(expected.at({ name.str(), t.element(i).str() }) == t.value(i).str());
+        }
+    });
+
+    assert(entries == expected.size());
+    assert(names.size() == t.names());
+});
+
+unit("entry_table", "arena")
+.body([] {
+    SecureArena arena;
+    EntryTable<TestMeta> t{ ArenaAllocator<char>(&arena) };
+
+    assert(t.arena() == &arena && arena.size() == 0);
+
+    for (int n = 0; n < 1000; ++n) {
+        t.put("name" + std::to_string(n % 50), "element" + std::to_string(n), "secret" + std::to_string(n));
+    }
+
+    // names, elements and values all live in the arena, including after the
+    // blob has grown and after compaction
+    auto check = [&] (const EntryTable<TestMeta> &table) {
+        table.forEachName([&] (StringRef name, uint32_t first) {
+            assert(arena.contains(name.data));
+            for (auto i = first; i != table.NONE; i = table.next(i)) {
+                assert(arena.contains(table.element(i).data));
+                assert(arena.contains(table.value(i).data));
+            }
+        });
+    };
+
+    check(t);
+    assert(arena.size() > 0);
+
+    for (int n = 0; n < 1000; n += 2) t.erase("name" + std::to_string(n % 50), "element" + std::to_string(n));
+    for (int n = 0; n < 1000; ++n) t.put("name" + std::to_string(n % 50), "element" + std::to_string(n), "other");
+    check(t);
+
+    {
+        EntryTable<TestMeta> copy(t);
+        assert(copy.arena() == &arena);
+        check(copy);
+    }
+
+    // the blob is returned to the arena once the table is gone
+    t.clear();
+    assert(arena.size() == 0);
+});
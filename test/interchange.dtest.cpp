@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2023 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#include <dtest.h>
+#include <interchange.h>
+#include <error.h>
+
+static std::string value(const EntryTable<NoMeta> &t, const std::string &name, const std::string &element) {
+    auto i = t.find(name, element);
+    return i == t.NONE ? "<none>" : t.value(i).str();
+}
+
+static bool malformed(const std::string &text, InterchangeFormat format) {
+    try {
+        parse_entries(text, format);
+        return false;
+    }
+    catch (const Error &) {
+        return true;
+    }
+}
+
+unit("interchange", "csv")
+.body([] {
+    auto t = parse_entries(
+        "name,element,value\n"
+        "github,default,pass\n"
+        "\"my, bank\",pin,\"1\"\"2\r\n3\"\r\n"
+        "\n"
+        "github,default,changed\n",
+        InterchangeFormat::CSV
+    );
+    assert(t.size() == 2);
+    assert(value(t, "github", "default") == "changed");
+    assert(value(t, "my, bank", "pin") == "1\"2\r\n3");
+
+    // as exported by other password managers; unknown columns are ignored
+    t = parse_entries(
+        "\xef\xbb\xbf" "folder,favorite,type,name,notes,fields,login_uri,login_username,login_password,login_totp\n"
+        "work,,login,GitHub,,,https://github.com,me,secret,\n"
+        "work,,login,Bank,\"call first\",,,,1234,\n",
+        InterchangeFormat::CSV
+    );
+    assert(t.size() == 5);
+    assert(value(t, "GitHub", "default") == "secret");
+    assert(value(t, "GitHub", "user") == "me");
+    assert(value(t, "GitHub", "url") == "https://github.com");
+    assert(value(t, "GitHub", "totp") == "<none>");
+    assert(value(t, "Bank", "notes") == "call first");
+
+    assert(malformed("a,b\nx,y\n", InterchangeFormat::CSV));
+    assert(malformed("name,element,value\n\"x,default,y\n", InterchangeFormat::CSV));
+    assert(malformed("name,element,value\nx,y\n", InterchangeFormat::CSV));
+});
+
+unit("interchange", "json")
+.body([] {
+    auto t = parse_entries(
+        "{\n"
+        "    \"github\": {\"default\": \"pass\", \"user\": \"me\"},\n"
+        "    \"q\\\"uote\": \"\\u00e9\\ud83d\\ude00\\n\",\n"
+        "    \"empty\": {}\n"
+        "}\n",
+        InterchangeFormat::JSON
+    );
+    assert(t.size() == 3);
+    assert(value(t, "github", "user") == "me");
+    assert(value(t, "q\"uote", "default") == "\xc3\xa9\xf0\x9f\x98\x80\n");
+
+    assert(parse_entries("{}", InterchangeFormat::JSON).size() == 0);
+    assert(malformed("{\"a\": \"b\"", InterchangeFormat::JSON));
+    assert(malformed("{\"a\": [\"b\"]}", InterchangeFormat::JSON));
+    assert(malformed("{\"a\": \"b\"} x", InterchangeFormat::JSON));
+});
+
+unit("interchange", "chunks")
+.body([] {
+    // large enough to be split into many chunks, with quoted newlines and
+    // commas in every record
+    std::string csv("name,element,value\n"), json("{");
+    const size_t N = 50000;
+    for (size_t i = 0; i < N; ++i) {
+        auto n = std::to_string(i);
+        csv += "\"entry," + n + "\",default,\"line\n" + n + "\"\n";
+        json += (i ? ",\n\"entry," : "\n\"entry,") + n + "\": {\"default\": \"line\\n" + n + "\", \"x\": \"}\"}";
+    }
+    json += "\n}";
+
+    for (auto t : { parse_entries(csv, InterchangeFormat::CSV), parse_entries(json, InterchangeFormat::JSON) }) {
+        assert(t.names() == N);
+        for (size_t i = 0; i < N; i += 997) {
+            auto n = std::to_string(i);
+            assert(value(t, "entry," + n, "default") == "line\n" + n);
+        }
+    }
+});
+
+unit("interchange", "chunks-quotes")
+.body([] {
+    // a quote within an unquoted field is kept as it is, and must not be
+    // taken for the start of a quoted one when splitting into chunks, or
+    // every quoted newline after it would look like the end of a record
+    std::string csv("name,element,value\n" "5\" screen,default,pass\n");
+    const size_t N = 20000;
+    for (size_t i = 0; i < N; ++i) {
+        auto n = std::to_string(i);
+        csv += "\"entry," + n + "\",default,\"line\n" + n + "\"\n";
+    }
+    assert(csv.size() > 4 * 64 * 1024);
+
+    auto t = parse_entries(csv, InterchangeFormat::CSV);
+    assert(t.names() == N + 1);
+    assert(value(t, "5\" screen", "default") == "pass");
+    for (size_t i = 0; i < N; i += 997) {
+        auto n = std::to_string(i);
+        assert(value(t, "entry," + n, "default") == "line\n" + n);
+    }
+
+    // an unterminated quote far into the text is still reported
+    assert(malformed(csv + "\"x,default,y\n", InterchangeFormat::CSV));
+});
+
+unit("interchange", "roundtrip")
+.body([] {
+    PasswordStore s("password");
+    s.put("github", "default", "pa,ss");
+    s.put("github", "user", "\"me\"");
+    s.put("bank", "pin", " 12\n34 ");
+
+    for (auto format : { InterchangeFormat::CSV, InterchangeFormat::JSON }) {
+        PasswordStore r("password");
+        r.putAll(parse_entries(format_entries(s, format), format));
+
+        assert(r.list() == s.list());
+        assert(r.get("github", "user") == "\"me\"");
+        assert(r.get("github", "default") == "pa,ss");
+        assert(r.get("bank", "pin") == " 12\n34 ");
+    }
+
+    assert(interchange_format("dump.JSON") == InterchangeFormat::JSON);
+    assert(interchange_format("dump.csv") == InterchangeFormat::CSV);
+});
@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2023 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#include <dtest.h>
+#include <name_search.h>
+#include <algorithm>
+#include <random>
+
+static std::vector<std::string> paths(const std::vector<SearchResult> &results) {
+    std::vector<std::string> v;
+    for (const auto &r : results) v.push_back(r.element.empty() ? r.name : r.name + "." + r.element);
+    return v;
+}
+
+unit("name_search", "rank")
+.body([] {
+    NameSearch s;
+    s.add("GitHub");
+    s.add("GitHub", "user");
+    s.add("gitlab");
+    s.add("my-github-work");
+    s.add("bank");
+    s.add("google", "token");
+
+    // prefix matches, shorter first, then word starts, then fuzzy matches
+    assert((paths(s.find("git")) == std::vector<std::string> { "GitHub", "gitlab", "GitHub.user", "my-github-work" }));
+    assert((paths(s.find("GH")) == std::vector<std::string> { "GitHub", "GitHub.user", "my-github-work" }));
+    assert((paths(s.find("user")) == std::vector<std::string> { "GitHub.user" }));
+    assert((paths(s.find("hub.u")) == std::vector<std::string> { "GitHub.user" }));
+    assert((paths(s.find("git", 2)) == std::vector<std::string> { "GitHub", "gitlab" }));
+
+    assert(s.find("zz").empty());
+    assert(s.find("").empty());
+
+    auto r = s.find("token");
+    assert(r.size() == 1 && r[0].name == "google" && r[0].element == "token");
+});
+
+unit("name_search", "random")
+.body([] {
+    NameSearch s;
+    std::vector<std::string> names;
+    std::mt19937 rng(1);
+
+    // enough candidates to span several tasks
+    for (int i = 0; i < 100000; ++i) {
+        std::string name;
+        for (size_t n = 1 + rng() % 12; n > 0; --n) name.push_back("abcXYZ-09"[rng() % 9]);
+        names.push_back(name);
+        s.add(name);
+    }
+
+    for (auto pattern : { "ab", "xyz", "a-0", "cab9", "zzzzzz" }) {
+        std::string p(pattern);
+        size_t expected = 0;
+        for (const auto &name : names) {
+            std::string folded(name);
+            std::transform(folded.begin(), folded.end(), folded.begin(), ::tolower);
+            if (folded.find(p) != std::string::npos) ++expected;
+        }
+
+        auto r = s.find(p, names.size());
+        size_t substring = 0;
+        for (size_t i = 0; i < r.size(); ++i) {
+            if (i > 0) assert(r[i - 1].score <= r[i].score);
+
+            std::string folded(r[i].name);
+            std::transform(folded.begin(), folded.end(), folded.begin(), ::tolower);
+            if (folded.find(p) != std::string::npos) ++substring;
+        }
+
+        // every substring match is found, ahead of any fuzzy match
+        assert(substring == expected);
+        assert(r.size() >= expected);
+    }
+});
@@ -6,6 +6,104 @@
 #include <dtest.h>
 #include <password_store.h>
 #include <file.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+class InspectablePasswordStore
+:   public PasswordStore {
+
+public:
+
+    using PasswordStore::PasswordStore;
+
+    size_t segments() const {
+        return _segments.size();
+    }
+
+    void writeVersion(const std::string &path, uint32_t version) const {
+        File file(path.c_str());
+        file.open(File::READ_WRITE | File::CREATE | File::TRUNCATE, 0600);
+        OutputFileSerializer out(file);
+        PasswordStore::writeVersion(out, version);
+        out.flush();
+        file.close();
+    }
+
+    size_t residentValues() const {
+        size_t n = 0;
+        _entries.forEach([&] (uint32_t i) {
+            if (_entries.meta(i).valid && _entries.meta(i).resident) ++n;
+        });
+        return n;
+    }
+
+    size_t dirtySegments() const {
+        size_t n = 0;
+        for (const auto &s : _segments) if (s.dirty) ++n;
+        return n;
+    }
+};
+
+// every entry as name, element and value, in sorted order
+static std::vector<std::string> entries_of(const PasswordStore &s) {
+    std::vector<std::string> entries;
+    s.forEach([&] (StringRef name, StringRef element, StringRef value) {
+        entries.push_back(name.str() + '\0' + element.str() + '\0' + value.str());
+    });
+    std::sort(entries.begin(), entries.end());
+    return entries;
+}
+
+// the fields of a password file in the current format, read and written back
+// as they are, so that tests can rearrange them
+struct RawFile {
+    uint64_t magic;
+    uint32_t version;
+    std::string salt;
+    uint32_t algorithm;
+    uint64_t cost;
+    uint32_t blockSize;
+    uint32_t parallelism;
+    std::string snapshot;
+    uint32_t compression;
+    uint32_t level;
+    uint32_t count;
+    std::string tag;
+    std::vector<std::string> sealed;
+    std::vector<std::string> values;
+
+    explicit RawFile(const std::string &path) {
+        File file(path.c_str());
+        InputFileSerializer in(file);
+
+        in
+            >> magic >> version >> salt
+            >> algorithm >> cost >> blockSize >> parallelism
+            >> snapshot >> compression >> level >> count >> tag;
+
+        sealed.resize(count);
+        values.resize(count);
+        for (uint32_t i = 0; i < count; ++i) in >> sealed[i] >> values[i];
+    }
+
+    void write(const std::string &path) const {
+        File file(path.c_str());
+        file.open(File::READ_WRITE | File::CREATE | File::TRUNCATE, 0600);
+        OutputFileSerializer out(file);
+
+        out
+            << magic << version << salt
+            << algorithm << cost << blockSize << parallelism
+            << snapshot << compression << level << count << tag;
+
+        for (uint32_t i = 0; i < count; ++i) out << sealed[i] << values[i];
+        out.flush();
+        file.close();
+    }
+};
 
 unit("password_store", "serialization")
 .onInit([] {
@@ -38,6 +136,425 @@ unit("password_store", "serialization")
     }
 });
 
+unit("password_store", "segments")
+.onInit([] {
+    File("password_store_segments.test").open(File::CREATE | File::TRUNCATE);
+})
+.onComplete([] {
+    File("password_store_segments.test").remove();
+})
+.body([] {
+    {
+        InspectablePasswordStore s("password");
+        for (int i = 0; i < 2000; ++i) {
+            s.put("name" + std::to_string(i), "default", "pass" + std::to_string(i));
+        }
+        s.put("name0", "user", "me");
+        s.put("name0", "empty", "");
+
+        (OutputFileSerializer(File("password_store_segments.test")) << s).flush();
+        assert(s.segments() > 1);
+        assert(s.dirtySegments() == 0);
+    }
+
+    {
+        InspectablePasswordStore s("password");
+        InputFileSerializer(File("password_store_segments.test")) >> s;
+        assert(s.dirtySegments() == 0);
+        assert(s.get("name1999", "default") == "pass1999");
+        assert(s.get("name0", "user") == "me");
+        assert(s.contains("name0", "empty") && s.get("name0", "empty").empty());
+
+        s.put("name5", "default", "changed");
+        s.remove("name6");
+        assert(s.dirtySegments() <= 2);
+
+        (OutputFileSerializer(File("password_store_segments.test")) << s).flush();
+        assert(s.dirtySegments() == 0);
+    }
+
+    {
+        PasswordStore s("password");
+        InputFileSerializer(File("password_store_segments.test")) >> s;
+        assert(s.get("name5", "default") == "changed");
+        assert(! s.contains("name6"));
+        assert(s.get("name7", "default") == "pass7");
+    }
+
+    {
+        PasswordStore s("password1");
+        try {
+            InputFileSerializer(File("password_store_segments.test")) >> s;
+            fail("Decrypted using invalid password");
+        }
+        catch (...) { }
+    }
+});
+
+unit("password_store", "lazy")
+.onInit([] {
+    File("password_store_lazy.test").open(File::CREATE | File::TRUNCATE);
+})
+.onComplete([] {
+    File("password_store_lazy.test").remove();
+})
+.body([] {
+    {
+        PasswordStore s("password");
+        for (int i = 0; i < 1000; ++i) {
+            s.put("name" + std::to_string(i), "default", "pass" + std::to_string(i));
+            s.put("name" + std::to_string(i), "user", "user" + std::to_string(i));
+        }
+
+        (OutputFileSerializer(File("password_store_lazy.test")) << s).flush();
+    }
+
+    {
+        InspectablePasswordStore s("password", OpenMode::LAZY);
+        InputFileSerializer(File("password_store_lazy.test")) >> s;
+        assert(s.residentValues() == 0);
+        assert(s.contains("name10", "user"));
+        assert(s.elements("name10").size() == 2);
+
+        assert(s.get("name10", "user") == "user10");
+        assert(s.residentValues() == 1);
+        assert(s.get("name11").get("default") == "pass11");
+        assert(s.residentValues() == 3);
+
+        // unresolved values are carried over sealed
+        s.put("name12", "default", "changed");
+        s.put("name1000", "default", "pass1000");
+        (OutputFileSerializer(File("password_store_lazy.test")) << s).flush();
+        assert(s.residentValues() == 5);
+    }
+
+    {
+        PasswordStore s("password");
+        InputFileSerializer(File("password_store_lazy.test")) >> s;
+        assert(s.get("name12", "default") == "changed");
+        assert(s.get("name12", "user") == "user12");
+        assert(s.get("name1000", "default") == "pass1000");
+        assert(s.get("name999", "user") == "user999");
+    }
+});
+
+unit("password_store", "kdf")
+.onInit([] {
+    File("password_store_kdf.test").open(File::CREATE | File::TRUNCATE);
+})
+.onComplete([] {
+    File("password_store_kdf.test").remove();
+})
+.body([] {
+    auto kdf = tune_kdf(KdfAlgorithm::PBKDF2_SHA256, 1, 0.01);
+    assert(kdf.valid());
+
+    {
+        PasswordStore s("password");
+        s.put("mypass", "default", "pass");
+        (OutputFileSerializer(File("password_store_kdf.test")) << s).flush();
+
+        s.rekey(kdf);
+        (OutputFileSerializer(File("password_store_kdf.test")) << s).flush();
+    }
+
+    {
+        PasswordStore s("password");
+        InputFileSerializer(File("password_store_kdf.test")) >> s;
+        assert(s.kdf().algorithm == KdfAlgorithm::PBKDF2_SHA256);
+        assert(s.kdf().cost == kdf.cost);
+        assert(s.get("mypass", "default") == "pass");
+    }
+});
+
+unit("password_store", "kdf-bounds")
+.body([] {
+    assert(KdfParameters::defaults().valid());
+    assert(KdfParameters::defaults().memory() == 128ull * 8 * (1 << 15));
+
+    // 128 * r * N must not wrap around to a small value
+    KdfParameters kdf { KdfAlgorithm::SCRYPT, 1 << 15, 1u << 25, 1 };
+    assert(kdf.memory() > (1ull << 32));
+    assert(! kdf.valid());
+    kdf = KdfParameters { KdfAlgorithm::SCRYPT, 1ull << 62, 1u << 31, 1 };
+    assert(kdf.memory() == UINT64_MAX);
+    assert(! kdf.valid());
+
+    // r and p are capped, however little memory N * r needs
+    kdf = KdfParameters { KdfAlgorithm::SCRYPT, 2, KDF_MAX_BLOCK_SIZE, KDF_MAX_PARALLELISM };
+    assert(kdf.valid());
+    kdf.blockSize = KDF_MAX_BLOCK_SIZE + 1;
+    assert(! kdf.valid());
+    kdf.blockSize = 8;
+    kdf.parallelism = KDF_MAX_PARALLELISM + 1;
+    assert(! kdf.valid());
+    kdf.parallelism = UINT32_MAX;
+    assert(! kdf.valid());
+    kdf.parallelism = 0;
+    assert(! kdf.valid());
+});
+
+unit("password_store", "tamper")
+.onInit([] {
+    File("password_store_tamper.test").open(File::CREATE | File::TRUNCATE);
+})
+.onComplete([] {
+    File("password_store_tamper.test").remove();
+})
+.body([] {
+    {
+        PasswordStore s("password");
+        for (int i = 0; i < 100; ++i) s.put("name" + std::to_string(i), "default", "pass" + std::to_string(i));
+        (OutputFileSerializer(File("password_store_tamper.test")) << s).flush();
+    }
+
+    // flipping any byte past the header, in a segment or in a sealed value,
+    // fails authentication
+    int fd = ::open("password_store_tamper.test", O_RDWR);
+    off_t size = ::lseek(fd, 0, SEEK_END);
+
+    for (off_t offset : { size / 2, size - 1 }) {
+        char c;
+        assert(::pread(fd, &c, 1, offset) == 1);
+        c ^= 1;
+        assert(::pwrite(fd, &c, 1, offset) == 1);
+
+        try {
+            PasswordStore s("password");
+            InputFileSerializer(File("password_store_tamper.test")) >> s;
+            fail("Read a tampered password file");
+        }
+        catch (...) { }
+
+        c ^= 1;
+        assert(::pwrite(fd, &c, 1, offset) == 1);
+    }
+    ::close(fd);
+
+    PasswordStore s("password");
+    InputFileSerializer(File("password_store_tamper.test")) >> s;
+    assert(s.get("name99", "default") == "pass99");
+});
+
+unit("password_store", "legacy")
+.onComplete([] {
+    File("password_store_legacy.test").remove();
+    File("password_store_legacy.current.test").remove();
+})
+.body([] {
+    // every format version ever written is still read, both through the
+    // serializer and from a mapping, and is written back in the current one
+    for (uint32_t version = 0; version <= 10; ++version) {
+        InspectablePasswordStore s("password");
+        s.rekey(KdfParameters { KdfAlgorithm::PBKDF2_SHA256, 1000, 0, 0 });
+
+        // enough names for several segments; version 0 only had defaults
+        for (int i = 0; i < 600; ++i) {
+            s.put("name" + std::to_string(i), "default", "pass" + std::to_string(i));
+            if (version > 0 && i % 3 == 0) s.put("name" + std::to_string(i), "user", "user" + std::to_string(i));
+        }
+        auto expected = entries_of(s);
+
+        s.writeVersion("password_store_legacy.test", version);
+
+        {
+            PasswordStore r("password");
+            InputFileSerializer(File("password_store_legacy.test")) >> r;
+            assert(entries_of(r) == expected);
+
+            PasswordStore m("password", OpenMode::LAZY);
+            m.readFile("password_store_legacy.test");
+            assert(entries_of(m) == expected);
+
+            File file("password_store_legacy.current.test");
+            file.open(File::READ_WRITE | File::CREATE | File::TRUNCATE, 0600);
+            (OutputFileSerializer(file) << r).flush();
+            file.close();
+        }
+
+        PasswordStore r("password");
+        InputFileSerializer(File("password_store_legacy.current.test")) >> r;
+        assert(entries_of(r) == expected);
+
+        try {
+            PasswordStore w("password1");
+            InputFileSerializer(File("password_store_legacy.test")) >> w;
+            fail("Decrypted using invalid password");
+        }
+        catch (...) { }
+    }
+});
+
+unit("password_store", "splice")
+.onComplete([] {
+    File("password_store_splice.old.test").remove();
+    File("password_store_splice.new.test").remove();
+    File("password_store_splice.test").remove();
+})
+.body([] {
+    {
+        PasswordStore s("password");
+        s.put("a", "default", "old1");
+        (OutputFileSerializer(File("password_store_splice.old.test")) << s).flush();
+
+        // the key is kept, and the new value is sealed at the same offset
+        // with the same size
+        s.put("a", "default", "new1");
+        (OutputFileSerializer(File("password_store_splice.new.test")) << s).flush();
+    }
+
+    RawFile older("password_store_splice.old.test"), newer("password_store_splice.new.test");
+    assert(older.count == newer.count && older.salt == newer.salt);
+
+    newer.write("password_store_splice.test");
+    {
+        PasswordStore s("password");
+        InputFileSerializer(File("password_store_splice.test")) >> s;
+        assert(s.get("a", "default") == "new1");
+    }
+
+    // the older value is sealed under the same key, name and element, but the
+    // index of the newer file records the tag of the newer value
+    size_t spliced = 0;
+    for (uint32_t i = 0; i < newer.count; ++i) {
+        if (newer.values[i] != older.values[i]) {
+            assert(newer.values[i].size() == older.values[i].size());
+            newer.values[i] = older.values[i];
+            ++spliced;
+        }
+    }
+    assert(spliced == 1);
+    newer.write("password_store_splice.test");
+
+    try {
+        PasswordStore s("password", OpenMode::LAZY);
+        InputFileSerializer(File("password_store_splice.test")) >> s;
+        s.get("a", "default");
+        fail("Read a value spliced in from an older file");
+    }
+    catch (...) { }
+});
+
+unit("password_store", "compression")
+.onInit([] {
+    File("password_store_compression.test").open(File::CREATE | File::TRUNCATE);
+})
+.onComplete([] {
+    File("password_store_compression.test").remove();
+})
+.body([] {
+    auto size = [] {
+        int fd = ::open("password_store_compression.test", O_RDONLY);
+        off_t n = ::lseek(fd, 0, SEEK_END);
+        ::close(fd);
+        return n;
+    };
+
+    InspectablePasswordStore s("password");
+    for (int i = 0; i < 1000; ++i) s.put("account" + std::to_string(i), "username", "pass" + std::to_string(i));
+    (OutputFileSerializer(File("password_store_compression.test")) << s).flush();
+    auto deflated = size();
+
+    // every segment is rewritten, but sealed values are kept
+    s.recompress(CompressionParameters::deflate(0));
+    assert(s.compression().algorithm == Compression::NONE);
+    assert(s.dirtySegments() == s.segments());
+    assert(s.residentValues() == 1000);
+    (OutputFileSerializer(File("password_store_compression.test")) << s).flush();
+    assert(size() > deflated);
+
+    {
+        PasswordStore r("password");
+        InputFileSerializer(File("password_store_compression.test")) >> r;
+        assert(r.compression().algorithm == Compression::NONE);
+        assert(r.get("account999", "username") == "pass999");
+
+        r.recompress(CompressionParameters::deflate(9));
+        (OutputFileSerializer(File("password_store_compression.test")) << r).flush();
+    }
+
+    PasswordStore r("password");
+    InputFileSerializer(File("password_store_compression.test")) >> r;
+    assert(r.compression().algorithm == Compression::DEFLATE);
+    assert(r.compression().level == 9);
+    assert(r.list().size() == 1000);
+    assert(r.get("account0", "username") == "pass0");
+
+    try {
+        r.recompress(CompressionParameters { Compression::DEFLATE, 10 });
+        fail("Accepted an invalid compression level");
+    }
+    catch (const Error &) { }
+});
+
+unit("password_store", "mapped")
+.onComplete([] {
+    File("password_store_mapped.test").remove();
+    File("password_store_mapped.test.tmp").remove();
+})
+.body([] {
+    {
+        PasswordStore s("password");
+        for (int i = 0; i < 2000; ++i) s.put("name" + std::to_string(i), "default", "pass" + std::to_string(i));
+        (OutputFileSerializer(File("password_store_mapped.test")) << s).flush();
+    }
+
+    InspectablePasswordStore s("password", OpenMode::LAZY);
+    s.readFile("password_store_mapped.test");
+    assert(s.residentValues() == 0);
+    assert(s.get("name7", "default") == "pass7");
+
+    // replaced as Vault does, while clean segments and unopened values are
+    // still read from the mapping of the old file
+    s.put("name8", "default", "changed");
+    (OutputFileSerializer(File("password_store_mapped.test.tmp")) << s).flush();
+    assert(::rename("password_store_mapped.test.tmp", "password_store_mapped.test") == 0);
+    assert(s.get("name1999", "default") == "pass1999");
+
+    PasswordStore r("password");
+    r.readFile("password_store_mapped.test");
+    assert(r.get("name8", "default") == "changed");
+    assert(r.get("name1999", "default") == "pass1999");
+    assert(r.list().size() == 2000);
+
+    try {
+        PasswordStore w("password1");
+        w.readFile("password_store_mapped.test");
+        fail("Decrypted using invalid password");
+    }
+    catch (...) { }
+});
+
+unit("password_store", "mapped-serializer")
+.onComplete([] {
+    File("password_store_mapped_serializer.test").remove();
+})
+.body([] {
+    {
+        PasswordStore s("password");
+        for (int i = 0; i < 3000; ++i) {
+            s.put("name" + std::to_string(i), "default", "pass" + std::to_string(i));
+            if (i % 7 == 0) s.put("name" + std::to_string(i), "user", std::string(i, 'x'));
+        }
+        s.put("empty", "default", "");
+        s.put("large", "default", std::string(1 << 17, 'y'));
+        (OutputFileSerializer(File("password_store_mapped_serializer.test")) << s).flush();
+    }
+
+    // MappedReader parses the layout the serializer writes on its own, so
+    // both must see exactly the same file
+    PasswordStore a("password"), b("password");
+    InputFileSerializer(File("password_store_mapped_serializer.test")) >> a;
+    b.readFile("password_store_mapped_serializer.test");
+
+    assert(entries_of(a).size() == 3000 + 3000 / 7 + 1 + 2);
+    assert(entries_of(a) == entries_of(b));
+    assert(a.snapshot() == b.snapshot());
+    assert(a.kdf().algorithm == b.kdf().algorithm && a.kdf().cost == b.kdf().cost);
+    assert(a.compression().algorithm == b.compression().algorithm);
+    assert(a.compression().level == b.compression().level);
+});
+
 unit("password_store", "list")
 .body([] {
     PasswordStore s("password");
@@ -51,3 +568,103 @@ unit("password_store", "list")
         std::cout << p << std::endl;
     }
 });
+
+unit("password_store", "names")
+.body([] {
+    PasswordStore s("password");
+
+    for (auto n : { "github", "gitlab", "gmail", "bank", "git", "g\xff", "g\xff\xff" }) {
+        s.put(n, "default", "pass");
+    }
+
+    auto l = s.list();
+    assert(l.size() == 7);
+    assert(std::is_sorted(l.begin(), l.end()));
+
+    std::vector<std::string> git(s.names("git").begin(), s.names("git").end());
+    assert(git == std::vector<std::string>({ "git", "github", "gitlab" }));
+
+    assert(std::distance(s.names("g").begin(), s.names("g").end()) == 6);
+    assert(std::distance(s.names("g\xff").begin(), s.names("g\xff").end()) == 2);
+    assert(s.names("x").empty());
+    assert(std::distance(s.names().begin(), s.names().end()) == 7);
+
+    // kept up to date incrementally
+    s.remove("github");
+    s.put("gitea", "default", "pass");
+    s.put("gitlab", "user", "me");
+    s.remove("gitlab", "default");
+    s.remove("gitlab", "user");
+    git.assign(s.names("git").begin(), s.names("git").end());
+    assert(git == std::vector<std::string>({ "git", "gitea" }));
+
+    // rebuilt after untracked modifications
+    s.passwords().put("gitlab", HashMap<std::string, std::string>({ { "default", "pass" } }));
+    git.assign(s.names("git").begin(), s.names("git").end());
+    assert(git == std::vector<std::string>({ "git", "gitea", "gitlab" }));
+});
+
+unit("password_store", "match")
+.body([] {
+    PasswordStore s("password");
+
+    for (auto n : { "staging-web", "staging-db", "staging", "prod-web", "prod-db", "db-main", "db-replica" }) {
+        s.put(n, "default", "pass");
+    }
+    s.put("db-main", "password", "secret");
+    s.put("db-replica", "password", "secret");
+
+    assert(s.match("staging-*") == std::vector<std::string>({ "staging-db", "staging-web" }));
+    assert(s.match("*-web") == std::vector<std::string>({ "prod-web", "staging-web" }));
+    assert(s.match("prod-[dx]?") == std::vector<std::string>({ "prod-db" }));
+    assert(s.match("staging") == std::vector<std::string>({ "staging" }));
+    assert(s.match("x*").empty());
+
+    // journaled as one batch, taken by the next save
+    s.takeJournal();
+    assert(s.removeAll(s.match("staging-*")) == 2);
+    assert(s.removeAll(s.match("db-*"), "password") == 2);
+    assert(s.removeAll({ "nothing" }) == 0);
+    assert(! s.takeJournal().empty());
+
+    assert(s.list() == std::vector<std::string>({ "db-main", "db-replica", "prod-db", "prod-web", "staging" }));
+    assert(! s.contains("db-main", "password"));
+
+    // a name that is itself an entry is taken literally; otherwise, it is a
+    // pattern
+    s.put("a[1]", "default", "pass");
+    s.put("a1", "default", "pass");
+    s.put("a*", "default", "pass");
+    s.put("ab", "default", "pass");
+    assert(s.match("a[1]") == std::vector<std::string>({ "a[1]" }));
+    assert(s.match("a*") == std::vector<std::string>({ "a*" }));
+    assert(s.match("a?") == std::vector<std::string>({ "a*", "a1", "ab" }));
+
+    assert(s.removeAll(s.match("a*")) == 1);
+    s.remove("a[1]");
+    assert(s.match("a[1]") == std::vector<std::string>({ "a1" }));
+    assert(s.match("a*") == std::vector<std::string>({ "a1", "ab" }));
+});
+
+unit("password_store", "find")
+.body([] {
+    PasswordStore s("password");
+
+    s.put("github", "default", "pass");
+    s.put("github", "user", "me");
+    s.put("bank", "default", "pass");
+
+    // default elements are found through their name
+    auto r = s.find("user");
+    assert(r.size() == 1 && r[0].name == "github" && r[0].element == "user");
+    assert(s.find("default").empty());
+
+    // rebuilt after entries are added or removed
+    s.put("gitlab", "default", "pass");
+    assert(s.find("git").size() == 3);
+    s.remove("github", "user");
+    assert(s.find("git").size() == 2);
+    s.remove("github");
+    r = s.find("git");
+    assert(r.size() == 1 && r[0].name == "gitlab");
+});
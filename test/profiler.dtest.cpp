@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2023 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#include <dtest.h>
+#include <profiler.h>
+
+unit("profiler", "record")
+.body([] {
+    auto &p = Profiler::shared();
+    p.clear();
+
+    p.enable(false);
+    {
+        ProfileScope scope("test.disabled");
+    }
+    assert(p.json() == "[]\n");
+
+    p.enable();
+    for (int i = 1; i <= 100; ++i) p.record("test.phase", i);
+    {
+        ProfileScope scope("test", "scope");
+    }
+
+    ProfileTotal total("test.total");
+    for (int i = 0; i < 3; ++i) {
+        total.start();
+        total.stop();
+    }
+    total.record();
+
+    auto json = p.json();
+    assert(json.find("\"phase\":\"test.phase\",\"count\":100,\"total_ms\":5050.000000") != std::string::npos);
+    assert(json.find("\"p50_ms\":51.000000,\"p90_ms\":91.000000,\"p99_ms\":100.000000,\"max_ms\":100.000000") != std::string::npos);
+    assert(json.find("\"phase\":\"test.scope\",\"count\":1") != std::string::npos);
+    assert(json.find("\"phase\":\"test.total\",\"count\":1") != std::string::npos);
+    assert(p.str().find("test.phase") != std::string::npos);
+
+    p.enable(false);
+    p.clear();
+});
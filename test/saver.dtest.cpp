@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2023 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#include <dtest.h>
+#include <saver.h>
+#include <error.h>
+#include <atomic>
+
+using namespace spl;
+
+unit("saver", "coalesce")
+.body([] {
+    std::mutex gate;
+    std::atomic<int> calls(0);
+
+    gate.lock();
+    BackgroundSaver saver([&] () -> std::function<void()> {
+        ++calls;
+        std::lock_guard<std::mutex> lock(gate);
+        return nullptr;
+    });
+
+    saver.request();
+    while (calls == 0) std::this_thread::yield();
+
+    // the first save is being prepared, holding the shared mutex; the
+    // requests made meanwhile are covered by a single follow-up save
+    for (int i = 0; i < 5; ++i) saver.request();
+    assert(saver.saving());
+    assert(! saver.mutex().try_lock());
+
+    gate.unlock();
+    assert(saver.wait());
+    assert(! saver.saving());
+    assert(saver.saves() == 2);
+    assert(calls == 2);
+});
+
+unit("saver", "unlocked-write")
+.body([] {
+    std::mutex gate;
+    std::atomic<int> prepared(0), written(0);
+
+    gate.lock();
+    BackgroundSaver saver([&] {
+        ++prepared;
+        return [&] {
+            std::lock_guard<std::mutex> lock(gate);
+            ++written;
+        };
+    });
+
+    saver.request();
+    while (prepared == 0) std::this_thread::yield();
+
+    // the write is blocked, but the shared state is free to use again
+    assert(saver.saving());
+    {
+        std::unique_lock<std::mutex> lock(saver.mutex(), std::try_to_lock);
+        while (! lock.owns_lock()) lock.try_lock();
+        assert(written == 0);
+    }
+
+    gate.unlock();
+    assert(saver.wait());
+    assert(prepared == 1 && written == 1);
+});
+
+unit("saver", "errors")
+.body([] {
+    int calls = 0;
+    BackgroundSaver saver([&] {
+        return [&] {
+            if (++calls == 1) throw Error("Failed to write password file");
+        };
+    });
+
+    saver.request();
+    assert(! saver.wait());
+    auto errors = saver.errors();
+    assert(errors.size() == 1);
+    assert(errors[0] == "Failed to write password file");
+    assert(saver.errors().empty());
+
+    saver.request();
+    assert(saver.wait());
+});
+
+unit("saver", "autosave")
+.body([] {
+    std::atomic<int> calls(0);
+    {
+        BackgroundSaver saver([&] () -> std::function<void()> { ++calls; return nullptr; }, 3);
+
+        saver.mutated(2);
+        assert(saver.wait());
+        assert(calls == 0);
+
+        saver.mutated();
+        assert(saver.wait());
+        assert(calls == 1);
+
+        // an explicit save starts the count over
+        saver.mutated(2);
+        saver.request();
+        saver.mutated();
+        assert(saver.wait());
+        assert(calls == 2);
+
+        saver.mutated(2);
+    }
+
+    // pending saves are done before the saver goes away
+    calls = 0;
+    {
+        BackgroundSaver saver([&] () -> std::function<void()> { ++calls; return nullptr; });
+        saver.request();
+    }
+    assert(calls == 1);
+});
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2023 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#include <dtest.h>
+#include <secure_arena.h>
+#include <cstddef>
+#include <stdint.h>
+#include <string.h>
+
+unit("secure_arena", "allocate")
+.body([] {
+    SecureArena arena(4096);
+
+    auto a = static_cast<char *>(arena.allocate(3));
+    auto b = static_cast<char *>(arena.allocate(100));
+    assert(reinterpret_cast<uintptr_t>(a) % alignof(std::max_align_t) == 0);
+    assert(reinterpret_cast<uintptr_t>(b) % alignof(std::max_align_t) == 0);
+    assert(b >= a + 3);
+
+    // larger than a chunk
+    auto c = static_cast<char *>(arena.allocate(10000));
+    memset(c, 'x', 10000);
+    assert(arena.size() >= 10000 + 100 + 3);
+
+    ArenaAllocator<char> alloc(&arena);
+    SecureString s(alloc);
+    for (int i = 0; i < 10000; ++i) s.push_back('a' + i % 26);
+    assert(s.size() == 10000);
+    assert(s[9999] == 'a' + 9999 % 26);
+
+    SecureArena::wipe(&s[0], s.size());
+    for (auto ch : s) assert(ch == 0);
+});
+
+unit("secure_arena", "reuse")
+.body([] {
+    SecureArena arena(4096);
+
+    // freed blocks are wiped and handed out again for the same size class
+    auto a = static_cast<char *>(arena.allocate(100));
+    memset(a, 'x', 100);
+    arena.deallocate(a, 100);
+    assert(a[0] == 0 && a[99] == 0);
+    assert(arena.size() == 0);
+    assert(arena.allocate(120) == a);
+    arena.deallocate(a, 120);
+
+    // growing a buffer over and over, as a table does, stays within a
+    // bounded footprint
+    size_t capacity = 16;
+    void *p = arena.allocate(capacity);
+    for (int i = 0; i < 100000; ++i) {
+        size_t grown = capacity < 3000 ? 2 * capacity : 16;
+        void *q = arena.allocate(grown);
+        arena.deallocate(p, capacity);
+        p = q;
+        capacity = grown;
+    }
+    arena.deallocate(p, capacity);
+    assert(arena.size() == 0);
+    assert(arena.mapped() <= 4 * 4096);
+
+    // blocks larger than a chunk are unmapped once freed
+    size_t mapped = arena.mapped();
+    auto large = arena.allocate(100000);
+    assert(arena.mapped() >= mapped + 100000);
+    arena.deallocate(large, 100000);
+    assert(arena.mapped() == mapped);
+
+    // strings that grow and shrink reuse their blocks too
+    ArenaAllocator<char> alloc(&arena);
+    for (int i = 0; i < 10000; ++i) {
+        SecureString s(alloc);
+        s.assign(static_cast<size_t>(1 + i % 2000), 'y');
+    }
+    assert(arena.size() == 0);
+    assert(arena.mapped() <= mapped + 4 * 4096);
+});
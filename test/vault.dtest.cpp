@@ -0,0 +1,334 @@
+/*
+ * Copyright (c) 2023 Noah Orensa.
+ * Licensed under the MIT license. See LICENSE file in the project root for details.
+*/
+
+#include <dtest.h>
+#include <vault.h>
+#include <file.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static void remove_vault(const std::string &path) {
+    ::unlink(path.c_str());
+    ::unlink((path + ".tmp").c_str());
+    ::unlink((path + ".journal").c_str());
+    ::unlink((path + ".journal.next").c_str());
+    ::unlink((path + ".journal.rejected").c_str());
+    ::unlink((path + ".lock").c_str());
+}
+
+unit("vault", "journal")
+.onInit([] {
+    remove_vault("vault_journal.test");
+})
+.onComplete([] {
+    remove_vault("vault_journal.test");
+})
+.body([] {
+    {
+        PasswordStore s("password");
+        Vault v("vault_journal.test", s);
+
+        s.put("a", "default", "1");
+        s.put("b", "default", "2");
+        v.save();
+        assert(v.journalSize() > 0);
+
+        auto size = v.journalSize();
+        s.put("a", "user", "me");
+        s.remove("b");
+        s.put("c", "default", "3");
+        v.save();
+        assert(v.journalSize() > size);
+
+        // nothing to journal
+        size = v.journalSize();
+        v.save();
+        assert(v.journalSize() == size);
+    }
+
+    {
+        PasswordStore s("password", OpenMode::LAZY);
+        Vault v("vault_journal.test", s);
+        v.open();
+
+        assert(s.get("a", "default") == "1");
+        assert(s.get("a", "user") == "me");
+        assert(! s.contains("b"));
+        assert(s.get("c", "default") == "3");
+
+        s.remove("a", "user");
+        v.save();
+    }
+
+    {
+        PasswordStore s("password");
+        Vault v("vault_journal.test", s);
+        v.open();
+
+        assert(! s.contains("a", "user"));
+        assert(s.list().size() == 2);
+    }
+
+    {
+        PasswordStore s("password1");
+        Vault v("vault_journal.test", s);
+        try {
+            v.open();
+            fail("Decrypted using invalid password");
+        }
+        catch (...) { }
+    }
+});
+
+unit("vault", "prepare")
+.onInit([] {
+    remove_vault("vault_prepare.test");
+})
+.onComplete([] {
+    remove_vault("vault_prepare.test");
+})
+.body([] {
+    {
+        PasswordStore s("password");
+        Vault v("vault_prepare.test", s);
+
+        // a snapshot, then a journal record, each written after the store has
+        // moved on; only what was prepared is saved
+        s.put("a", "default", "1");
+        auto write = v.prepare();
+        s.put("b", "default", "2");
+        write();
+        assert(v.journalSize() > 0);
+
+        auto size = v.journalSize();
+        write = v.prepare();
+        s.put("c", "default", "3");
+        write();
+        assert(v.journalSize() > size);
+
+        // the snapshot has the first change only
+        PasswordStore r("password");
+        r.readFile("vault_prepare.test");
+        assert(r.contains("a") && ! r.contains("b"));
+
+        // later changes are taken by the next save
+        v.save();
+    }
+
+    {
+        PasswordStore s("password");
+        Vault v("vault_prepare.test", s);
+        v.open();
+
+        assert(s.get("a", "default") == "1");
+        assert(s.get("b", "default") == "2");
+        assert(s.get("c", "default") == "3");
+    }
+});
+
+unit("vault", "torn-record")
+.onInit([] {
+    remove_vault("vault_torn.test");
+})
+.onComplete([] {
+    remove_vault("vault_torn.test");
+})
+.body([] {
+    size_t size;
+
+    {
+        PasswordStore s("password");
+        Vault v("vault_torn.test", s);
+
+        s.put("a", "default", "1");
+        v.save();
+        s.put("b", "default", "2");
+        v.save();
+        size = v.journalSize();
+    }
+
+    // a save interrupted partway through its record
+    {
+        int fd = ::open("vault_torn.test.journal", O_WRONLY | O_APPEND);
+        uint32_t len = 64;
+        assert(::write(fd, &len, sizeof(len)) == sizeof(len));
+        assert(::write(fd, "partial", 7) == 7);
+        ::close(fd);
+    }
+
+    {
+        PasswordStore s("password");
+        Vault v("vault_torn.test", s);
+        v.open();
+
+        assert(v.journalSize() == size);
+        assert(s.get("a", "default") == "1");
+        assert(s.get("b", "default") == "2");
+
+        s.put("c", "default", "3");
+        v.save();
+    }
+
+    {
+        PasswordStore s("password");
+        Vault v("vault_torn.test", s);
+        v.open();
+
+        assert(s.get("c", "default") == "3");
+    }
+});
+
+unit("vault", "lock")
+.onInit([] {
+    remove_vault("vault_lock.test");
+})
+.onComplete([] {
+    remove_vault("vault_lock.test");
+})
+.body([] {
+    assert(! Vault::inUse("vault_lock.test"));
+
+    {
+        PasswordStore s("password");
+        Vault v("vault_lock.test", s);
+        s.put("a", "default", "1");
+        v.save();
+        assert(Vault::inUse("vault_lock.test"));
+
+        // a second writer would append records with the same sequence numbers
+        PasswordStore t("password");
+        try {
+            Vault w("vault_lock.test", t);
+            fail("Opened a vault that is in use");
+        }
+        catch (const Error &) { }
+
+        s.put("b", "default", "2");
+        v.save();
+    }
+
+    assert(! Vault::inUse("vault_lock.test"));
+
+    PasswordStore s("password");
+    Vault v("vault_lock.test", s);
+    v.open();
+    assert(s.list().size() == 2);
+});
+
+unit("vault", "bad-record")
+.onInit([] {
+    remove_vault("vault_bad.test");
+})
+.onComplete([] {
+    remove_vault("vault_bad.test");
+})
+.body([] {
+    {
+        PasswordStore s("password");
+        Vault v("vault_bad.test", s);
+        // a goes into the first snapshot, and b, c and d into records
+        for (auto n : { "a", "b", "c", "d" }) {
+            s.put(n, "default", n);
+            v.save();
+        }
+    }
+
+    // flip a byte in the second record, which is not the last one
+    {
+        int fd = ::open("vault_bad.test.journal", O_RDWR);
+        off_t size = ::lseek(fd, 0, SEEK_END);
+        uint32_t len;
+        off_t second = 24;
+        assert(::pread(fd, &len, sizeof(len), second) == sizeof(len));
+        second += sizeof(len) + len;
+        assert(second < size);
+
+        char c;
+        assert(::pread(fd, &c, 1, second + 8) == 1);
+        c ^= 1;
+        assert(::pwrite(fd, &c, 1, second + 8) == 1);
+        ::close(fd);
+    }
+
+    {
+        PasswordStore s("password");
+        Vault v("vault_bad.test", s);
+        v.open();
+
+        assert(! v.warning().empty());
+        assert(s.contains("b") && ! s.contains("c") && ! s.contains("d"));
+        assert(File("vault_bad.test.journal.rejected").exists());
+
+        s.put("e", "default", "e");
+        v.save();
+    }
+
+    PasswordStore s("password");
+    Vault v("vault_bad.test", s);
+    v.open();
+    assert(v.warning().empty());
+    assert(s.contains("a") && s.contains("b") && s.contains("e"));
+});
+
+unit("vault", "compaction")
+.onInit([] {
+    remove_vault("vault_compaction.test");
+})
+.onComplete([] {
+    remove_vault("vault_compaction.test");
+})
+.body([] {
+    {
+        PasswordStore s("password");
+        Vault v("vault_compaction.test", s, 512);
+
+        for (int i = 0; i < 100; ++i) {
+            s.put("name" + std::to_string(i), "default", "pass" + std::to_string(i));
+            if (i % 10 == 9) s.remove("name" + std::to_string(i - 5));
+            v.save();
+        }
+
+        v.close();
+        assert(! v.compacting());
+    }
+
+    {
+        PasswordStore s("password");
+        Vault v("vault_compaction.test", s);
+        v.open();
+
+        assert(s.list().size() == 90);
+        for (int i = 0; i < 100; ++i) {
+            auto name = "name" + std::to_string(i);
+            if (i % 10 == 4) {
+                assert(! s.contains(name));
+            }
+            else {
+                assert(s.get(name, "default") == "pass" + std::to_string(i));
+            }
+        }
+    }
+
+    // a rekey cannot be journaled, so it forces a new snapshot
+    {
+        PasswordStore s("password");
+        Vault v("vault_compaction.test", s);
+        v.open();
+
+        s.rekey(tune_kdf(KdfAlgorithm::PBKDF2_SHA256, 1, 0.01));
+        s.put("extra", "default", "x");
+        v.save();
+    }
+
+    {
+        PasswordStore s("password");
+        Vault v("vault_compaction.test", s);
+        v.open();
+
+        assert(s.kdf().algorithm == KdfAlgorithm::PBKDF2_SHA256);
+        assert(s.get("extra", "default") == "x");
+        assert(s.list().size() == 91);
+    }
+});